@@ -0,0 +1,34 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#version 150
+
+// one point per texel of the log luminance grid, moved to its bin
+
+uniform sampler2D luminance;
+uniform int size;      // the grid is size x size
+uniform int bins;
+uniform vec2 range;    // log2 luminance of the first and last bin edges
+
+void main ()
+{
+    ivec2 p = ivec2(gl_VertexID % size, gl_VertexID / size);
+    float l = texelFetch(luminance, p, 0).r;
+    float x = clamp((l - range.x) / (range.y - range.x), 0.0, 1.0);
+    float bin = min(floor(x * float(bins)), float(bins - 1));
+
+    gl_Position = vec4((bin + 0.5) / float(bins) * 2.0 - 1.0, 0.0, 0.0, 1.0);
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#version 150
+
+// first reduction pass: r log2 luminance, g and b luminance for min and max
+
+uniform sampler2D scene_tex;
+
+in vec2 tex_coord;
+out vec4 color;
+
+const vec3 rec709 = vec3(0.2126, 0.7152, 0.0722);
+
+void main ()
+{
+    float lum = max(dot(texture(scene_tex, tex_coord).rgb, rec709), 0.0);
+    color = vec4(log2(max(lum, 1.0e-6)), lum, lum, 1.0);
+}
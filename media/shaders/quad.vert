@@ -0,0 +1,37 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#version 150
+
+// image pixels, y up, to clip space: xy scale, zw offset
+layout(std140) uniform View
+{
+    vec4 transform;
+    vec4 tone;       // x exposure
+};
+
+uniform vec4 rect;      // x, y, width, height in image pixels
+uniform vec4 tex_rect;  // s, t, ds, dt
+
+in vec2 corner;         // the unit square
+out vec2 tex_coord;
+
+void main ()
+{
+    vec2 p = rect.xy + corner * rect.zw;
+    gl_Position = vec4(p * transform.xy + transform.zw, 0.0, 1.0);
+    tex_coord = tex_rect.xy + corner * tex_rect.zw;
+}
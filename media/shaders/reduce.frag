@@ -0,0 +1,37 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#version 150
+
+// halves the lower left corner of source: r mean, g min, b max
+
+uniform sampler2D source;
+
+out vec4 color;
+
+void main ()
+{
+    ivec2 p = ivec2(gl_FragCoord.xy) * 2;
+    vec4 a = texelFetch(source, p, 0);
+    vec4 b = texelFetch(source, p + ivec2(1, 0), 0);
+    vec4 c = texelFetch(source, p + ivec2(0, 1), 0);
+    vec4 d = texelFetch(source, p + ivec2(1, 1), 0);
+
+    color = vec4(0.25 * (a.r + b.r + c.r + d.r),
+                 min(min(a.g, b.g), min(c.g, d.g)),
+                 max(max(a.b, b.b), max(c.b, d.b)),
+                 1.0);
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#version 150
+
+// One operator per program: exactly one TONEMAP_* is defined right after
+// the #version line, so nothing is branched on per pixel.  None is raw.
+
+layout(std140) uniform View
+{
+    vec4 transform;
+    vec4 tone;       // x exposure
+};
+
+uniform sampler2D scene_tex;
+
+in vec2 tex_coord;
+out vec4 color;
+
+#ifndef BRIGHT_THRESHOLD
+#define BRIGHT_THRESHOLD 1.2
+#endif
+#ifndef GAMMA
+#define GAMMA 1.0
+#endif
+#ifndef MIDDLE_GREY
+#define MIDDLE_GREY 0.18
+#endif
+
+const vec3 rec709 = vec3(0.2126, 0.7152, 0.0722);
+
+vec3 srgb_oetf (vec3 c)
+{
+    c = clamp(c, 0.0, 1.0);
+    return mix(c * 12.92, 1.055 * pow(c, vec3(1.0 / 2.4)) - 0.055,
+               step(vec3(0.0031308), c));
+}
+
+void main ()
+{
+    vec3 c = texture(scene_tex, tex_coord).rgb;
+    float exposure = tone.x;
+
+#if defined(TONEMAP_CURVE)
+    // gazer's original curve
+    float yd = exposure * (exposure / BRIGHT_THRESHOLD + 1.0)
+               / (exposure + 1.0);
+    c = pow(max(c * yd, 0.0), vec3(1.0 / GAMMA));
+#elif defined(TONEMAP_REINHARD)
+    c = max(c * exposure, 0.0);
+    c = srgb_oetf(c / (1.0 + dot(c, rec709)));
+#elif defined(TONEMAP_ACES)
+    // Narkowicz's fit of the ACES reference rendering transform
+    c = max(c * exposure, 0.0);
+    c = srgb_oetf((c * (2.51 * c + 0.03)) / (c * (2.43 * c + 0.59) + 0.14));
+#elif defined(TONEMAP_SRGB)
+    c = srgb_oetf(c * exposure);
+#elif defined(TONEMAP_FALSE_COLOR)
+    // a band per two stops around middle grey; grey itself is green
+    const vec3 bands[7] = vec3[7](
+        vec3(0.3, 0.0, 0.5),    // below -5 stops
+        vec3(0.0, 0.0, 1.0),
+        vec3(0.0, 0.7, 1.0),
+        vec3(0.0, 0.8, 0.0),    // -1 to +1
+        vec3(1.0, 1.0, 0.0),
+        vec3(1.0, 0.5, 0.0),
+        vec3(1.0, 0.0, 0.0));   // above +5 stops
+    float lum = max(dot(c * exposure, rec709), 1.0e-6);
+    float stops = log2(lum / MIDDLE_GREY);
+    c = bands[int(clamp(floor((stops + 1.0) / 2.0) + 3.0, 0.0, 6.0))];
+#endif
+
+    color = vec4(c, 1.0);
+}
@@ -0,0 +1,307 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file BatchConverter.cpp
+ * @brief BatchConverter implementation
+ */
+
+/* includes {{{*/
+#include "BatchConverter.h"
+#include "Decoder.h"
+#include "Kernels.h"
+
+#include <stdio.h>
+
+#include <exception>
+#include <vector>
+
+#include <QtCore>
+#include <QImage>
+
+#include <ImfRgbaFile.h>
+/*}}}*/
+
+class ConvertJob : public QRunnable/*{{{*/
+{
+private:
+    BatchConverter* converter;
+    QString fname;
+
+public:
+    ConvertJob (BatchConverter* converter, const QString& fname) :
+        converter(converter),
+        fname(fname)
+    {
+    }
+
+    virtual void run ()
+    {
+        converter->convert(fname);
+    }
+};/*}}}*/
+
+class BandJob : public QRunnable/*{{{*/
+{
+private:
+    BatchConverter* converter;
+    const Image& image;
+    float gain;
+    QImage* proxy;
+    half* exr;
+    int first;
+    int last;
+    QSemaphore& done;
+
+public:
+    BandJob (BatchConverter* converter, const Image& image, float gain,
+             QImage* proxy, half* exr, int first, int last,
+             QSemaphore& done) :
+        converter(converter),
+        image(image),
+        gain(gain),
+        proxy(proxy),
+        exr(exr),
+        first(first),
+        last(last),
+        done(done)
+    {
+    }
+
+    virtual void run ()
+    {
+        converter->tonemap_rows(image, gain, proxy, exr, first, last);
+        done.release();
+    }
+};/*}}}*/
+
+BatchConverter::BatchConverter () :/*{{{*/
+    out_dir("."),
+    format("jpg"),
+    exposure(1.1f),
+    max_size(0),
+    failures(0)
+{
+}/*}}}*/
+BatchConverter::~BatchConverter ()/*{{{*/
+{
+    file_pool.waitForDone();
+    band_pool.waitForDone();
+}/*}}}*/
+
+void BatchConverter::set_output_dir (const QString& dir)/*{{{*/
+{
+    out_dir = dir;
+}/*}}}*/
+void BatchConverter::set_format (const QString& format)/*{{{*/
+{
+    this->format = format.toLower();
+}/*}}}*/
+void BatchConverter::set_exposure (float exposure)/*{{{*/
+{
+    this->exposure = exposure;
+}/*}}}*/
+void BatchConverter::set_max_size (int size)/*{{{*/
+{
+    max_size = qMax(0, size);
+}/*}}}*/
+void BatchConverter::set_jobs (int count)/*{{{*/
+{
+    file_pool.setMaxThreadCount(qMax(1, count));
+}/*}}}*/
+
+/**
+ * Converts every file in @a files and returns how many failed.
+ */
+int BatchConverter::run (const QStringList& files)/*{{{*/
+{
+    failures = 0;
+    foreach (const QString& fname, files) {
+        file_pool.start(new ConvertJob(this, fname));
+    }
+    file_pool.waitForDone();
+    return failures;
+}/*}}}*/
+
+/**
+ * The linear scale tonemap.frag's curve operator applies at @a exposure,
+ * with its BRIGHT_THRESHOLD of 1.2.  Its GAMMA is 1, so the scale is all
+ * there is to it.
+ */
+float BatchConverter::curve_gain (float exposure)/*{{{*/
+{
+    const float bright_threshold = 1.2f;
+    return exposure * (exposure / bright_threshold + 1.0f) / (exposure + 1.0f);
+}/*}}}*/
+
+void BatchConverter::convert (const QString& fname)/*{{{*/
+{
+    try {
+        QString path = output_path(fname);
+
+        ImagePtr image = Decoder::decode(fname);
+        while (max_size > 0
+               && qMax(image->width, image->height) >= 2 * max_size) {
+            image = image->half_size();
+        }
+
+        // the halving stops short of twice the size; the rest is resampled
+        QSize size = output_size(image->width, image->height);
+        float gain = curve_gain(exposure);
+        if (format == "exr") {
+            // from the arena like the decoded image, so both are reused
+            Image exposed (image->width, image->height,
+                           GL_RGBA, GL_HALF_FLOAT_ARB);
+            tonemap(*image, gain, NULL, (half*)exposed.data);
+            const half* pixels = (const half*)exposed.data;
+            std::vector<half> resampled;
+            if (size != QSize(image->width, image->height)) {
+                resampled.resize((size_t)size.width() * size.height() * 4);
+                resample(pixels, image->width, image->height,
+                         &resampled[0], size.width(), size.height());
+                pixels = &resampled[0];
+            }
+
+            Imf::RgbaOutputFile file (qPrintable(path), size.width(),
+                                      size.height(), Imf::WRITE_RGBA);
+            file.setFrameBuffer((const Imf::Rgba*)pixels, 1, size.width());
+            file.writePixels(size.height());
+        } else {
+            QImage proxy (image->width, image->height, QImage::Format_RGB32);
+            if (proxy.isNull()) {
+                throw "out of memory";
+            }
+            tonemap(*image, gain, &proxy, NULL);
+            if (size != proxy.size()) {
+                proxy = proxy.scaled(size, Qt::IgnoreAspectRatio,
+                                     Qt::SmoothTransformation);
+                if (proxy.isNull()) {
+                    throw "out of memory";
+                }
+            }
+            if ( ! proxy.save(path, qPrintable(format), 90)) {
+                throw "could not write output";
+            }
+        }
+
+        printf("%s -> %s\n", qPrintable(fname), qPrintable(path));
+        fflush(stdout);
+    } catch (const char* error) {
+        fprintf(stderr, "%s: %s\n", qPrintable(fname), error);
+        failures.ref();
+    } catch (const std::exception& error) {
+        fprintf(stderr, "%s: %s\n", qPrintable(fname), error.what());
+        failures.ref();
+    }
+}/*}}}*/
+QString BatchConverter::output_path (const QString& fname) const/*{{{*/
+{
+    QFileInfo info (fname);
+    QString path = QDir(out_dir).filePath(info.completeBaseName() + "."
+                                          + format);
+    if (QFileInfo(path).absoluteFilePath() == info.absoluteFilePath()) {
+        throw "output would overwrite the input";
+    }
+    return path;
+}/*}}}*/
+
+/**
+ * Tone maps all of @a image, top row first, into @a proxy or @a exr, in
+ * bands on the band pool; returns when every band is done.
+ */
+void BatchConverter::tonemap (const Image& image, float gain, QImage* proxy, half* exr)/*{{{*/
+{
+    int threads = qMax(1, band_pool.maxThreadCount());
+    int rows = qMax(16, image.height / (4 * threads));
+    int bands = 0;
+    QSemaphore done;
+    for (int y = 0; y < image.height; y += rows) {
+        band_pool.start(new BandJob(this, image, gain, proxy, exr, y,
+                                    qMin(y + rows, image.height), done));
+        bands++;
+    }
+    done.acquire(bands);
+}/*}}}*/
+void BatchConverter::tonemap_rows (const Image& image, float gain, QImage* proxy, half* exr, int first, int last)/*{{{*/
+{
+    size_t w = image.width;
+    std::vector<float> row (w * 4);
+    for (int y = first; y < last; y++) {
+        image.row_to_float(image.flip_y ? y : image.height - 1 - y, &row[0]);
+        if (proxy != NULL) {
+            Kernels::scale_to_bgra8(&row[0], proxy->scanLine(y), w, gain);
+            continue;
+        }
+        half* out = exr + y * w * 4;
+        for (size_t x = 0; x < w; x++) {
+            out[x * 4 + 0] = row[x * 4 + 0] * gain;
+            out[x * 4 + 1] = row[x * 4 + 1] * gain;
+            out[x * 4 + 2] = row[x * 4 + 2] * gain;
+            out[x * 4 + 3] = row[x * 4 + 3];
+        }
+    }
+}/*}}}*/
+
+/**
+ * The size an image of @a width by @a height is written at: its longest
+ * side brought down to max_size, keeping the aspect ratio, or as it is if
+ * it is no larger.
+ */
+QSize BatchConverter::output_size (int width, int height) const/*{{{*/
+{
+    int longest = qMax(width, height);
+    if (max_size <= 0 || longest <= max_size) {
+        return QSize(width, height);
+    }
+    double scale = double(max_size) / longest;
+    return QSize(qMax(1, qRound(width * scale)),
+                 qMax(1, qRound(height * scale)));
+}/*}}}*/
+
+/**
+ * Bilinear resample of the RGBA halfs in @a src down to @a out_width by
+ * @a out_height in @a dst.  The reduction is always under two to one once
+ * the image has been halved, so four taps a pixel do not alias.
+ */
+void BatchConverter::resample (const half* src, int width, int height, half* dst, int out_width, int out_height)/*{{{*/
+{
+    float sx = float(width) / out_width;
+    float sy = float(height) / out_height;
+    for (int y = 0; y < out_height; y++) {
+        float fy = qBound(0.0f, (y + 0.5f) * sy - 0.5f, float(height - 1));
+        int y0 = int(fy);
+        int y1 = qMin(y0 + 1, height - 1);
+        float wy = fy - y0;
+        const half* row0 = src + (size_t)y0 * width * 4;
+        const half* row1 = src + (size_t)y1 * width * 4;
+        half* out = dst + (size_t)y * out_width * 4;
+        for (int x = 0; x < out_width; x++) {
+            float fx = qBound(0.0f, (x + 0.5f) * sx - 0.5f, float(width - 1));
+            int x0 = int(fx);
+            int x1 = qMin(x0 + 1, width - 1);
+            float wx = fx - x0;
+            for (int c = 0; c < 4; c++) {
+                float top = row0[x0 * 4 + c] * (1 - wx)
+                            + row0[x1 * 4 + c] * wx;
+                float bottom = row1[x0 * 4 + c] * (1 - wx)
+                               + row1[x1 * 4 + c] * wx;
+                out[x * 4 + c] = top * (1 - wy) + bottom * wy;
+            }
+        }
+    }
+}/*}}}*/
+
+// vim: sw=4 fdm=marker
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file BatchConverter.h
+ * @brief BatchConverter definition
+ */
+
+#pragma once
+
+#include "Image.h"
+
+#include <half.h>
+
+#include <QAtomicInt>
+#include <QSize>
+#include <QStringList>
+#include <QThreadPool>
+
+class QImage;
+
+/**
+ * Headless proxy generation: decodes files with the viewer's Decoder and
+ * writes them out tone mapped, without a display or a GPU.
+ *
+ * The tone mapping is tonemap.frag's curve operator done on the CPU with
+ * the Kernels, so a proxy looks like the image does in the viewer at the
+ * same exposure.  8-bit formats are clamped and rounded; EXR output keeps
+ * the exposed values as half floats, unclamped.
+ *
+ * Files are converted in parallel on one pool, and each image's rows are
+ * split into bands on another, so one huge frame keeps every core as busy
+ * as thousands of small ones do.
+ */
+class BatchConverter
+{
+    friend class ConvertJob;
+    friend class BandJob;
+
+private:
+    QString out_dir;
+    QString format;       ///< file suffix: "exr" or anything QImage writes
+    float exposure;
+    int max_size;         ///< longest side of the output, 0 for full size
+    QThreadPool file_pool;
+    QThreadPool band_pool;
+    QAtomicInt failures;
+
+public:
+    BatchConverter ();
+    virtual ~BatchConverter ();
+
+    void set_output_dir (const QString& dir);
+    void set_format (const QString& format);
+    void set_exposure (float exposure);
+    void set_max_size (int size);
+    void set_jobs (int count);
+
+    int run (const QStringList& files);
+
+    static float curve_gain (float exposure);
+
+private:
+    void convert (const QString& fname);
+    QString output_path (const QString& fname) const;
+    void tonemap (const Image& image, float gain, QImage* proxy, half* exr);
+    void tonemap_rows (const Image& image, float gain, QImage* proxy,
+                       half* exr, int first, int last);
+    QSize output_size (int width, int height) const;
+    static void resample (const half* src, int width, int height,
+                          half* dst, int out_width, int out_height);
+};
+
+// vim: sw=4 fdm=marker
@@ -0,0 +1,193 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file BufferArena.cpp
+ * @brief BufferArena implementation
+ */
+
+/* includes {{{*/
+#include "BufferArena.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <QList>
+#include <QMutex>
+/*}}}*/
+
+struct ArenaBlock/*{{{*/
+{
+    void* buffer;
+    size_t size;
+};/*}}}*/
+
+struct ArenaState/*{{{*/
+{
+    QMutex mutex;
+    QList<ArenaBlock> free_blocks;   ///< least recently freed first
+    qint64 limit;
+    BufferArena::Stats stats;
+
+    ArenaState () : limit(512 << 20)
+    {
+        memset(&stats, 0, sizeof(stats));
+    }
+};/*}}}*/
+
+static ArenaState& arena ()/*{{{*/
+{
+    static ArenaState a;
+    return a;
+}/*}}}*/
+
+static void unmap (const ArenaBlock& block)/*{{{*/
+{
+    munmap(block.buffer, block.size);
+}/*}}}*/
+
+/**
+ * Unmaps the least recently freed blocks until the cache fits the limit;
+ * call with the mutex held.
+ */
+static void shrink (ArenaState& a)/*{{{*/
+{
+    while ( ! a.free_blocks.isEmpty() && a.stats.cached > a.limit) {
+        ArenaBlock block = a.free_blocks.takeFirst();
+        a.stats.cached -= block.size;
+        unmap(block);
+    }
+}/*}}}*/
+
+/**
+ * Four classes per power of two: at most 25% over what was asked for.
+ */
+size_t BufferArena::size_class (size_t bytes)/*{{{*/
+{
+    size_t power = min_size;
+    while (power * 2 < bytes) {
+        power *= 2;
+    }
+    size_t step = power / 4;
+    return (bytes + step - 1) / step * step;
+}/*}}}*/
+
+/**
+ * A buffer of at least @a bytes, or NULL if there is no memory for it.
+ * Its contents are whatever the last user left.
+ */
+void* BufferArena::allocate (size_t bytes)/*{{{*/
+{
+    if (bytes < min_size) {
+        return malloc(bytes);
+    }
+    size_t size = size_class(bytes);
+    ArenaState& a = arena();
+
+    {
+        QMutexLocker lock (&a.mutex);
+        // the most recently freed block is the likeliest still in cache
+        for (int i = a.free_blocks.size() - 1; i >= 0; i--) {
+            if (a.free_blocks[i].size == size) {
+                void* buffer = a.free_blocks.takeAt(i).buffer;
+                a.stats.cached -= size;
+                a.stats.in_use += size;
+                a.stats.in_use_peak = qMax(a.stats.in_use_peak,
+                                           a.stats.in_use);
+                a.stats.hits++;
+                return buffer;
+            }
+        }
+        // make room first rather than peak at limit plus the new block
+        a.stats.misses++;
+        qint64 limit = a.limit;
+        a.limit = qMax((qint64)0, a.limit - (qint64)size);
+        shrink(a);
+        a.limit = limit;
+    }
+
+    void* buffer = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) {
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    if (size >= huge_page) {
+        madvise(buffer, size, MADV_HUGEPAGE);
+    }
+#endif
+
+    QMutexLocker lock (&a.mutex);
+    a.stats.in_use += size;
+    a.stats.in_use_peak = qMax(a.stats.in_use_peak, a.stats.in_use);
+    a.stats.mapped_peak = qMax(a.stats.mapped_peak,
+                               a.stats.in_use + a.stats.cached);
+    return buffer;
+}/*}}}*/
+/**
+ * Gives back @a buffer, which allocate() returned for the same @a bytes.
+ */
+void BufferArena::release (void* buffer, size_t bytes)/*{{{*/
+{
+    if (buffer == NULL) {
+        return;
+    }
+    if (bytes < min_size) {
+        free(buffer);
+        return;
+    }
+
+    ArenaBlock block = { buffer, size_class(bytes) };
+    ArenaState& a = arena();
+    QMutexLocker lock (&a.mutex);
+    a.stats.in_use -= block.size;
+    a.stats.cached += block.size;
+    a.free_blocks << block;
+    shrink(a);
+}/*}}}*/
+
+/**
+ * How many bytes of freed buffers are kept for reuse.
+ */
+void BufferArena::set_limit (qint64 bytes)/*{{{*/
+{
+    ArenaState& a = arena();
+    QMutexLocker lock (&a.mutex);
+    a.limit = qMax((qint64)0, bytes);
+    shrink(a);
+}/*}}}*/
+/**
+ * Unmaps every cached buffer.
+ */
+void BufferArena::trim ()/*{{{*/
+{
+    ArenaState& a = arena();
+    QMutexLocker lock (&a.mutex);
+    foreach (const ArenaBlock& block, a.free_blocks) {
+        unmap(block);
+    }
+    a.free_blocks.clear();
+    a.stats.cached = 0;
+}/*}}}*/
+BufferArena::Stats BufferArena::stats ()/*{{{*/
+{
+    ArenaState& a = arena();
+    QMutexLocker lock (&a.mutex);
+    return a.stats;
+}/*}}}*/
+
+// vim: sw=4 fdm=marker
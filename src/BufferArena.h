@@ -0,0 +1,70 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file BufferArena.h
+ * @brief BufferArena definition
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#include <QtGlobal>
+
+/**
+ * Recycles the large buffers decoded pixels live in.
+ *
+ * Sizes are rounded up to a class, four per doubling, so a buffer freed
+ * by one image fits the next image of about the same size.  Freed buffers
+ * stay mapped, and their pages faulted in, up to a limit; past it the
+ * least recently freed ones are unmapped.  Browsing a sequence of frames
+ * therefore settles into handing the same few buffers around instead of
+ * mapping, faulting and zeroing hundreds of megabytes a second.
+ *
+ * Buffers of two megabytes or more are backed by transparent huge pages where
+ * the kernel has them.  Small requests go straight to malloc().
+ *
+ * Safe to call from any thread; a buffer may be freed by a different one
+ * than allocated it, as decoded images are.
+ */
+class BufferArena
+{
+public:
+    static const size_t min_size = 256 << 10;   ///< below this, malloc()
+    static const size_t huge_page = 2 << 20;
+
+    struct Stats {
+        qint64 in_use;          ///< bytes handed out now
+        qint64 in_use_peak;
+        qint64 cached;          ///< bytes freed and kept for reuse
+        qint64 mapped_peak;     ///< in use plus cached, at most
+        qint64 hits;            ///< allocations served from the cache
+        qint64 misses;
+    };
+
+public:
+    static void* allocate (size_t bytes);
+    static void release (void* buffer, size_t bytes);
+
+    static void set_limit (qint64 bytes);
+    static void trim ();
+    static Stats stats ();
+
+    static size_t size_class (size_t bytes);
+};
+
+// vim: sw=4 fdm=marker
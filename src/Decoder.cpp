@@ -0,0 +1,676 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file Decoder.cpp
+ * @brief Decoder implementation
+ */
+
+/* includes {{{*/
+#include "Decoder.h"
+#include "RawDecoder.h"
+#include "Profiler.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <QtCore>
+#include <QImage>
+#include <QImageReader>
+
+#include <Iex.h>
+#include <ImfIO.h>
+#include <ImfRgbaFile.h>
+#include <ImfTiledRgbaFile.h>
+#include <ImfTestFile.h>
+#include <ImfThreading.h>
+/*}}}*/
+
+/**
+ * Scanlines per readPixels() call: small enough to notice a cancel and to
+ * stream, big enough to give every IlmImf thread a few line buffers.
+ */
+static int exr_chunk_lines ()/*{{{*/
+{
+    return qMax(64, 32 * 2 * Imf::globalThreadCount());
+}/*}}}*/
+
+/**
+ * The region of a @a full_size image the hints ask for.
+ */
+QRect DecodeHints::region (const QSize& full_size) const/*{{{*/
+{
+    QRect all (QPoint(0, 0), full_size);
+    if (view.isNull()) {
+        return all;
+    }
+    QRect r ((int)floor(view.left() * full_size.width()),
+             (int)floor(view.top() * full_size.height()),
+             (int)ceil(view.width() * full_size.width()) + 1,
+             (int)ceil(view.height() * full_size.height()) + 1);
+    r &= all;
+    return r.isEmpty() ? all : r;
+}/*}}}*/
+/**
+ * The power of two a decoder may divide the resolution by and still meet
+ * the hinted scale.
+ */
+int DecodeHints::reduction () const/*{{{*/
+{
+    int step = 1;
+    if (scale > 0.0f) {
+        while (step < 64 && step * 2 * scale <= 1.0f) {
+            step *= 2;
+        }
+    }
+    return step;
+}/*}}}*/
+/**
+ * These hints grown by a margin, snapped outwards to sixteenths of the
+ * image, and with the scale rounded up to a reduction().  Views a little
+ * pan or zoom apart snap to the same hints, so what is decoded for one
+ * serves the others.
+ */
+DecodeHints DecodeHints::snapped () const/*{{{*/
+{
+    static const float grid = 16.0f;
+
+    DecodeHints s;
+    int step = reduction();
+    s.scale = step > 1 ? 1.0f / step : 0.0f;
+    if (view.isNull()) {
+        return s;
+    }
+
+    float mx = 0.25f * view.width();
+    float my = 0.25f * view.height();
+    QRectF all (0.0f, 0.0f, 1.0f, 1.0f);
+    QRectF r = QRectF(QPointF(floorf((view.left() - mx) * grid) / grid,
+                              floorf((view.top() - my) * grid) / grid),
+                      QPointF(ceilf((view.right() + mx) * grid) / grid,
+                              ceilf((view.bottom() + my) * grid) / grid))
+               & all;
+    if (r != all) {
+        s.view = r;
+    }
+    return s;
+}/*}}}*/
+/**
+ * These hints less what a format with @a capabilities can't act on: the
+ * view if it can't read regions, and the scale if it can't decode at any
+ * reduced size.  The format would leave those out anyway, so two hints
+ * that come out the same here decode to the same pixels.
+ */
+DecodeHints DecodeHints::honoured_by (int capabilities) const/*{{{*/
+{
+    DecodeHints h (*this);
+    if ( ! (capabilities & DecoderFormat::REGIONS)) {
+        h.view = QRectF();
+    }
+    if ( ! (capabilities & (DecoderFormat::MIPMAPS | DecoderFormat::REDUCES
+                            | DecoderFormat::HALF_SIZE))) {
+        h.scale = 0.0f;
+    }
+    return h;
+}/*}}}*/
+/**
+ * Whether @a image already has enough pixels for these hints.
+ */
+bool DecodeHints::satisfied_by (const Image& image) const/*{{{*/
+{
+    if ( ! image.region.contains(region(image.full_size))) {
+        return false;
+    }
+    float needed = (scale <= 0.0f || scale > 1.0f) ? 1.0f : scale;
+    float have = (float)image.width / image.region.width();
+    return have >= needed * 0.99f;
+}/*}}}*/
+
+void Decoder::set_exr_threads (int count)/*{{{*/
+{
+    // shared by every worker decoding an EXR
+    Imf::setGlobalThreadCount(qMax(0, count));
+}/*}}}*/
+
+/**
+ * OpenEXR input from an InputFile, read where OpenEXR seeks to, so tiled
+ * and cropped reads only touch the chunks they decode.
+ */
+class FileIStream : public Imf::IStream/*{{{*/
+{
+private:
+    const InputFile& file;
+    size_t pos;
+
+public:
+    FileIStream (const InputFile& file) :
+        Imf::IStream(QFile::encodeName(file.name()).constData()),
+        file(file),
+        pos(0)
+    {
+    }
+
+    virtual bool read (char c[], int n)
+    {
+        if (n < 0 || pos + n > file.size()) {
+            throw Iex::InputExc("unexpected end of file");
+        }
+        try {
+            file.read(pos, c, n);
+        } catch (const char* error) {
+            throw Iex::InputExc(error);
+        }
+        pos += n;
+        return pos < file.size();
+    }
+
+    virtual Imf::Int64 tellg ()
+    {
+        return pos;
+    }
+
+    virtual void seekg (Imf::Int64 p)
+    {
+        pos = p;
+    }
+};/*}}}*/
+
+/* formats {{{*/
+static bool has_magic (const QByteArray& header, const char* magic, int size)/*{{{*/
+{
+    return header.size() >= size
+           && memcmp(header.constData(), magic, size) == 0;
+}/*}}}*/
+static bool is_tiff (const QByteArray& header)/*{{{*/
+{
+    return has_magic(header, "II*\0", 4) || has_magic(header, "MM\0*", 4);
+}/*}}}*/
+
+class ExrFormat : public DecoderFormat/*{{{*/
+{
+public:
+    virtual const char* name () const { return "OpenEXR"; }
+
+    virtual int capabilities () const
+    {
+        return DEEP | FLOAT | TILES | MIPMAPS | REDUCES | REGIONS | STREAMING;
+    }
+
+    virtual Match sniff (const QByteArray& header, const QString& suffix) const
+    {
+        Q_UNUSED(suffix);
+        return has_magic(header, "\x76\x2f\x31\x01", 4) ? YES : NO;
+    }
+
+    virtual Match sniff_suffix (const QString& suffix) const
+    {
+        return suffix == "exr" || suffix == "sxr" ? MAYBE : NO;
+    }
+
+    virtual ImagePtr decode (const InputFile& file, DecodeContext& context) const
+    {
+        PROFILE_SCOPE("decode exr");
+        return Decoder::decode_exr(file, context);
+    }
+};/*}}}*/
+
+/**
+ * Camera raw; see RawDecoder.  Most raw files are TIFF inside, so a TIFF
+ * header only counts with a raw suffix; the formats with a magic number of
+ * their own are recognised by it.
+ */
+class RawFormat : public DecoderFormat/*{{{*/
+{
+public:
+    virtual const char* name () const { return "camera raw"; }
+
+    virtual int capabilities () const
+    {
+        return DEEP | HALF_SIZE | STREAMING;
+    }
+
+    virtual Match sniff (const QByteArray& header, const QString& suffix) const
+    {
+        static const char* const suffixes[] = {
+            "3fr", "arw", "cr2", "crw", "dcr", "dng", "erf", "kdc", "mef",
+            "mos", "mrw", "nef", "nrw", "orf", "pef", "raf", "rw2", "rwl",
+            "sr2", "srf", "srw", "x3f", NULL
+        };
+        bool raw_suffix = false;
+        for (int i = 0; suffixes[i] != NULL; i++) {
+            raw_suffix = raw_suffix || suffix == suffixes[i];
+        }
+
+        if (has_magic(header, "FUJIFILM", 8)            // RAF
+            || (header.size() >= 14 && header.mid(6, 8) == "HEAPCCDR")  // CRW
+            || has_magic(header, "IIRO", 4) || has_magic(header, "IIRS", 4)
+            || has_magic(header, "MMOR", 4)             // ORF
+            || has_magic(header, "IIU\0", 4)            // RW2
+            || has_magic(header, "\0MRM", 4)            // MRW
+            || has_magic(header, "FOVb", 4)) {          // X3F
+            return YES;
+        }
+        if (is_tiff(header)) {
+            return raw_suffix ? YES : NO;
+        }
+        // some older cameras are only told apart by dcraw from file size
+        return raw_suffix ? MAYBE : NO;
+    }
+
+    virtual ImagePtr decode (const InputFile& file, DecodeContext& context) const
+    {
+        return RawDecoder::decode(file, context);
+    }
+};/*}}}*/
+
+class QImageFormat : public DecoderFormat/*{{{*/
+{
+public:
+    virtual const char* name () const { return "QImage"; }
+
+    virtual int capabilities () const
+    {
+        // QImageReader's clip rect and scaled size
+        return REDUCES | REGIONS;
+    }
+
+    virtual Match sniff (const QByteArray& header, const QString& suffix) const
+    {
+        if (has_magic(header, "\x89PNG", 4)
+            || has_magic(header, "\xff\xd8\xff", 3)
+            || has_magic(header, "GIF8", 4) || has_magic(header, "BM", 2)
+            || (header.size() >= 2 && header[0] == 'P'
+                && header[1] >= '1' && header[1] <= '6')) {
+            return YES;
+        }
+        if (is_tiff(header)) {
+            // also the fallback for raw files dcraw turns down
+            return suffix == "tif" || suffix == "tiff" ? YES : MAYBE;
+        }
+        return QImageReader::supportedImageFormats().contains(suffix.toAscii())
+               ? MAYBE : NO;
+    }
+
+    virtual ImagePtr decode (const InputFile& file, DecodeContext& context) const
+    {
+        PROFILE_SCOPE("decode qimage");
+        return Decoder::decode_qimage(file, context);
+    }
+};/*}}}*/
+
+struct FormatRegistry/*{{{*/
+{
+    QMutex mutex;
+    QList<DecoderFormat*> formats;  ///< in order of preference on a tie
+    QHash<QString, bool> suffixes;  ///< accepts() answers so far
+
+    FormatRegistry ()
+    {
+        formats << new ExrFormat << new RawFormat << new QImageFormat;
+    }
+};/*}}}*/
+static FormatRegistry& registry ()/*{{{*/
+{
+    static FormatRegistry r;
+    return r;
+}/*}}}*/
+/*}}}*/
+
+/**
+ * Adds @a format, which the Decoder then owns, after the built in ones.
+ */
+void Decoder::add_format (DecoderFormat* format)/*{{{*/
+{
+    QMutexLocker lock (&registry().mutex);
+    registry().formats << format;
+    registry().suffixes.clear();
+}/*}}}*/
+/**
+ * Whether any format might read @a fname, by its suffix; the file isn't
+ * opened.  Answers are remembered per suffix, as a directory of frames asks
+ * the same question many thousand times.
+ */
+bool Decoder::accepts (const QString& fname)/*{{{*/
+{
+    QString suffix = QFileInfo(fname).suffix().toLower();
+
+    QMutexLocker lock (&registry().mutex);
+    QHash<QString, bool>::const_iterator known = registry().suffixes.find(suffix);
+    if (known != registry().suffixes.end()) {
+        return known.value();
+    }
+    bool accepted = false;
+    foreach (const DecoderFormat* format, registry().formats) {
+        accepted = accepted || format->sniff_suffix(suffix) != DecoderFormat::NO;
+    }
+    registry().suffixes.insert(suffix, accepted);
+    return accepted;
+}/*}}}*/
+/**
+ * Every format that might read @a file, likeliest first, by its header.
+ */
+QList<const DecoderFormat*> Decoder::candidates (const InputFile& file)/*{{{*/
+{
+    QByteArray header = file.header(header_size);
+    QString suffix = QFileInfo(file.name()).suffix().toLower();
+
+    QList<DecoderFormat*> formats;
+    {
+        QMutexLocker lock (&registry().mutex);
+        formats = registry().formats;
+    }
+
+    QList<const DecoderFormat*> yes, maybe;
+    foreach (const DecoderFormat* format, formats) {
+        switch (format->sniff(header, suffix)) {
+        case DecoderFormat::YES:
+            yes << format;
+            break;
+        case DecoderFormat::MAYBE:
+            maybe << format;
+            break;
+        default:
+            break;
+        }
+    }
+    return yes + maybe;
+}/*}}}*/
+
+ImagePtr Decoder::decode (const QString& fname)/*{{{*/
+{
+    DecodeContext context;
+    return decode(fname, context);
+}/*}}}*/
+/**
+ * Opens the file once; the sniffing and the decoders all read through it.
+ * Each format is handed the hints it honours, and the context is left with
+ * the capabilities of the one that read the file.
+ */
+ImagePtr Decoder::decode (const QString& fname, DecodeContext& context)/*{{{*/
+{
+    context.check();
+    ScopedTimer timer ("decode");
+
+    InputFile file (fname);
+    QList<const DecoderFormat*> formats = candidates(file);
+    if (formats.isEmpty()) {
+        throw "unknown image format";
+    }
+    DecodeHints hints = context.hints;
+    foreach (const DecoderFormat* format, formats) {
+        context.capabilities = format->capabilities();
+        context.hints = hints.honoured_by(context.capabilities);
+        ImagePtr image = format->decode(file, context);
+        if (image) {
+            timer.add_bytes(image->byte_size());
+            return image;
+        }
+        context.check();
+    }
+    throw "image not valid";
+}/*}}}*/
+
+ImagePtr Decoder::decode_exr (const InputFile& input, DecodeContext& context)/*{{{*/
+{
+    FileIStream stream (input);
+    bool tiled = false;
+    if ( ! Imf::isOpenExrFile(stream, tiled)) {
+        throw "invalid exr format";
+    }
+    stream.seekg(0);
+    if (tiled) {
+        return decode_exr_tiled(stream, context);
+    }
+
+    Imf::RgbaInputFile file (stream);
+    Imath::Box2i dw = file.dataWindow();
+    int w = dw.max.x - dw.min.x + 1;
+    int h = dw.max.y - dw.min.y + 1;
+
+    const DecodeHints& hints = context.hints;
+    if (hints.reduction() > 1
+        || hints.region(QSize(w, h)) != QRect(0, 0, w, h)) {
+        return decode_exr_reduced(file, context);
+    }
+    // every chunk is going to be read, so stream all of it in
+    input.will_read(0, input.size());
+
+    ImagePtr image (new Image(w, h, GL_RGBA, GL_HALF_FLOAT_ARB));
+    Imf::Rgba* pix = (Imf::Rgba*)image->data;
+    image->flip_y = true;
+    image->opaque = ! (file.channels() & Imf::WRITE_A);  // read as 1.0
+    image->set_ready_rows(0);
+    context.started(image);
+
+    // the frame buffer base is relative to the data window origin
+    file.setFrameBuffer(pix - dw.min.x - dw.min.y * w, 1, w);
+    int chunk = exr_chunk_lines();
+    for (int y = dw.min.y; y <= dw.max.y; y += chunk) {
+        context.check();
+        int last = qMin(y + chunk - 1, dw.max.y);
+        file.readPixels(y, last);
+        image->set_ready_rows(last - dw.min.y + 1);
+    }
+
+    return image;
+}/*}}}*/
+/**
+ * Scanline files have no levels and can't skip columns, but only the rows
+ * under the hinted view need decompressing.  They are read a chunk at a
+ * time into a scratch buffer and box filtered down by the hinted
+ * reduction into an image of just the view.
+ */
+ImagePtr Decoder::decode_exr_reduced (Imf::RgbaInputFile& file, DecodeContext& context)/*{{{*/
+{
+    Imath::Box2i dw = file.dataWindow();
+    int w = dw.max.x - dw.min.x + 1;
+    int h = dw.max.y - dw.min.y + 1;
+    QSize full_size (w, h);
+    int step = context.hints.reduction();
+    QRect want = context.hints.region(full_size);
+    int ow = (want.width() + step - 1) / step;
+    int oh = (want.height() + step - 1) / step;
+
+    ImagePtr image (new Image(ow, oh, GL_RGBA, GL_HALF_FLOAT_ARB));
+    image->flip_y = true;
+    image->opaque = ! (file.channels() & Imf::WRITE_A);
+    image->full_size = full_size;
+    image->region = QRect(want.topLeft(), QSize(ow * step, oh * step))
+                    & QRect(QPoint(0, 0), full_size);
+    image->set_ready_rows(0);
+    context.started(image);
+
+    // whole output rows per chunk, so no box straddles two of them
+    int chunk_rows = qMax(1, exr_chunk_lines() / step);
+    std::vector<Imf::Rgba> scratch ((size_t)w * chunk_rows * step);
+    std::vector<float> sum ((size_t)ow * 4);
+    for (int oy0 = 0; oy0 < oh; oy0 += chunk_rows) {
+        context.check();
+        int oy1 = qMin(oy0 + chunk_rows, oh);
+        int y0 = want.top() + oy0 * step;
+        int y1 = qMin(want.top() + oy1 * step, want.bottom() + 1);
+        file.setFrameBuffer(&scratch[0] - dw.min.x - (dw.min.y + y0) * w, 1, w);
+        file.readPixels(dw.min.y + y0, dw.min.y + y1 - 1);
+
+        for (int oy = oy0; oy < oy1; oy++) {
+            int ry0 = want.top() + oy * step - y0;
+            int ry1 = qMin(ry0 + step, y1 - y0);
+            std::fill(sum.begin(), sum.end(), 0.0f);
+            for (int ry = ry0; ry < ry1; ry++) {
+                const Imf::Rgba* src = &scratch[(size_t)ry * w + want.left()];
+                for (int x = 0; x < want.width(); x++) {
+                    float* s = &sum[(x / step) * 4];
+                    s[0] += src[x].r;
+                    s[1] += src[x].g;
+                    s[2] += src[x].b;
+                    s[3] += src[x].a;
+                }
+            }
+            Imf::Rgba* dst = (Imf::Rgba*)image->line(oy);
+            for (int ox = 0; ox < ow; ox++) {
+                int cols = qMin(step, want.width() - ox * step);
+                float norm = 1.0f / (cols * (ry1 - ry0));
+                const float* s = &sum[ox * 4];
+                dst[ox] = Imf::Rgba(s[0] * norm, s[1] * norm,
+                                    s[2] * norm, s[3] * norm);
+            }
+        }
+        image->set_ready_rows(oy1);
+    }
+
+    return image;
+}/*}}}*/
+/**
+ * Reads the coarsest level that is still fine enough for the hinted scale,
+ * and of it only the tiles under the hinted view.
+ */
+ImagePtr Decoder::decode_exr_tiled (Imf::IStream& stream, DecodeContext& context)/*{{{*/
+{
+    Imf::TiledRgbaInputFile file (stream);
+    Imath::Box2i dw = file.dataWindow();
+    QSize full_size (dw.max.x - dw.min.x + 1, dw.max.y - dw.min.y + 1);
+    const DecodeHints& hints = context.hints;
+
+    // level
+    int level = 0;
+    int levels = 1;
+    switch (file.levelMode()) {
+    case Imf::MIPMAP_LEVELS:
+        levels = file.numLevels();
+        break;
+    case Imf::RIPMAP_LEVELS:
+        levels = qMin(file.numXLevels(), file.numYLevels());
+        break;
+    default:
+        break;
+    }
+    if (hints.scale > 0.0f && hints.scale < 1.0f) {
+        while (level + 1 < levels
+               && file.levelWidth(level + 1) >= hints.scale * full_size.width()
+               && file.levelHeight(level + 1) >= hints.scale * full_size.height()) {
+            level++;
+        }
+    }
+    Imath::Box2i ldw = file.dataWindowForLevel(level, level);
+    int lw = ldw.max.x - ldw.min.x + 1;
+    int lh = ldw.max.y - ldw.min.y + 1;
+
+    // tiles under the view, in level coordinates relative to ldw.min
+    QRect want = hints.region(QSize(lw, lh));
+    int tw = file.tileXSize();
+    int th = file.tileYSize();
+    int tx0 = want.left() / tw;
+    int tx1 = want.right() / tw;
+    int ty0 = want.top() / th;
+    int ty1 = want.bottom() / th;
+    int px0 = tx0 * tw;
+    int py0 = ty0 * th;
+    int px1 = qMin((tx1 + 1) * tw, lw) - 1;
+    int py1 = qMin((ty1 + 1) * th, lh) - 1;
+    int w = px1 - px0 + 1;
+    int h = py1 - py0 + 1;
+
+    ImagePtr image (new Image(w, h, GL_RGBA, GL_HALF_FLOAT_ARB));
+    Imf::Rgba* pix = (Imf::Rgba*)image->data;
+    image->flip_y = true;
+    image->opaque = ! (file.channels() & Imf::WRITE_A);
+    image->full_size = full_size;
+    double sx = (double)full_size.width() / lw;
+    double sy = (double)full_size.height() / lh;
+    image->region = QRect((int)(px0 * sx), (int)(py0 * sy),
+                          (int)ceil(w * sx), (int)ceil(h * sy))
+                    & QRect(QPoint(0, 0), full_size);
+    image->set_ready_rows(0);
+    context.started(image);
+
+    file.setFrameBuffer(pix - (ldw.min.x + px0) - (ldw.min.y + py0) * w, 1, w);
+    for (int ty = ty0; ty <= ty1; ty++) {
+        context.check();
+        file.readTiles(tx0, tx1, ty, ty, level, level);
+        image->set_ready_rows(qMin((ty + 1) * th, lh) - py0);
+    }
+
+    return image;
+}/*}}}*/
+/**
+ * Clipped to the hinted view and scaled down by the hinted reduction as it
+ * is read; the JPEG reader does both while decoding, the others after.
+ */
+ImagePtr Decoder::decode_qimage (const InputFile& file, DecodeContext& context)/*{{{*/
+{
+    QByteArray bytes = QByteArray::fromRawData(file.data(), (int)file.size());
+    QBuffer buffer (&bytes);
+    buffer.open(QIODevice::ReadOnly);
+    // a suffix helps the formats that have no magic number; the content
+    // is still sniffed if it's wrong
+    QImageReader reader (&buffer,
+                         QFileInfo(file.name()).suffix().toLower().toAscii());
+
+    QSize full_size = reader.size();
+    QRect clip;
+    int step = context.hints.reduction();
+    if (full_size.isValid()) {
+        QSize scaled ((full_size.width() + step - 1) / step,
+                      (full_size.height() + step - 1) / step);
+        QRect want = context.hints.region(full_size);
+        clip = QRect(want.left() / step, want.top() / step,
+                     (want.width() + step - 1) / step,
+                     (want.height() + step - 1) / step)
+               & QRect(QPoint(0, 0), scaled);
+        if (step > 1) {
+            reader.setScaledSize(scaled);
+        }
+        if (clip.size() != scaled) {
+            reader.setScaledClipRect(clip);
+        }
+    }
+
+    QImage img = reader.read();
+    if (img.isNull()) {
+        return ImagePtr();
+    }
+    context.check();
+    ImagePtr image = from_qimage(img);
+    if (full_size.isValid() && img.size() != full_size) {
+        image->full_size = full_size;
+        image->region = QRect(clip.topLeft() * step, clip.size() * step)
+                        & QRect(QPoint(0, 0), full_size);
+    }
+    return image;
+}/*}}}*/
+/**
+ * A copy of @a img's pixels, top row first, as 8-bit BGRA.
+ */
+ImagePtr Decoder::from_qimage (const QImage& img)/*{{{*/
+{
+    const QImage argb = img.convertToFormat(QImage::Format_ARGB32);
+
+    // ARGB32 is stored as native 32-bit words, which BGRA/8_8_8_8_REV matches
+    ImagePtr image (new Image(argb.width(), argb.height(),
+                              GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV));
+    for (int y = 0; y < argb.height(); y++) {
+        memcpy(image->line(y), argb.scanLine(y), image->bytes_per_line());
+    }
+
+    image->flip_y = true;
+    image->opaque = ! img.hasAlphaChannel();
+    return image;
+}/*}}}*/
+
+// vim: sw=4 fdm=marker
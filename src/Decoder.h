@@ -0,0 +1,231 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file Decoder.h
+ * @brief Decoder definition
+ */
+
+#pragma once
+
+#include "Image.h"
+#include "InputFile.h"
+
+#include <ImfIO.h>
+#include <ImfRgbaFile.h>
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QList>
+#include <QRectF>
+
+class QImage;
+class QString;
+
+/**
+ * Shared flag a decode polls to find out it is no longer wanted.
+ *
+ * Copies refer to the same flag, so the loader keeps one and hands another
+ * to the worker.
+ */
+class CancelToken
+{
+private:
+    QSharedPointer<QAtomicInt> flag;
+
+public:
+    CancelToken () : flag(new QAtomicInt(0)) {}
+
+    void cancel () { flag->fetchAndStoreOrdered(1); }
+    bool cancelled () const { return *flag != 0; }
+
+    bool operator== (const CancelToken& other) const
+    {
+        return flag == other.flag;
+    }
+};
+
+/**
+ * Thrown out of a decode once its CancelToken has been cancelled.
+ */
+struct DecodeCancelled
+{
+};
+
+/**
+ * How much of an image the viewer actually needs.
+ *
+ * Decoders use these to skip what isn't needed: tiled OpenEXR reads a
+ * level and the tiles under the view, scanline OpenEXR only the rows under
+ * it, reduced by reduction(), and QImageReader clips and scales as it
+ * decodes, which for JPEG saves most of the work.  Raw files only come in
+ * half size.  What each format acts on is in its DecoderFormat capabilities,
+ * and honoured_by() takes out the rest.
+ */
+class DecodeHints
+{
+public:
+    float scale;  ///< screen pixels per image pixel; 0 means full resolution
+    QRectF view;  ///< visible part, normalized to [0,1] with y down; null is all
+
+public:
+    DecodeHints () : scale(0.0f) {}
+
+    QRect region (const QSize& full_size) const;
+    int reduction () const;
+    DecodeHints snapped () const;
+    DecodeHints honoured_by (int capabilities) const;
+    bool satisfied_by (const Image& image) const;
+};
+
+/**
+ * What a decode needs to know besides the file name.
+ *
+ * Streaming decoders call started() as soon as the pixel buffer exists and
+ * then publish rows through Image::set_ready_rows(), so the caller can show
+ * the image while it is still arriving.  Decoders with a cheap rendition
+ * of the file hand it to preview() first.
+ */
+class DecodeContext
+{
+public:
+    CancelToken cancel;
+    DecodeHints hints;
+    int capabilities;  ///< of the format decoding; all (-1) until one is picked
+
+public:
+    DecodeContext () : capabilities(-1) {}
+    DecodeContext (const CancelToken& cancel, const DecodeHints& hints) :
+        cancel(cancel),
+        hints(hints),
+        capabilities(-1)
+    {
+    }
+    virtual ~DecodeContext () {}
+
+    void check () const
+    {
+        if (cancel.cancelled()) {
+            throw DecodeCancelled();
+        }
+    }
+
+    virtual void started (const ImagePtr& image) { Q_UNUSED(image); }
+
+    /**
+     * A quick, coarser stand-in for the image still being decoded, such
+     * as a raw file's embedded preview, to show until the decode is done.
+     */
+    virtual void preview (const ImagePtr& image) { Q_UNUSED(image); }
+};
+
+/**
+ * One file format the Decoder can read.
+ *
+ * sniff() looks at the first header_size bytes of a file, and at its
+ * lower case suffix for containers several formats share (TIFF based raw
+ * files), and says how sure it is the file is its own.  decode() reads
+ * the InputFile, all of it or the ranges it needs, and returns a null
+ * image for a file that turns out not to be its own after all; the next
+ * likeliest format gets it then.
+ *
+ * Formats are shared between worker threads, so they keep no state.
+ */
+class DecoderFormat
+{
+public:
+    enum Capability {
+        DEEP = 1 << 0,       ///< more than 8 bits per sample
+        FLOAT = 1 << 1,      ///< scene referred, above 1.0
+        TILES = 1 << 2,
+        MIPMAPS = 1 << 3,    ///< reads stored levels for DecodeHints::scale
+        REDUCES = 1 << 4,    ///< decodes at any DecodeHints::reduction()
+        HALF_SIZE = 1 << 5,  ///< decodes at half size, but no smaller
+        REGIONS = 1 << 6,    ///< reads only DecodeHints::view
+        STREAMING = 1 << 7   ///< calls DecodeContext::started()
+    };
+
+    enum Match {
+        NO = 0,
+        MAYBE = 1,           ///< shared container, or suffix only
+        YES = 2              ///< its own magic number
+    };
+
+public:
+    virtual ~DecoderFormat () {}
+
+    virtual const char* name () const = 0;
+    virtual int capabilities () const = 0;
+    virtual Match sniff (const QByteArray& header,
+                         const QString& suffix) const = 0;
+    virtual ImagePtr decode (const InputFile& file,
+                             DecodeContext& context) const = 0;
+
+    /**
+     * Whether a file might be this format going by its suffix alone, for
+     * listing directories without opening every file.
+     */
+    virtual Match sniff_suffix (const QString& suffix) const
+    {
+        return sniff(QByteArray(), suffix);
+    }
+};
+
+/**
+ * Turns a file into an Image.
+ *
+ * The format is picked from the file's first bytes through the registered
+ * DecoderFormats, best match first; the built in ones are OpenEXR, camera
+ * raw through RawDecoder and whatever QImage reads.  add_format() adds more
+ * without touching anything else.
+ *
+ * Everything here is safe to call from worker threads: no GL calls and no
+ * QObject parented to a GUI object.  Failures throw a const char*; a
+ * cancelled decode throws DecodeCancelled at the next convenient point.
+ */
+class Decoder
+{
+    friend class ExrFormat;
+    friend class QImageFormat;
+
+public:
+    static const int header_size = 32;
+
+public:
+    static ImagePtr decode (const QString& fname);
+    static ImagePtr decode (const QString& fname, DecodeContext& context);
+
+    static void add_format (DecoderFormat* format);
+    static bool accepts (const QString& fname);
+
+    static void set_exr_threads (int count);
+
+    static ImagePtr from_qimage (const QImage& image);
+
+private:
+    static QList<const DecoderFormat*> candidates (const InputFile& file);
+
+    static ImagePtr decode_exr (const InputFile& file,
+                                DecodeContext& context);
+    static ImagePtr decode_exr_reduced (Imf::RgbaInputFile& file,
+                                        DecodeContext& context);
+    static ImagePtr decode_exr_tiled (Imf::IStream& stream,
+                                      DecodeContext& context);
+    static ImagePtr decode_qimage (const InputFile& file,
+                                   DecodeContext& context);
+};
+
+// vim: sw=4 fdm=marker
@@ -0,0 +1,214 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file DirectoryScanner.cpp
+ * @brief DirectoryScanner implementation
+ */
+
+/* includes {{{*/
+#include "DirectoryScanner.moc"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include <QtCore>
+/*}}}*/
+
+class ScanJob : public QRunnable/*{{{*/
+{
+private:
+    DirectoryScanner* scanner;
+    QString dir;
+    QString always;
+    CancelToken cancel;
+    int generation;
+
+public:
+    ScanJob (DirectoryScanner* scanner, const QString& dir,
+             const QString& always, const CancelToken& cancel,
+             int generation) :
+        scanner(scanner),
+        dir(dir),
+        always(always),
+        cancel(cancel),
+        generation(generation)
+    {
+    }
+
+    virtual void run ()
+    {
+        QDirIterator it (dir, QDir::Files);
+        QHash<QString, bool> suffixes;  // saves the registry lock per file
+        QStringList batch;
+        int batch_size = DirectoryScanner::first_batch;
+        while (it.hasNext() && ! cancel.cancelled()) {
+            it.next();
+            QString name = it.fileName();
+            QString suffix = it.fileInfo().suffix();
+            QHash<QString, bool>::iterator known = suffixes.find(suffix);
+            if (known == suffixes.end()) {
+                known = suffixes.insert(suffix, Decoder::accepts(name));
+            }
+            if ( ! known.value() && name != always) {
+                continue;
+            }
+
+            batch << name;
+            if (batch.size() >= batch_size) {
+                batch.sort();
+                emit scanner->batch_ready(generation, batch, false);
+                batch.clear();
+                batch_size = qMin(batch_size * 2, (int)DirectoryScanner::max_batch);
+            }
+        }
+        batch.sort();
+        emit scanner->batch_ready(generation, batch, true);
+    }
+};/*}}}*/
+
+DirectoryScanner::DirectoryScanner (QObject* parent) :/*{{{*/
+    QObject(parent),
+    generation(0),
+    busy(false),
+    notify_fd(-1),
+    watch(-1),
+    notifier(NULL)
+{
+    pool.setMaxThreadCount(1);
+
+    connect(this, SIGNAL(batch_ready(int,QStringList,bool)),
+            this, SLOT(deliver(int,QStringList,bool)),
+            Qt::QueuedConnection);
+
+    notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (notify_fd < 0) {
+        qDebug() << "inotify:" << strerror(errno);
+        return;  // scans still work, new files just aren't noticed
+    }
+    notifier = new QSocketNotifier(notify_fd, QSocketNotifier::Read, this);
+    connect(notifier, SIGNAL(activated(int)), this, SLOT(read_events()));
+}/*}}}*/
+DirectoryScanner::~DirectoryScanner ()/*{{{*/
+{
+    stop();
+    pool.waitForDone();
+    if (notify_fd >= 0) {
+        delete notifier;
+        close(notify_fd);
+    }
+}/*}}}*/
+
+/**
+ * Replaces any scan in progress with one of @a dir, which is also watched
+ * from now on.  @a always is listed even if no decoder claims its suffix,
+ * so the file the user picked is never left out.
+ */
+void DirectoryScanner::scan (const QString& dir, const QString& always)/*{{{*/
+{
+    stop();
+    this->dir = QDir(dir).absolutePath();
+    this->always = always;
+
+    // watched first, so a file finished during the scan is found either way
+    if (notify_fd >= 0) {
+        watch = inotify_add_watch(notify_fd, QFile::encodeName(this->dir),
+                                  IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (watch < 0) {
+            qDebug() << "inotify:" << this->dir << strerror(errno);
+        }
+    }
+
+    cancel = CancelToken();
+    busy = true;
+    pool.start(new ScanJob(this, this->dir, always, cancel, generation));
+}/*}}}*/
+/**
+ * Cancels the scan and stops watching; nothing more is reported.
+ */
+void DirectoryScanner::stop ()/*{{{*/
+{
+    cancel.cancel();
+    generation++;
+    busy = false;
+    unwatch();
+}/*}}}*/
+
+const QString& DirectoryScanner::directory () const/*{{{*/
+{
+    return dir;
+}/*}}}*/
+bool DirectoryScanner::scanning () const/*{{{*/
+{
+    return busy;
+}/*}}}*/
+
+void DirectoryScanner::deliver (int generation, const QStringList& names, bool last)/*{{{*/
+{
+    if (generation != this->generation) {
+        return;  // from a directory since left
+    }
+    if ( ! names.isEmpty()) {
+        emit files_found(names);
+    }
+    if (last) {
+        busy = false;
+        emit finished();
+    }
+}/*}}}*/
+/**
+ * New files in the watched directory: written and closed, or moved in,
+ * which is how renderers that write to a temporary name finish a frame.
+ */
+void DirectoryScanner::read_events ()/*{{{*/
+{
+    char buffer[64 * 1024]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    QStringList names;
+    ssize_t length;
+    while ((length = read(notify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char* p = buffer; p < buffer + length;) {
+            const struct inotify_event* event = (const struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (event->wd != watch || event->len == 0
+                || (event->mask & IN_ISDIR)) {
+                continue;  // a directory left behind, or a subdirectory
+            }
+            QString name = QFile::decodeName(event->name);
+            if (Decoder::accepts(name)) {
+                names << name;
+            }
+        }
+    }
+    if ( ! names.isEmpty()) {
+        names.sort();
+        names.removeDuplicates();
+        emit files_found(names);
+    }
+}/*}}}*/
+
+void DirectoryScanner::unwatch ()/*{{{*/
+{
+    if (watch >= 0) {
+        inotify_rm_watch(notify_fd, watch);
+        watch = -1;
+    }
+}/*}}}*/
+
+// vim: sw=4 fdm=marker
@@ -0,0 +1,93 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file DirectoryScanner.h
+ * @brief DirectoryScanner definition
+ */
+
+#pragma once
+
+#include "Decoder.h"
+
+#include <QObject>
+#include <QStringList>
+#include <QThreadPool>
+
+class QSocketNotifier;
+
+/**
+ * Lists a directory on a worker thread, in batches, and keeps watching it.
+ *
+ * Only names are read, never the files: whether a file is wanted goes by
+ * its suffix, see Decoder::accepts().  Each batch is sorted by name before
+ * it is handed over; the first ones are small so something shows at once,
+ * later ones grow so a directory of a couple of hundred thousand frames
+ * isn't merged a few names at a time.  Files finished in the directory
+ * afterwards, as a renderer writes them, are reported the same way through
+ * inotify.  Names are relative to the directory.
+ *
+ * Batches of a scan that has been replaced are never delivered.
+ */
+class DirectoryScanner : public QObject
+{
+    Q_OBJECT
+
+    friend class ScanJob;
+
+public:
+    static const int first_batch = 256;
+    static const int max_batch = 16384;
+
+private:
+    QThreadPool pool;
+    CancelToken cancel;
+    int generation;     ///< of the current scan; stale batches are dropped
+    bool busy;
+    QString dir;
+    QString always;     ///< listed whatever its suffix
+
+    int notify_fd;
+    int watch;
+    QSocketNotifier* notifier;
+
+public:
+    DirectoryScanner (QObject* parent = NULL);
+    virtual ~DirectoryScanner ();
+
+    void scan (const QString& dir, const QString& always = QString());
+    void stop ();
+
+    const QString& directory () const;
+    bool scanning () const;
+
+signals:
+    /// Sorted; may repeat names already found.
+    void files_found (const QStringList& names);
+    void finished ();
+
+    /// from the ScanJob to deliver(), across threads
+    void batch_ready (int generation, const QStringList& names, bool last);
+
+private slots:
+    void deliver (int generation, const QStringList& names, bool last);
+    void read_events ();
+
+private:
+    void unwatch ();
+};
+
+// vim: sw=4 fdm=marker
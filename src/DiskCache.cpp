@@ -0,0 +1,296 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file DiskCache.cpp
+ * @brief DiskCache implementation
+ */
+
+/* includes {{{*/
+#include "DiskCache.h"
+
+#include <string.h>
+#include <utime.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+#include <half.h>
+/*}}}*/
+
+const int DiskCache::thumbnail_size;
+
+static const char magic[4] = { 'G', 'Z', 'P', 'V' };
+static const quint32 version = 1;
+static const int prune_interval = 64;  ///< writes between prunes
+
+/**
+ * Start of every entry.  Offsets are from the start of the file and keep
+ * the pixels 64 byte aligned.
+ */
+struct EntryHeader/*{{{*/
+{
+    char magic[4];
+    quint32 version;
+    qint32 full_width;
+    qint32 full_height;
+    qint32 thumbnail_width;
+    qint32 thumbnail_height;
+    qint32 preview_width;
+    qint32 preview_height;
+    quint64 thumbnail_offset;   ///< GL_RGBA, GL_UNSIGNED_BYTE
+    quint64 preview_offset;     ///< GL_RGBA, GL_HALF_FLOAT_ARB
+};/*}}}*/
+
+static quint64 align64 (quint64 offset)/*{{{*/
+{
+    return (offset + 63) & ~(quint64)63;
+}/*}}}*/
+
+DiskCache::DiskCache () :/*{{{*/
+    preview_size(2048),
+    budget(2048LL << 20),
+    writes(0)
+{
+}/*}}}*/
+DiskCache::~DiskCache ()/*{{{*/
+{
+}/*}}}*/
+
+void DiskCache::set_dir (const QString& dir)/*{{{*/
+{
+    this->dir = dir;
+    if ( ! dir.isEmpty()) {
+        QDir().mkpath(dir);
+    }
+}/*}}}*/
+void DiskCache::set_preview_size (int size)/*{{{*/
+{
+    preview_size = qMax(thumbnail_size, size);
+}/*}}}*/
+void DiskCache::set_budget (qint64 budget_bytes)/*{{{*/
+{
+    budget = budget_bytes;
+}/*}}}*/
+
+bool DiskCache::contains (const QString& fname) const/*{{{*/
+{
+    return ! dir.isEmpty() && QFile::exists(path_for(fname));
+}/*}}}*/
+ImagePtr DiskCache::preview (const QString& fname) const/*{{{*/
+{
+    return read(fname, false);
+}/*}}}*/
+ImagePtr DiskCache::thumbnail (const QString& fname) const/*{{{*/
+{
+    return read(fname, true);
+}/*}}}*/
+
+/**
+ * Writes the entry for @a fname from its decoded @a image: a box filtered
+ * preview no larger than preview_size and a thumbnail box filtered from
+ * that.  The entry appears atomically, so readers never see half of one.
+ */
+void DiskCache::store (const QString& fname, const Image& image)/*{{{*/
+{
+    if (dir.isEmpty()) {
+        return;
+    }
+
+    /* preview {{{*/
+    int step = qMax(1, (qMax(image.width, image.height) + preview_size - 1)
+                       / preview_size);
+    int pw = (image.width + step - 1) / step;
+    int ph = (image.height + step - 1) / step;
+    std::vector<uint16_t> preview ((size_t)pw * ph * 4);
+    std::vector<float> row ((size_t)image.width * 4);
+    std::vector<float> sum ((size_t)pw * 4);
+    for (int py = 0; py < ph; py++) {
+        std::fill(sum.begin(), sum.end(), 0.0f);
+        int y0 = py * step;
+        int y1 = qMin(y0 + step, image.height);
+        for (int y = y0; y < y1; y++) {
+            // top row first, whichever way the image is stored
+            image.row_to_float(image.flip_y ? y : image.height - 1 - y,
+                               &row[0]);
+            for (int x = 0; x < image.width; x++) {
+                float* s = &sum[(x / step) * 4];
+                const float* p = &row[x * 4];
+                s[0] += p[0];
+                s[1] += p[1];
+                s[2] += p[2];
+                s[3] += p[3];
+            }
+        }
+        for (int px = 0; px < pw; px++) {
+            int cols = qMin(step, image.width - px * step);
+            float norm = 1.0f / (cols * (y1 - y0));
+            for (int c = 0; c < 4; c++) {
+                half h = sum[px * 4 + c] * norm;
+                preview[((size_t)py * pw + px) * 4 + c] = h.bits();
+            }
+        }
+    }
+    /*}}}*/
+
+    /* thumbnail {{{*/
+    int tstep = qMax(1, (qMax(pw, ph) + thumbnail_size - 1) / thumbnail_size);
+    int tw = (pw + tstep - 1) / tstep;
+    int th = (ph + tstep - 1) / tstep;
+    std::vector<uint8_t> thumbnail ((size_t)tw * th * 4);
+    for (int ty = 0; ty < th; ty++) {
+        for (int tx = 0; tx < tw; tx++) {
+            float s[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            int count = 0;
+            for (int y = ty * tstep; y < qMin((ty + 1) * tstep, ph); y++) {
+                for (int x = tx * tstep; x < qMin((tx + 1) * tstep, pw); x++) {
+                    for (int c = 0; c < 4; c++) {
+                        half h;
+                        h.setBits(preview[((size_t)y * pw + x) * 4 + c]);
+                        s[c] += h;
+                    }
+                    count++;
+                }
+            }
+            for (int c = 0; c < 4; c++) {
+                float v = qBound(0.0f, s[c] / count, 1.0f);
+                thumbnail[((size_t)ty * tw + tx) * 4 + c] =
+                    (uint8_t)(v * 255.0f + 0.5f);
+            }
+        }
+    }
+    /*}}}*/
+
+    EntryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.full_width = image.full_size.width();
+    header.full_height = image.full_size.height();
+    header.thumbnail_width = tw;
+    header.thumbnail_height = th;
+    header.preview_width = pw;
+    header.preview_height = ph;
+    header.thumbnail_offset = align64(sizeof(header));
+    header.preview_offset = align64(header.thumbnail_offset
+                                    + thumbnail.size());
+
+    QString path = path_for(fname);
+    QFile file (path + ".tmp");
+    if ( ! file.open(QIODevice::WriteOnly)) {
+        return;
+    }
+    bool ok = file.write((const char*)&header, sizeof(header))
+              == sizeof(header);
+    ok = ok && file.seek(header.thumbnail_offset)
+         && file.write((const char*)&thumbnail[0], thumbnail.size())
+            == (qint64)thumbnail.size();
+    ok = ok && file.seek(header.preview_offset)
+         && file.write((const char*)&preview[0],
+                       preview.size() * sizeof(uint16_t))
+            == (qint64)(preview.size() * sizeof(uint16_t));
+    file.close();
+    QFile::remove(path);
+    if ( ! ok || ! file.rename(path)) {
+        file.remove();
+        return;
+    }
+
+    if (writes.fetchAndAddRelaxed(1) + 1 >= prune_interval) {
+        writes = 0;
+        prune();
+    }
+}/*}}}*/
+/**
+ * Deletes the least recently used entries until the cache is within its
+ * budget.  Reading an entry counts as using it.
+ */
+void DiskCache::prune ()/*{{{*/
+{
+    if (dir.isEmpty()) {
+        return;
+    }
+
+    QFileInfoList entries = QDir(dir).entryInfoList(
+        QStringList("*.gzp"), QDir::Files, QDir::Time);  // newest first
+    qint64 total = 0;
+    foreach (const QFileInfo& entry, entries) {
+        total += entry.size();
+        if (total > budget) {
+            QFile::remove(entry.filePath());
+        }
+    }
+}/*}}}*/
+
+QString DiskCache::path_for (const QString& fname) const/*{{{*/
+{
+    QFileInfo info (fname);
+    QCryptographicHash hash (QCryptographicHash::Sha1);
+    hash.addData(info.absoluteFilePath().toUtf8());
+    hash.addData(QByteArray::number(info.lastModified().toTime_t()));
+    hash.addData(QByteArray::number(info.size()));
+    return QDir(dir).filePath(hash.result().toHex() + ".gzp");
+}/*}}}*/
+ImagePtr DiskCache::read (const QString& fname, bool thumbnail) const/*{{{*/
+{
+    if (dir.isEmpty()) {
+        return ImagePtr();
+    }
+
+    QString path = path_for(fname);
+    QFile file (path);
+    if ( ! file.open(QIODevice::ReadOnly)
+         || file.size() < (qint64)sizeof(EntryHeader)) {
+        return ImagePtr();
+    }
+    const uchar* map = file.map(0, file.size());
+    if (map == NULL) {
+        return ImagePtr();
+    }
+
+    const EntryHeader* header = (const EntryHeader*)map;
+    if (memcmp(header->magic, magic, sizeof(magic)) != 0
+        || header->version != version) {
+        return ImagePtr();
+    }
+    int w = thumbnail ? header->thumbnail_width : header->preview_width;
+    int h = thumbnail ? header->thumbnail_height : header->preview_height;
+    quint64 offset = thumbnail ? header->thumbnail_offset
+                               : header->preview_offset;
+    if (w <= 0 || h <= 0) {
+        return ImagePtr();
+    }
+
+    ImagePtr image (new Image(w, h, GL_RGBA, thumbnail ? GL_UNSIGNED_BYTE
+                                                       : GL_HALF_FLOAT_ARB));
+    if (offset + image->byte_size() > (quint64)file.size()) {
+        return ImagePtr();  // truncated
+    }
+    memcpy(image->data, map + offset, image->byte_size());
+    image->full_size = QSize(header->full_width, header->full_height);
+    image->region = QRect(QPoint(0, 0), image->full_size);
+
+    utime(QFile::encodeName(path).constData(), NULL);
+    return image;
+}/*}}}*/
+
+// vim: sw=4 fdm=marker
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file DiskCache.h
+ * @brief DiskCache definition
+ */
+
+#pragma once
+
+#include "Image.h"
+
+#include <QAtomicInt>
+#include <QString>
+
+/**
+ * Thumbnails and previews of decoded images, kept on disk between runs.
+ *
+ * Entries are named by a hash of the file's path, modification time and
+ * size, so an edited file simply misses and its old entry ages out.  Each
+ * entry is one file: a fixed header, an RGBA8 thumbnail and a half float
+ * RGBA preview, top row first, read back through a memory map without any
+ * parsing.  Files are in host byte order; the cache is per machine.
+ *
+ * Entries are written by the decoding workers, so every method is thread
+ * safe once the cache is set up.  With no directory set it does nothing.
+ */
+class DiskCache
+{
+public:
+    static const int thumbnail_size = 128;
+
+private:
+    QString dir;
+    int preview_size;
+    qint64 budget;
+    QAtomicInt writes;  ///< since the last prune
+
+public:
+    DiskCache ();
+    virtual ~DiskCache ();
+
+    void set_dir (const QString& dir);
+    void set_preview_size (int size);
+    void set_budget (qint64 budget_bytes);
+
+    bool contains (const QString& fname) const;
+    ImagePtr preview (const QString& fname) const;
+    ImagePtr thumbnail (const QString& fname) const;
+    void store (const QString& fname, const Image& image);
+    void prune ();
+
+private:
+    QString path_for (const QString& fname) const;
+    ImagePtr read (const QString& fname, bool thumbnail) const;
+};
+
+// vim: sw=4 fdm=marker
@@ -0,0 +1,327 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file FileListModel.cpp
+ * @brief FileListModel implementation
+ */
+
+/* includes {{{*/
+#include "FileListModel.moc"
+
+#include <algorithm>
+#include <exception>
+#include <iterator>
+#include <vector>
+
+#include <QtCore>
+/*}}}*/
+
+class ThumbnailJob : public QRunnable/*{{{*/
+{
+private:
+    FileListModel* model;
+    QString fname;
+    CancelToken cancel;
+
+public:
+    ThumbnailJob (FileListModel* model, const QString& fname,
+                  const CancelToken& cancel) :
+        model(model),
+        fname(fname),
+        cancel(cancel)
+    {
+    }
+
+    virtual void run ()
+    {
+        QImage thumbnail;
+        bool finished = false;
+        if ( ! cancel.cancelled()) {
+            try {
+                thumbnail = model->make_thumbnail(fname, cancel);
+                finished = true;
+            } catch (const DecodeCancelled&) {
+            }
+        }
+
+        model->mutex.lock();
+        if (model->pending.contains(fname) && model->pending[fname] == cancel) {
+            model->pending.remove(fname);
+        }
+        model->mutex.unlock();
+
+        if (finished) {
+            // a null image too, so a file that won't decode isn't retried
+            emit model->thumbnail_ready(fname, thumbnail);
+        }
+    }
+};/*}}}*/
+
+/**
+ * Box filtered to at most @a size on either side, top row first.
+ */
+static QImage to_thumbnail (const Image& image, int size)/*{{{*/
+{
+    int step = qMax(1, (qMax(image.width, image.height) + size - 1) / size);
+    int w = (image.width + step - 1) / step;
+    int h = (image.height + step - 1) / step;
+
+    QImage thumbnail (w, h, QImage::Format_ARGB32);
+    std::vector<float> row ((size_t)image.width * 4);
+    std::vector<float> sum ((size_t)w * 4);
+    for (int ty = 0; ty < h; ty++) {
+        std::fill(sum.begin(), sum.end(), 0.0f);
+        int y0 = ty * step;
+        int y1 = qMin(y0 + step, image.height);
+        for (int y = y0; y < y1; y++) {
+            image.row_to_float(image.flip_y ? y : image.height - 1 - y,
+                               &row[0]);
+            for (int x = 0; x < image.width; x++) {
+                for (int c = 0; c < 4; c++) {
+                    sum[(x / step) * 4 + c] += row[x * 4 + c];
+                }
+            }
+        }
+        QRgb* dst = (QRgb*)thumbnail.scanLine(ty);
+        for (int x = 0; x < w; x++) {
+            int cols = qMin(step, image.width - x * step);
+            float norm = 255.0f / (cols * (y1 - y0));
+            const float* s = &sum[x * 4];
+            dst[x] = qRgba(qBound(0, (int)(s[0] * norm + 0.5f), 255),
+                           qBound(0, (int)(s[1] * norm + 0.5f), 255),
+                           qBound(0, (int)(s[2] * norm + 0.5f), 255),
+                           qBound(0, (int)(s[3] * norm + 0.5f), 255));
+        }
+    }
+    return thumbnail;
+}/*}}}*/
+
+FileListModel::FileListModel (DiskCache* disk_cache, QObject* parent) :/*{{{*/
+    QAbstractListModel(parent),
+    disk_cache(disk_cache),
+    thumbnail_size(64),
+    thumbnails(32 * 1024),
+    first_visible(0),
+    last_visible(-1)
+{
+    // out of the way of the decodes for the image on screen
+    pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() / 4));
+
+    connect(this, SIGNAL(thumbnail_ready(QString,QImage)),
+            this, SLOT(store_thumbnail(QString,QImage)),
+            Qt::QueuedConnection);
+}/*}}}*/
+FileListModel::~FileListModel ()/*{{{*/
+{
+    cancel_all();
+    pool.waitForDone();
+}/*}}}*/
+
+void FileListModel::set_files (const QStringList& files)/*{{{*/
+{
+    beginResetModel();
+    cancel_all();
+    this->files = files;
+    rows.clear();
+    rows.reserve(files.size());
+    for (int i = 0; i < files.size(); i++) {
+        rows.insert(files[i], i);
+    }
+    thumbnails.clear();  // names are relative to the directory
+    first_visible = 0;
+    last_visible = -1;
+    endResetModel();
+}/*}}}*/
+/**
+ * Merges @a names, which must be sorted, into the list; names already in
+ * it are skipped.  Appending, as frames are rendered, is the common case
+ * and only inserts rows.  Anything else moves rows about, which views and
+ * selections follow through their persistent indexes.
+ */
+void FileListModel::add_files (const QStringList& names)/*{{{*/
+{
+    QStringList added;
+    foreach (const QString& name, names) {
+        if ( ! rows.contains(name)) {
+            added << name;
+        }
+    }
+    if (added.isEmpty()) {
+        return;
+    }
+
+    if (files.isEmpty() || files.last() < added.first()) {
+        beginInsertRows(QModelIndex(), files.size(),
+                        files.size() + added.size() - 1);
+        foreach (const QString& name, added) {
+            rows.insert(name, files.size());
+            files << name;
+        }
+        endInsertRows();
+        return;
+    }
+
+    emit layoutAboutToBeChanged();
+    QModelIndexList from = persistentIndexList();
+    QStringList moved;
+    foreach (const QModelIndex& index, from) {
+        moved << files[index.row()];
+    }
+
+    QStringList merged;
+    merged.reserve(files.size() + added.size());
+    std::merge(files.begin(), files.end(), added.begin(), added.end(),
+               std::back_inserter(merged));
+    int first_changed = std::lower_bound(files.begin(), files.end(),
+                                         added.first()) - files.begin();
+    files.swap(merged);
+    for (int i = first_changed; i < files.size(); i++) {
+        rows[files[i]] = i;
+    }
+
+    QModelIndexList to;
+    foreach (const QString& name, moved) {
+        to << index(rows.value(name));
+    }
+    changePersistentIndexList(from, to);
+    emit layoutChanged();
+}/*}}}*/
+const QStringList& FileListModel::file_list () const/*{{{*/
+{
+    return files;
+}/*}}}*/
+/**
+ * Row of @a fname, or -1; a hash lookup, however long the list.
+ */
+int FileListModel::row (const QString& fname) const/*{{{*/
+{
+    return rows.value(fname, -1);
+}/*}}}*/
+void FileListModel::set_thumbnail_size (int size)/*{{{*/
+{
+    thumbnail_size = qMax(16, size);
+}/*}}}*/
+/**
+ * Rows @a first to @a last are on screen; thumbnails still queued for any
+ * others are dropped.
+ */
+void FileListModel::set_visible (int first, int last)/*{{{*/
+{
+    first_visible = first;
+    last_visible = last;
+
+    QMutexLocker lock (&mutex);
+    QHash<QString, CancelToken>::iterator it;
+    for (it = pending.begin(); it != pending.end(); ++it) {
+        int row = rows.value(it.key(), -1);
+        if (row < first || row > last) {
+            it.value().cancel();
+        }
+    }
+}/*}}}*/
+
+int FileListModel::rowCount (const QModelIndex& parent) const/*{{{*/
+{
+    return parent.isValid() ? 0 : files.size();
+}/*}}}*/
+QVariant FileListModel::data (const QModelIndex& index, int role) const/*{{{*/
+{
+    if ( ! index.isValid() || index.row() >= files.size()) {
+        return QVariant();
+    }
+
+    const QString& fname = files[index.row()];
+    switch (role) {
+    case Qt::DisplayRole:
+    case Qt::ToolTipRole:
+        return fname;
+    case Qt::DecorationRole:
+        if (QPixmap* pixmap = thumbnails.object(fname)) {
+            return pixmap->isNull() ? QVariant() : *pixmap;
+        }
+        // only visible rows are asked for, so this is what the view needs
+        const_cast<FileListModel*>(this)->request(index.row());
+        return QVariant();
+    default:
+        return QVariant();
+    }
+}/*}}}*/
+
+void FileListModel::store_thumbnail (const QString& fname, const QImage& image)/*{{{*/
+{
+    QHash<QString, int>::const_iterator row = rows.find(fname);
+    if (row == rows.end()) {
+        return;  // from the previous directory
+    }
+    QPixmap* pixmap = new QPixmap(QPixmap::fromImage(image));
+    thumbnails.insert(fname, pixmap, image.byteCount() / 1024 + 1);
+    QModelIndex changed = index(row.value());
+    emit dataChanged(changed, changed);
+}/*}}}*/
+
+void FileListModel::request (int row)/*{{{*/
+{
+    const QString& fname = files[row];
+
+    QMutexLocker lock (&mutex);
+    if (pending.contains(fname) && ! pending[fname].cancelled()) {
+        return;
+    }
+    CancelToken cancel;
+    pending.insert(fname, cancel);
+    // the middle of the view first
+    int centre = last_visible >= first_visible ?
+        (first_visible + last_visible) / 2 : row;
+    pool.start(new ThumbnailJob(this, fname, cancel), -qAbs(row - centre));
+}/*}}}*/
+void FileListModel::cancel_all ()/*{{{*/
+{
+    QMutexLocker lock (&mutex);
+    foreach (CancelToken cancel, pending) {
+        cancel.cancel();  // copies share the flag
+    }
+    pending.clear();
+}/*}}}*/
+/**
+ * Runs on the pool.  Decoding is the last resort; what it decodes whole
+ * goes to the DiskCache so it is never decoded for a thumbnail again.
+ */
+QImage FileListModel::make_thumbnail (const QString& fname, const CancelToken& cancel)/*{{{*/
+{
+    QString path = QFileInfo(fname).absoluteFilePath();
+    ImagePtr image = disk_cache->thumbnail(path);
+    if ( ! image) {
+        DecodeContext context (cancel, DecodeHints());
+        // tiled files have small levels; formats that can't reduce at all
+        // are handed whole hints by the Decoder, and what they decode
+        // whole goes to the DiskCache below
+        context.hints.scale = 1.0f / 16;
+        try {
+            image = Decoder::decode(path, context);
+        } catch (const char* msg) {
+            qDebug() << path << msg;
+        } catch (const std::exception& e) {
+            qDebug() << path << e.what();
+        }
+        if (image && ! image->is_partial()) {
+            disk_cache->store(path, *image);
+        }
+    }
+    return image ? to_thumbnail(*image, thumbnail_size) : QImage();
+}/*}}}*/
+
+// vim: sw=4 fdm=marker
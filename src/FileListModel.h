@@ -0,0 +1,95 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file FileListModel.h
+ * @brief FileListModel definition
+ */
+
+#pragma once
+
+#include "Decoder.h"
+#include "DiskCache.h"
+
+#include <QAbstractListModel>
+#include <QCache>
+#include <QHash>
+#include <QImage>
+#include <QPixmap>
+#include <QMutex>
+#include <QStringList>
+#include <QThreadPool>
+
+/**
+ * The file list as a model, with thumbnails made on demand.
+ *
+ * No per-file objects exist: views only ask for the rows they show, and
+ * only then is a thumbnail looked up, first in memory, then in the
+ * DiskCache, and decoded only as a last resort.  Thumbnails are made on a
+ * pool of their own so they never hold up the image on screen; those
+ * nearest the middle of the visible rows go first, and those scrolled out
+ * of view before their turn are cancelled.
+ *
+ * The list can grow while it is shown: add_files() merges in sorted names
+ * as a DirectoryScanner finds them.
+ */
+class FileListModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+    friend class ThumbnailJob;
+
+private:
+    QStringList files;
+    QHash<QString, int> rows;  ///< file name to row
+    DiskCache* disk_cache;
+    int thumbnail_size;
+
+    QThreadPool pool;
+    QMutex mutex;
+    QHash<QString, CancelToken> pending;
+    QCache<QString, QPixmap> thumbnails;  ///< cost is in KiB
+    int first_visible;
+    int last_visible;
+
+public:
+    FileListModel (DiskCache* disk_cache, QObject* parent = NULL);
+    virtual ~FileListModel ();
+
+    void set_files (const QStringList& files);
+    void add_files (const QStringList& names);
+    const QStringList& file_list () const;
+    int row (const QString& fname) const;
+    void set_thumbnail_size (int size);
+    void set_visible (int first, int last);
+
+    virtual int rowCount (const QModelIndex& parent = QModelIndex()) const;
+    virtual QVariant data (const QModelIndex& index,
+                           int role = Qt::DisplayRole) const;
+
+signals:
+    void thumbnail_ready (const QString& fname, const QImage& image);
+
+private slots:
+    void store_thumbnail (const QString& fname, const QImage& image);
+
+private:
+    void request (int row);
+    void cancel_all ();
+    QImage make_thumbnail (const QString& fname, const CancelToken& cancel);
+};
+
+// vim: sw=4 fdm=marker
@@ -19,42 +19,28 @@
  * @brief GLSurface implementation
  */
 
-#define DCRAW_4 1
-
 /* includes {{{*/
 #include "GLSurface.moc"
 #include "MainWindow.h"
+#include "BufferArena.h"
+#include "Profiler.h"
 
-#include <gas/swap.h>
 #include <assert.h>
+#include <string.h>
 
 #include <QtCore>
+#include <QDesktopServices>
 #include <QMouseEvent>
 #include <QMainWindow>
+#include <QPainter>
 #include <QStatusBar>
 
-#include <ImfRgbaFile.h>
-#include <ImfArray.h>
-#include <ImfTestFile.h>
-
-#include <apr_pools.h>
-
-#include <Cg/cgGL.h>
+#include <math.h>
 
 #include "shaders.h"
 
 /*}}}*/
 
-struct Color/*{{{*/
-{
-    union {
-        struct {
-            float r, g, b, a;
-        };
-        float value[4];
-    };
-};/*}}}*/
-
 /* error helpers {{{*/
 #define GLERRCHK()                                                          \
     do {                                                                    \
@@ -70,51 +56,119 @@ struct Color/*{{{*/
 /*}}}*/
 
 GLSurface::GLSurface () :/*{{{*/
-    QGLWidget(),
+    QGLWidget(core_format()),
     flip_y(false),
     tex_id(0),
-    pool(NULL),
+    coarse_tex_id(0),
+    has_coarse(false),
+    detail_tex_id(0),
+    tiled(false),
+    max_texture_size(0),
+    tile_budget(256 << 20),
     image_size(0, 0),
     image_position(0, 0),
     scale(1.0f),
-    use_shader(true)
+    use_shader(true),
+    tone_op(ToneMapper::CURVE),
+    auto_exposure(false),
+    stats_dirty(false),
+    vao(0),
+    vbo(0),
+    view_ubo(0),
+    layout_mode(SINGLE),
+    rotation(0),
+    wipe(0.5f),
+    dragging_wipe(false),
+    probing(false),
+    show_profile(false),
+    overlay_tex(0)
 {
-    apr_pool_create(&pool, NULL);
     setFocusPolicy(Qt::StrongFocus);
+    setMouseTracking(true);  // for the probe
+
+    overlay_timer.setInterval(250);
+    connect(&overlay_timer, SIGNAL(timeout()), this, SLOT(updateGL()));
+    connect(&residency, SIGNAL(encode_finished()),
+            this, SLOT(upload_encoded()), Qt::QueuedConnection);
+    connect(&residency, SIGNAL(replaced(GLuint, GLuint)),
+            this, SLOT(texture_replaced(GLuint, GLuint)));
 
     tmapr.exposure = 1.1f;
 }/*}}}*/
 GLSurface::~GLSurface ()/*{{{*/
 {
+    makeCurrent();
+    residency.release();
+}/*}}}*/
+
+/**
+ * A 3.2 core profile context: no fixed function, which is also what Mesa's
+ * llvmpipe offers, so the same path runs headless.
+ */
+QGLFormat GLSurface::core_format ()/*{{{*/
+{
+    QGLFormat format;
+    format.setVersion(3, 2);
+    format.setProfile(QGLFormat::CoreProfile);
+    format.setDoubleBuffer(true);
+    format.setDepth(false);
+    return format;
 }/*}}}*/
 
 void GLSurface::initializeGL ()/*{{{*/
 {
+    QGLFormat format = this->format();
+    if (format.majorVersion() * 10 + format.minorVersion() < 32) {
+        qFatal("OpenGL 3.2 core profile not available (got %d.%d)",
+               format.majorVersion(), format.minorVersion());
+    }
+
+    // core profiles don't list extensions the old way GLEW asks for them
+    glewExperimental = GL_TRUE;
     GLenum glew_status;
     if ((glew_status = glewInit()) != GLEW_OK) {
         qFatal("GLEW error: %s", glewGetErrorString(glew_status));
     }
+    glGetError();  // glewInit trips GL_INVALID_ENUM on core profiles
 
-    glGenTextures(1, &tex_id);
+    glGenTextures(1, &coarse_tex_id);
+    glGenTextures(1, &detail_tex_id);
+    glGenTextures(1, &overlay_tex);
+    uploader.initialize();
+    compare_uploader.initialize();
+    residency.initialize();
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
     glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-    glEnable(GL_TEXTURE_2D);
 
-    GLERRCHK();
+/* geometry {{{*/
+    static const GLfloat corners[] = { 0, 0,  1, 0,  0, 1,  1, 1 };
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+
+    glGenBuffers(1, &view_ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, view_ubo);
+    glBufferData(GL_UNIFORM_BUFFER, 8 * sizeof(GLfloat), NULL,
+                 GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, view_ubo);
+/*}}}*/
 
-/* cg {{{*/
-    cg_context = cgCreateContext();
-    cg_fragment_profile = cgGLGetLatestProfile(CG_GL_FRAGMENT);
-    cgGLSetOptimalOptions(cg_fragment_profile);
-    cg_fragment_program = cgCreateProgram(cg_context, CG_SOURCE,
-                                          tonemap_shader_source,
-                                          cg_fragment_profile, "tonemap", NULL);
-    cgGLLoadProgram(cg_fragment_program);
-
-    cg_params.scene_tex = cgGetNamedParameter(cg_fragment_program, "scene_tex");
-    cg_params.exposure = cgGetNamedParameter(cg_fragment_program,
-                                             "tmapr.exposure");
+/* shaders {{{*/
+    QString cache_dir = QDir(QDesktopServices::storageLocation(
+        QDesktopServices::CacheLocation)).filePath("shaders");
+    try {
+        tonemapper.initialize(cache_dir);
+        stats.initialize(vao, cache_dir);
+    } catch (const char* error) {
+        qFatal("%s", error);
+    }
 /*}}}*/
 
+    GLERRCHK();
 }/*}}}*/
 void GLSurface::resizeGL (int w, int h)/*{{{*/
 {
@@ -122,221 +176,626 @@ void GLSurface::resizeGL (int w, int h)/*{{{*/
 
     glViewport(0, 0, w, h);
 
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    glOrtho(0, w, 0, h, 1, -1);
-
     if (image_position.x() == 0 && image_position.y() == 0) {
         image_position.setX(0.5 * w);
         image_position.setY(0.5 * h);
     }
-
+    emit view_changed();
 }/*}}}*/
-void GLSurface::paintGL ()/*{{{*/
+/**
+ * What a frame costs: the paint and the buffer swap after it, where a
+ * driver with frames queued makes us wait.  Idle time between repaints is
+ * left out, so the overlay's own timer doesn't show up as frame time.
+ */
+void GLSurface::glDraw ()/*{{{*/
 {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    if (tex_id == 0) {
+    if ( ! Profiler::enabled()) {
+        QGLWidget::glDraw();
         return;
     }
+    qint64 start = Profiler::now_us();
+    QGLWidget::glDraw();
+    Profiler::record("frame", start, Profiler::now_us());
+}/*}}}*/
+void GLSurface::paintGL ()/*{{{*/
+{
+    PROFILE_SCOPE("paint");
 
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
+    glClear(GL_COLOR_BUFFER_BIT);
 
-    glMatrixMode(GL_TEXTURE);
-    glLoadIdentity();
-    if (flip_y) {
-        glScalef(1.0f, -1.0f, 1.0f);
+    // at most one band budget per frame; come back for the rest
+    int rows_before = uploader.rows();
+    ImagePtr uploading_image = uploader.current();
+    bool uploading = uploader.step();
+    if (uploading_image && ! uploading) {
+        residency.uploaded(uploading_image);
     }
 
+    // statistics once the whole image, or the preview of a tiled one, is in
+    GLuint stats_tex = tiled ? (has_coarse ? coarse_tex_id : 0) : tex_id;
+    if (stats_dirty && ! uploading && current_image && stats_tex != 0) {
+        PROFILE_SCOPE("stats");
+        image_stats = stats.compute(stats_tex);
+        glViewport(0, 0, surface_size.width(), surface_size.height());
+        stats_dirty = false;
+        if (auto_exposure) {
+            expose();
+        }
+    }
 
-    if (use_shader) {
-        cgGLEnableProfile(cg_fragment_profile);
-        cgGLBindProgram(cg_fragment_program);
+    tonemapper.use(use_shader ? tone_op : ToneMapper::RAW);
+    glBindVertexArray(vao);
+    glActiveTexture(GL_TEXTURE0);
 
-        cgGLSetTextureParameter(cg_params.scene_tex, tex_id);
-        cgGLSetParameter1f(cg_params.exposure, tmapr.exposure);
+    // every view under the same pan and zoom, each in a cell of its own;
+    // a wipe has both on the whole surface, each on its side of the line
+    bool more = false;
+    QList<QRect> cells = view_cells();
+    int wipe_x = qRound(wipe * surface_size.width());
+    for (int i = 0; i < cells.size(); i++) {
+        int view = (i + rotation) % cells.size();
+        if (layout_mode == WIPE) {
+            glEnable(GL_SCISSOR_TEST);
+            if (i == 0) {
+                glScissor(0, 0, wipe_x, surface_size.height());
+            } else {
+                glScissor(wipe_x, 0, surface_size.width() - wipe_x,
+                          surface_size.height());
+            }
+        }
+        if (view == 0) {
+            draw_current(cells[i], uploading, &more);
+        } else {
+            draw_compare(cells[i], compare[view - 1]);
+        }
     }
+    if (layout_mode == WIPE) {
+        glScissor(wipe_x - 1, 0, 2, surface_size.height());
+        glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glDisable(GL_SCISSOR_TEST);
+    }
+    glViewport(0, 0, surface_size.width(), surface_size.height());
 
-    glMatrixMode(GL_MODELVIEW);
-    glTranslatef(image_position.x(), image_position.y(), 0.0f);
-    glScalef(scale, scale, 1.0f);
-    glTranslatef(-0.5f * image_size.width(),
-                 -0.5f * image_size.height(), 0.0f);
-    glColor3f(1.0f, 1.0f, 1.0f);
-    glBindTexture(GL_TEXTURE_2D, tex_id);
-    glBegin(GL_QUADS);
-    glTexCoord2f(0.0f,0.0f);glVertex2f(0.0f              , 0.0f);
-    glTexCoord2f(1.0f,0.0f);glVertex2f(image_size.width(), 0.0f);
-    glTexCoord2f(1.0f,1.0f);glVertex2f(image_size.width(), image_size.height());
-    glTexCoord2f(0.0f,1.0f);glVertex2f(0.0f              , image_size.height());
-    glEnd();
-
-    if (use_shader) {
-        cgGLDisableProfile(cg_fragment_profile);
+    if (show_profile) {
+        draw_overlay();
     }
 
     GLERRCHK();
+
+    if (more) {
+        QTimer::singleShot(15, this, SLOT(updateGL()));
+    } else if (uploading) {
+        // no new rows means we are waiting on the decoder, not the GPU
+        int delay = uploader.rows() == rows_before ? 15 : 0;
+        QTimer::singleShot(delay, this, SLOT(updateGL()));
+    }
+}/*}}}*/
+/**
+ * Maps image pixels of an image of @a full_size, centred on image_position
+ * and scaled, to clip space in @a cell of the surface.
+ */
+void GLSurface::set_view (const QRect& cell, const QSize& full_size)/*{{{*/
+{
+    glViewport(cell.x(), cell.y(), cell.width(), cell.height());
+    float sx = 2.0f / cell.width();
+    float sy = 2.0f / cell.height();
+    GLfloat view[8] = {
+        scale * sx,
+        scale * sy,
+        (image_position.x() - 0.5f * scale * full_size.width()) * sx - 1.0f,
+        (image_position.y() - 0.5f * scale * full_size.height()) * sy - 1.0f,
+        tmapr.exposure,
+        0.0f,
+        0.0f,
+        0.0f
+    };
+    glBindBuffer(GL_UNIFORM_BUFFER, view_ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(view), view);
+}/*}}}*/
+/**
+ * The current image in @a cell: its tiles, the bands of it uploaded so
+ * far over the coarse preview, or all of it, and any detail over that.
+ */
+void GLSurface::draw_current (const QRect& cell, bool uploading, bool* more)/*{{{*/
+{
+    if (tex_id == 0 && ! tiled) {
+        return;
+    }
+    set_view(cell, image_size);
+
+    const QRectF& r = image_region;
+    if (tiled) {
+        if ( ! has_coarse && current_image->complete()) {
+            upload_coarse();
+        }
+        if (has_coarse) {
+            draw_quad(coarse_tex_id, r);
+        }
+        QList<TileCache::Quad> quads = tiles.prepare(visible_rect(), scale,
+                                                     more);
+        foreach (const TileCache::Quad& quad, quads) {
+            draw_quad(quad.tex, quad.rect, quad.tex_rect);
+        }
+    } else if (uploading) {
+        // coarse preview underneath, refined by the bands already in
+        if (has_coarse) {
+            draw_quad(coarse_tex_id, r);
+        }
+        float f = (float)uploader.rows() / current_image->height;
+        if (flip_y) {
+            draw_quad(tex_id, QRectF(r.x(), r.y() + r.height() * (1.0f - f),
+                                     r.width(), r.height() * f));
+        } else {
+            draw_quad(tex_id, QRectF(r.x(), r.y(), r.width(), r.height() * f));
+        }
+    } else {
+        draw_quad(tex_id, r);
+    }
+    if (detail_image && ! tiled) {
+        draw_quad(detail_tex_id, detail_region,
+                  detail_image->flip_y ? QRectF(0, 1, 1, -1)
+                                       : QRectF(0, 0, 1, 1));
+    }
 }/*}}}*/
+void GLSurface::draw_compare (const QRect& cell, const CompareView& view)/*{{{*/
+{
+    if (view.tex == 0) {
+        return;
+    }
+    const Image& image = *view.image;
+    set_view(cell, image.full_size);
+    // region is y down, drawing is y up
+    draw_quad(view.tex,
+              QRectF(image.region.x(),
+                     image.full_size.height() - image.region.bottom() - 1,
+                     image.region.width(), image.region.height()),
+              image.flip_y ? QRectF(0, 1, 1, -1) : QRectF(0, 0, 1, 1));
+}/*}}}*/
+/**
+ * Draws the part @a rect of the image, in image pixels with y up, from a
+ * texture that covers image_region.
+ */
+void GLSurface::draw_quad (GLuint tex, const QRectF& rect)/*{{{*/
+{
+    if (rect.isEmpty()) {
+        return;
+    }
 
+    const QRectF& r = image_region;
+    float s0 = (rect.left() - r.left()) / r.width();
+    float s1 = (rect.right() - r.left()) / r.width();
+    float t0 = (rect.top() - r.top()) / r.height();
+    float t1 = (rect.bottom() - r.top()) / r.height();
+    if (flip_y) {
+        t0 = 1.0f - t0;
+        t1 = 1.0f - t1;
+    }
+    draw_quad(tex, rect, QRectF(QPointF(s0, t0), QPointF(s1, t1)));
+}/*}}}*/
+/**
+ * Draws @a tex over @a rect, with @a tex_rect's top left corner at the
+ * rect's top left; either may be upside down.
+ */
+void GLSurface::draw_quad (GLuint tex, const QRectF& rect, const QRectF& tex_rect)/*{{{*/
+{
+    tonemapper.set_rects(rect, tex_rect);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}/*}}}*/
+
+/**
+ * Shows a QImage through the same path as decoded images; QGLWidget's
+ * bindTexture() relies on fixed function state a core profile lacks.
+ */
 void GLSurface::load_image (QImage& image)/*{{{*/
 {
     if (image.isNull()) {
         throw "image not valid";
     }
 
-    image_size = image.size();
-    tex_id = bindTexture(image, GL_TEXTURE_2D, GL_RGBA16F_ARB);
-
-    flip_y = false;
-    updateGL();
+    load_image(Decoder::from_qimage(image));
 }/*}}}*/
-void GLSurface::load_image (const QString& fname)/*{{{*/
+void GLSurface::load_image (const ImagePtr& image)/*{{{*/
 {
+    if ( ! image) {
+        throw "image not valid";
+    }
+    PROFILE_SCOPE("load image");
 
-/* try OpenEXR {{{*/
-    if (fname.endsWith("exr")) {
+    if (image == current_image) {
+        return;  // finished decoding what is already streaming in
+    }
+    current_image = image;
+    image_size = image->full_size;
+    flip_y = image->flip_y;
+    // region is y down, drawing is y up
+    image_region = QRectF(image->region.x(),
+                          image_size.height() - image->region.bottom() - 1,
+                          image->region.width(), image->region.height());
 
-        if ( ! Imf::isOpenExrFile(qPrintable(fname))) {
-            throw "invalid exr format";
+    has_coarse = false;
+    stats_dirty = true;
+    tiles.release();
+    update_shown();
+    tiled = TileCache::needed(*image, max_texture_size, tile_budget);
+    if (tiled) {
+        // only ever the tiles in view; the preview covers for the rest
+        uploader.cancel();
+        if (image->complete()) {
+            upload_coarse();
         }
+        tiles.start(image, image_region);
+        updateGL();
+        return;
+    }
 
-        Imf::RgbaInputFile file (qPrintable(fname));
-        Imath::Box2i dw = file.dataWindow();
-        image_size.setWidth(dw.max.x - dw.min.x + 1);
-        image_size.setHeight(dw.max.y - dw.min.y + 1);
-        Imf::Array2D<Imf::Rgba> pix;
-        pix.resizeErase(image_size.height(), image_size.width());
-        file.setFrameBuffer(&pix[0][0], 1, image_size.width());
-        file.readPixels(dw.min.y, dw.max.y);
-
-        flip_y = true;
-
-        glBindTexture(GL_TEXTURE_2D, tex_id);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-                        GL_LINEAR_MIPMAP_LINEAR);
-        if (GL_EXT_framebuffer_object) {
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F_ARB,
-                         image_size.width(), image_size.height(),
-                         0, GL_RGBA, GL_HALF_FLOAT_ARB, &pix[0][0]);
-            glGenerateMipmapEXT(GL_TEXTURE_2D);
-        } else if (GL_SGIS_generate_mipmap) {
-            glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F_ARB,
-                         image_size.width(), image_size.height(),
-                         0, GL_RGBA, GL_HALF_FLOAT_ARB, &pix[0][0]);
-        } else {
-            size_t bytes_per_line = image_size.width() * sizeof(Color);
-            size_t size = image_size.height() * bytes_per_line;
-            Color* fpix = (Color*)apr_palloc(pool, size);
-            Color c;
-            flip_y = false;  // flipping pixels since loop is already necessary
-            for (int y = 0; y < image_size.height(); y++) {
-                for (int x = 0; x < image_size.width(); x++) {
-                    c.r = pix[y][x].r;
-                    c.g = pix[y][x].g;
-                    c.b = pix[y][x].b;
-                    fpix[x+(image_size.height()-y-1)*image_size.width()]=c;
-                }
-            }
-            gluBuild2DMipmaps(GL_TEXTURE_2D, GL_RGBA16F_ARB,
-                              image_size.width(), image_size.height(),
-                              GL_RGBA, GL_FLOAT, fpix);
-            apr_pool_clear(pool);
-        }
+    // back to an image whose texture is still around: nothing to upload
+    GLuint resident = residency.find(image);
+    if (resident != 0) {
+        uploader.cancel();
+        tex_id = resident;
         updateGL();
         return;
     }
-/*}}}*/
 
-/* try dcraw {{{*/
-    QProcess dcraw (this);
-    QStringList args;
-    args << "-i" << qPrintable(fname);
-    dcraw.start("dcraw", args);
-    if (dcraw.waitForStarted()) {
-        dcraw.waitForFinished();
-        if (dcraw.exitCode() == 0) {
-            args.clear();
-            args << "-c";
-
-#if 1
-            args << "-w";  // camera white balance
-#else
-            args << "-a";  // whole image average white balance
-#endif
+    // a tiny preview now, the full image streamed over the next frames;
+    // a still decoding image brings its own top-down preview instead
+    if (image->complete()) {
+        upload_coarse();
+    }
+    tex_id = residency.allocate(image);
+    uploader.start(image, tex_id);
+    GLERRCHK();
 
-#if DCRAW_4
-            args << "-4";
-#endif
-            args << qPrintable(fname);
-            dcraw.start("dcraw", args);
-            if (dcraw.waitForStarted()) {
-                dcraw.waitForReadyRead();
-
-                QString ppm_type = dcraw.readLine().trimmed();
-                assert(ppm_type == "P6");
-                QByteArray line = dcraw.readLine().trimmed();
-                QList<QByteArray> wh = line.split(' ');
-                int w = wh[0].toInt();
-                int h = wh[1].toInt();
-                image_size = QSize(w, h);
-#if DCRAW_4
-                qint64 byte_size = w * h * sizeof(quint16) * 3;
-#else
-                qint64 byte_size = w * h * sizeof(quint8) * 3;
-#endif
-                quint16* pixels = (quint16*)apr_palloc(pool, byte_size);
-
-                dcraw.waitForFinished();
-                int max = dcraw.readLine().trimmed().toInt();
-#if DCRAW_4
-                assert(max == 0xffff);
-#else
-                assert(max == 0xff);
-#endif
-                qint64 bytes_read = dcraw.read((char*)pixels, byte_size);
-                if (bytes_read != byte_size) {
-                    qDebug() << "failed to read" << byte_size;
-                }
+    updateGL();
+}/*}}}*/
 
-                assert(dcraw.atEnd() == true);
+/**
+ * Playback: uploads @a image in full to a texture of its own, then shows
+ * it.  A frame is never seen half uploaded, and the texture being drawn is
+ * never the one being written.  Frames still resident from the last time
+ * round a loop are not uploaded again.
+ */
+void GLSurface::show_frame (const ImagePtr& image)/*{{{*/
+{
+    if (TileCache::needed(*image, max_texture_size, tile_budget)) {
+        load_image(image);  // too big to play; shown like a still
+        return;
+    }
+    PROFILE_SCOPE("show frame");
 
-#if DCRAW_4
-                gas_swap(pixels, sizeof(quint16), byte_size);
-#endif
+    makeCurrent();
+    tiles.release();
+    tiled = false;
+    has_coarse = false;
+    detail_image.clear();
+    stats_dirty = true;
+    current_image = image;
+    update_shown();
+    GLuint tex = residency.find(image);
+    if (tex != 0) {
+        uploader.cancel();
+    } else {
+        tex = residency.allocate(image);
+        uploader.start(image, tex);
+        uploader.finish();
+        // rows not decoded yet go up from paintGL, which marks it then
+        if ( ! uploader.busy()) {
+            residency.uploaded(image);
+        }
+    }
+    tex_id = tex;
 
-                glBindTexture(GL_TEXTURE_2D, tex_id);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-                                GL_LINEAR_MIPMAP_LINEAR);
-                GLenum type = 0;
-#if DCRAW_4
-                type = GL_UNSIGNED_SHORT;
-#else
-                type = GL_UNSIGNED_BYTE;
-#endif
-                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F_ARB,
-                             image_size.width(), image_size.height(),
-                             0, GL_RGB, type, pixels);
-                glGenerateMipmapEXT(GL_TEXTURE_2D);
-                apr_pool_clear(pool);
+    image_size = image->full_size;
+    flip_y = image->flip_y;
+    image_region = QRectF(image->region.x(),
+                          image_size.height() - image->region.bottom() - 1,
+                          image->region.width(), image->region.height());
+    GLERRCHK();
+    updateGL();
+}/*}}}*/
 
-                flip_y = true;
+void GLSurface::upload_coarse ()/*{{{*/
+{
+    PROFILE_SCOPE("upload coarse");
+    ImagePtr coarse = current_image->subsample(coarse_size);
+    glBindTexture(GL_TEXTURE_2D, coarse_tex_id);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D, 0, TextureUploader::internal_format(*coarse),
+                 coarse->width, coarse->height,
+                 0, coarse->format, coarse->type, coarse->data);
+    has_coarse = true;
+}/*}}}*/
 
-                updateGL();
-                return;
-            } else {
-                qDebug() << "dcraw didn't start again";
-            }
-        }
+/**
+ * The part of the image on screen, in image pixels with y up; the corners
+ * of its cell back through the transform in set_view().
+ */
+QRectF GLSurface::visible_rect () const/*{{{*/
+{
+    float w = image_size.width();
+    float h = image_size.height();
+    float x0 = -image_position.x() / scale + 0.5f * w;
+    QSize cell = view_cells().first().size();
+    float x1 = (cell.width() - image_position.x()) / scale + 0.5f * w;
+    float y0 = -image_position.y() / scale + 0.5f * h;
+    float y1 = (cell.height() - image_position.y()) / scale + 0.5f * h;
+    return QRectF(x0, y0, x1 - x0, y1 - y0);
+}/*}}}*/
+/**
+ * What the next decode needs to fill the screen as it is set up now,
+ * assuming the next image is the same size as this one.
+ */
+DecodeHints GLSurface::view_hints () const/*{{{*/
+{
+    DecodeHints hints;
+    hints.scale = scale;
+    if (image_size.isEmpty() || scale <= 0.0f) {
+        return hints;
     }
-/*}}}*/
 
-    QImage img (fname);
-    load_image(img);
+    float w = image_size.width();
+    float h = image_size.height();
+    QRectF v = visible_rect();
 
+    QRectF all (0.0f, 0.0f, 1.0f, 1.0f);
+    QRectF visible = QRectF(v.left() / w, 1.0f - v.bottom() / h,
+                            v.width() / w, v.height() / h) & all;
+    if (visible != all) {
+        hints.view = visible;
+    }
+    return hints;
+}/*}}}*/
+/**
+ * Whether what is on screen already has the pixels @a hints ask for.
+ * Tiled images fetch their own tiles and always do.
+ */
+bool GLSurface::satisfies (const DecodeHints& hints) const/*{{{*/
+{
+    if ( ! current_image || tiled) {
+        return true;
+    }
+    return hints.satisfied_by(*current_image)
+           || (detail_image && hints.satisfied_by(*detail_image));
+}/*}}}*/
+/**
+ * Shows @a image, a finer decode of part of the current image, over it.
+ * Only the view's worth of pixels, so it goes up in one go.
+ */
+void GLSurface::load_detail (const ImagePtr& image)/*{{{*/
+{
+    if ( ! current_image || image->full_size != image_size
+        || ! image->complete()) {
+        return;  // for an image no longer shown, or not there yet
+    }
+    PROFILE_SCOPE("upload detail");
+
+    makeCurrent();
+    glBindTexture(GL_TEXTURE_2D, detail_tex_id);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D, 0, TextureUploader::internal_format(*image),
+                 image->width, image->height,
+                 0, image->format, image->type, image->data);
+    GLERRCHK();
+
+    detail_image = image;
+    // region is y down, drawing is y up
+    detail_region = QRectF(image->region.x(),
+                           image_size.height() - image->region.bottom() - 1,
+                           image->region.width(), image->region.height());
+    updateGL();
+}/*}}}*/
+void GLSurface::clear_detail ()/*{{{*/
+{
+    detail_image.clear();  // the texture is left for the next one
+}/*}}}*/
+/**
+ * The image in the first view, decoded or still decoding.
+ */
+const ImagePtr& GLSurface::shown_image () const/*{{{*/
+{
+    return current_image;
+}/*}}}*/
+void GLSurface::cancel_upload ()/*{{{*/
+{
+    uploader.cancel();
+    tiles.release();
+    tiled = false;
+    current_image.clear();
+    detail_image.clear();
+    updateGL();
+}/*}}}*/
+
+void GLSurface::set_tile_budget (qint64 bytes)/*{{{*/
+{
+    tile_budget = bytes;
+    tiles.set_budget(bytes);
+}/*}}}*/
+/**
+ * GPU memory for whole image textures, the one on screen and those kept
+ * for going back to; see TextureResidency.
+ */
+void GLSurface::set_texture_budget (qint64 bytes)/*{{{*/
+{
+    makeCurrent();
+    residency.set_budget(bytes);
+}/*}}}*/
+void GLSurface::set_bc6h (bool on)/*{{{*/
+{
+    residency.set_bc6h(on);
+}/*}}}*/
+void GLSurface::upload_encoded ()/*{{{*/
+{
+    PROFILE_SCOPE("upload bc6h");
+    makeCurrent();
+    residency.upload_encoded();
+    GLERRCHK();
+}/*}}}*/
+void GLSurface::texture_replaced (GLuint old_tex, GLuint new_tex)/*{{{*/
+{
+    if (tex_id == old_tex) {
+        tex_id = new_tex;
+    }
+    for (int i = 0; i < max_views - 1; i++) {
+        if (compare[i].tex == old_tex) {
+            compare[i].tex = new_tex;
+        }
+    }
+    updateGL();
+}/*}}}*/
+
+/**
+ * Shows the current image alone, or next to other images, in cells of the
+ * surface or either side of a wipe.  Whatever the layout, all views share
+ * one pan and zoom.
+ */
+void GLSurface::set_layout (Layout new_layout)/*{{{*/
+{
+    if (new_layout == layout_mode) {
+        return;
+    }
+    // the same spot of the image stays in the middle of its cell
+    QSize before = view_cells().first().size();
+    layout_mode = new_layout;
+    rotation = 0;
+    QSize after = view_cells().first().size();
+    image_position += QPointF(after.width() - before.width(),
+                              after.height() - before.height()) * 0.5f;
+    emit view_changed();
+    updateGL();
+}/*}}}*/
+GLSurface::Layout GLSurface::view_layout () const/*{{{*/
+{
+    return layout_mode;
+}/*}}}*/
+int GLSurface::view_count () const/*{{{*/
+{
+    switch (layout_mode) {
+    case SIDE_BY_SIDE:
+    case WIPE:
+        return 2;
+    case QUAD:
+        return max_views;
+    default:
+        return 1;
+    }
+}/*}}}*/
+/**
+ * Shows @a image in @a view, 1 to max_views - 1, against the current
+ * image, which is view 0; null empties the view.  Only whole images are
+ * taken.  The texture comes from the same residency as the current
+ * image's, so an image that was on screen before goes up without an
+ * upload, and an image compared against becomes current without one.
+ */
+void GLSurface::set_compare (int view, const ImagePtr& image)/*{{{*/
+{
+    assert(view >= 1 && view < max_views);
+    CompareView& v = compare[view - 1];
+    if (image == v.image) {
+        return;
+    }
+    makeCurrent();
+    v.image.clear();
+    v.texture_image.clear();
+    v.tex = 0;
+    if (image && image->complete()) {
+        PROFILE_SCOPE("upload compare");
+        v.image = image;
+        // no tiles for these; a stand-in that fits in one texture instead
+        v.texture_image = TileCache::needed(*image, max_texture_size,
+                                            tile_budget)
+                          ? stand_in(image) : image;
+        update_shown();
+        v.tex = residency.find(v.texture_image);
+        if (v.tex == 0) {
+            v.tex = residency.allocate(v.texture_image);
+            compare_uploader.start(v.texture_image, v.tex);
+            compare_uploader.finish();
+            if ( ! compare_uploader.busy()) {
+                residency.uploaded(v.texture_image);
+            }
+        }
+        GLERRCHK();
+    }
+    update_shown();
+    updateGL();
+}/*}}}*/
+/**
+ * Which view sits in which cell moves round by one: A and B trade places
+ * in a 2-up or either side of a wipe.
+ */
+void GLSurface::rotate_views ()/*{{{*/
+{
+    rotation = (rotation + 1) % view_count();
+    updateGL();
+}/*}}}*/
+/**
+ * The cells views are drawn in, GL style with y up, for the layout and
+ * surface size.  A wipe puts both views over the whole surface.
+ */
+QList<QRect> GLSurface::view_cells () const/*{{{*/
+{
+    int w = surface_size.width();
+    int h = surface_size.height();
+    int hw = w / 2;
+    int hh = h / 2;
+    QList<QRect> cells;
+    switch (layout_mode) {
+    case SINGLE:
+        cells << QRect(0, 0, w, h);
+        break;
+    case SIDE_BY_SIDE:
+        cells << QRect(0, 0, hw, h) << QRect(hw, 0, w - hw, h);
+        break;
+    case WIPE:
+        cells << QRect(0, 0, w, h) << QRect(0, 0, w, h);
+        break;
+    case QUAD:
+        cells << QRect(0, hh, hw, h - hh) << QRect(hw, hh, w - hw, h - hh)
+              << QRect(0, 0, hw, hh) << QRect(hw, 0, w - hw, hh);
+        break;
+    }
+    return cells;
+}/*}}}*/
+/**
+ * The subsample a compared @a image too big for one texture is shown
+ * through.  The same one every time, so its texture stays resident; the
+ * last few are kept for going back and forth between versions.
+ */
+ImagePtr GLSurface::stand_in (const ImagePtr& image)/*{{{*/
+{
+    for (int i = 0; i < stand_ins.size(); i++) {
+        if (stand_ins[i].source.toStrongRef() == image) {
+            stand_ins.move(i, 0);
+            return stand_ins.first().image;
+        }
+    }
+    StandIn s;
+    s.source = image.toWeakRef();
+    s.image = image->subsample(qMin(max_texture_size, 4096));
+    stand_ins.prepend(s);
+    while (stand_ins.size() > 2 * (max_views - 1)) {
+        stand_ins.removeLast();
+    }
+    return s.image;
+}/*}}}*/
+/**
+ * Tells the residency what is on screen, so none of it is evicted.
+ */
+void GLSurface::update_shown ()/*{{{*/
+{
+    QList<ImagePtr> shown;
+    shown << current_image;
+    for (int i = 0; i < max_views - 1; i++) {
+        shown << compare[i].texture_image;
+    }
+    residency.set_shown(shown);
 }/*}}}*/
 
 void GLSurface::mousePressEvent (QMouseEvent* evt)/*{{{*/
@@ -344,9 +803,23 @@ void GLSurface::mousePressEvent (QMouseEvent* evt)/*{{{*/
     QPointF pos = evt->pos();
     pos.ry() *= -1;
     prev_mouse_point = pos;
+    // grabbing the wipe line moves it; anywhere else pans
+    dragging_wipe = layout_mode == WIPE
+        && qAbs(evt->x() - wipe * surface_size.width()) <= 8.0f;
 }/*}}}*/
 void GLSurface::mouseMoveEvent (QMouseEvent* evt)/*{{{*/
 {
+    if (evt->buttons() == Qt::NoButton) {
+        if (probing) {
+            probe(evt->pos());
+        }
+        return;
+    }
+    if (dragging_wipe) {
+        wipe = qBound(0.0f, (float)evt->x() / surface_size.width(), 1.0f);
+        updateGL();
+        return;
+    }
     QPointF pos = evt->pos();
     pos.ry() *= -1;
     QPointF delta = pos - prev_mouse_point;
@@ -354,6 +827,15 @@ void GLSurface::mouseMoveEvent (QMouseEvent* evt)/*{{{*/
     prev_mouse_point = pos;
     updateGL();
 }/*}}}*/
+void GLSurface::mouseReleaseEvent (QMouseEvent* evt)/*{{{*/
+{
+    Q_UNUSED(evt);
+    if (dragging_wipe) {
+        dragging_wipe = false;
+        return;
+    }
+    emit view_changed();  // once the drag is over, not on every step
+}/*}}}*/
 void GLSurface::wheelEvent (QWheelEvent* evt)/*{{{*/
 {
     int degs = evt->delta() / 8;
@@ -380,16 +862,32 @@ void GLSurface::keyPressEvent (QKeyEvent* evt)/*{{{*/
     case '-':
         scale -= 0.1f;
         showMessage(QString("Zoom %1%").arg(scale*100));
+        emit view_changed();
         break;
     case '+':
     case '=':
         scale += 0.1f;
         showMessage(QString("Zoom %1%").arg(scale*100));
+        emit view_changed();
         break;
     case 'S':
         use_shader = ! use_shader;
         showMessage(QString("Shader %1").arg((use_shader ? "on" : "off")));
         break;
+    case 'T':
+        // every variant is already built, so this is only a program switch
+        tone_op = (ToneMapper::Operator)((tone_op + 1)
+                                         % ToneMapper::OPERATOR_COUNT);
+        if (tone_op == ToneMapper::RAW) {
+            tone_op = ToneMapper::CURVE;
+        }
+        use_shader = true;
+        if (auto_exposure) {
+            expose();
+        }
+        showMessage(QString("Tone mapping: %1")
+                    .arg(ToneMapper::name(tone_op)));
+        break;
     case '[':
         if (use_shader) {
             tmapr.exposure -= 0.1f;
@@ -402,10 +900,214 @@ void GLSurface::keyPressEvent (QKeyEvent* evt)/*{{{*/
             showMessage(QString("Exposure %1").arg(tmapr.exposure));
         }
         break;
+    case 'M': {
+        BufferArena::Stats a = BufferArena::stats();
+        TextureResidency::Stats t = residency.stats();
+        const double mb = 1.0 / (1 << 20);
+        showMessage(QString("Image buffers: %1 MB in use (peak %2 MB),"
+                            " %3 MB cached (peak mapped %4 MB),"
+                            " %5 of %6 reused; textures: %7 MB of %8 MB"
+                            " in %9 (%10 BC6H), %11 of %12 resident")
+                    .arg(a.in_use * mb, 0, 'f', 0)
+                    .arg(a.in_use_peak * mb, 0, 'f', 0)
+                    .arg(a.cached * mb, 0, 'f', 0)
+                    .arg(a.mapped_peak * mb, 0, 'f', 0)
+                    .arg(a.hits).arg(a.hits + a.misses)
+                    .arg(t.bytes * mb, 0, 'f', 0)
+                    .arg(t.budget * mb, 0, 'f', 0)
+                    .arg(t.textures).arg(t.compressed)
+                    .arg(t.hits).arg(t.hits + t.misses));
+        break;
+    }
+    case 'P':
+        // the overlay goes, the recording for the trace carries on
+        show_profile = ! show_profile;
+        if (show_profile) {
+            Profiler::set_enabled(true);
+            overlay_timer.start();
+        } else {
+            overlay_timer.stop();
+        }
+        overlay_age = QTime();
+        break;
+    case 'I':
+        probing = ! probing;
+        showMessage(QString("Pixel probe %1").arg(probing ? "on" : "off"));
+        break;
+    case 'A':
+        auto_exposure = ! auto_exposure;
+        if (auto_exposure) {
+            expose();
+        }
+        showMessage(QString("Auto exposure %1 (exposure %2, log2 mean %3,"
+                            " min %4, max %5)")
+                    .arg(auto_exposure ? "on" : "off")
+                    .arg(tmapr.exposure)
+                    .arg(image_stats.average_log)
+                    .arg(image_stats.min).arg(image_stats.max));
+        break;
     }
     updateGL();
 }/*}}}*/
 
+/**
+ * Sets the exposure so the image's geometric mean luminance comes out at
+ * middle grey.  The curve operator's exposure is inverted through the
+ * curve; every other operator takes exposure as a plain linear gain.
+ */
+void GLSurface::expose ()/*{{{*/
+{
+    if ( ! image_stats.valid) {
+        return;
+    }
+    const float bright_threshold = 1.2f;
+    const float middle_grey = 0.18f;
+
+    // yd = e (e / t + 1) / (e + 1) is the scale that lands the mean on grey
+    float yd = middle_grey / exp2f(image_stats.average_log);
+    if (tone_op != ToneMapper::CURVE) {
+        tmapr.exposure = yd;
+        return;
+    }
+    float t = bright_threshold;
+    float b = 1.0f - yd;
+    tmapr.exposure = 0.5f * t * (sqrtf(b * b + 4.0f * yd / t) - b);
+}/*}}}*/
+
+/**
+ * The Profiler's summary, drawn with QPainter into a texture a few times a
+ * second and put in the top left corner in screen pixels.
+ */
+void GLSurface::draw_overlay ()/*{{{*/
+{
+    if (overlay_age.isNull() || overlay_age.elapsed() > 250) {
+        Profiler::Stat frame = Profiler::stat("frame");
+        Profiler::Stat paint = Profiler::stat("paint");
+        Profiler::Stat decode = Profiler::stat("decode");
+        Profiler::Stat upload = Profiler::stat("upload");
+        Profiler::Stat load = Profiler::stat("navigate to image");
+        qint64 hits = Profiler::counter("cache hit");
+        qint64 misses = Profiler::counter("cache miss");
+        QStringList lines;
+        lines << QString("frame %1 ms (paint %2 ms)")
+                 .arg(frame.average_ms, 0, 'f', 1)
+                 .arg(paint.average_ms, 0, 'f', 1)
+              << QString("decode %1 ms, %2 MB/s")
+                 .arg(decode.average_ms, 0, 'f', 1)
+                 .arg(decode.mb_per_s(), 0, 'f', 0)
+              << QString("upload %1 MB/s").arg(upload.mb_per_s(), 0, 'f', 0)
+              << QString("shown after %1 ms").arg(load.average_ms, 0, 'f', 1)
+              << QString("cache hits %1%")
+                 .arg(hits + misses > 0 ? 100.0 * hits / (hits + misses)
+                                        : 0.0, 0, 'f', 0);
+
+        QFont font ("Monospace", 9);
+        font.setStyleHint(QFont::TypeWriter);
+        QFontMetrics metrics (font);
+        int width = 0;
+        foreach (const QString& line, lines) {
+            width = qMax(width, metrics.width(line));
+        }
+        QImage text (width + 12, metrics.lineSpacing() * lines.size() + 8,
+                     QImage::Format_ARGB32);
+        text.fill(qRgb(32, 32, 32));
+        QPainter painter (&text);
+        painter.setFont(font);
+        painter.setPen(Qt::white);
+        for (int i = 0; i < lines.size(); i++) {
+            painter.drawText(6, 4 + metrics.ascent()
+                             + i * metrics.lineSpacing(), lines[i]);
+        }
+        painter.end();
+
+        glBindTexture(GL_TEXTURE_2D, overlay_tex);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, text.width(), text.height(),
+                     0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV,
+                     text.constBits());
+        overlay_size = text.size();
+        overlay_age.start();
+    }
+
+    // screen pixels, y up, untouched by the tone mapping
+    GLfloat screen[4] = {
+        2.0f / surface_size.width(), 2.0f / surface_size.height(), -1.0f, -1.0f
+    };
+    glBindBuffer(GL_UNIFORM_BUFFER, view_ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(screen), screen);
+    tonemapper.use(ToneMapper::RAW);
+    float h = overlay_size.height();
+    // the QImage's first row is its top
+    draw_quad(overlay_tex,
+              QRectF(8.0f, surface_size.height() - 8.0f - h,
+                     overlay_size.width(), h),
+              QRectF(0.0f, 1.0f, 1.0f, -1.0f));
+}/*}}}*/
+
+/**
+ * Shows the decoded values of the pixel under @a pos, in widget
+ * coordinates, as they are in memory: no exposure, no tone mapping.  The
+ * detail is read where it covers the pixel, being the finer of the two.
+ */
+void GLSurface::probe (const QPoint& pos)/*{{{*/
+{
+    QPoint p (pos.x(), surface_size.height() - 1 - pos.y());  // y up
+    QList<QRect> cells = view_cells();
+    int cell = 0;
+    if (layout_mode == WIPE) {
+        cell = p.x() < wipe * surface_size.width() ? 0 : 1;
+    } else {
+        while (cell < cells.size() - 1 && ! cells[cell].contains(p)) {
+            cell++;
+        }
+    }
+    int view = (cell + rotation) % cells.size();
+    ImagePtr image = view == 0 ? current_image : compare[view - 1].image;
+    if ( ! image) {
+        showMessage(QString());
+        return;
+    }
+
+    // back through set_view(), to full size pixels, y down
+    QSize full = image->full_size;
+    float fx = (p.x() - cells[cell].x() + 0.5f - image_position.x()) / scale
+               + 0.5f * full.width();
+    float fy = (p.y() - cells[cell].y() + 0.5f - image_position.y()) / scale
+               + 0.5f * full.height();
+    QPoint pixel ((int)floorf(fx), full.height() - 1 - (int)floorf(fy));
+    QString name = QString("%1 %2, %3").arg(QChar('A' + view))
+                   .arg(pixel.x()).arg(pixel.y());
+    if (view == 0 && detail_image && detail_image->region.contains(pixel)) {
+        image = detail_image;
+    }
+    if ( ! image->region.contains(pixel)) {
+        showMessage(QString("%1: outside the image").arg(name));
+        return;
+    }
+
+    const QRect& region = image->region;
+    int x = (pixel.x() - region.x()) * image->width / region.width();
+    int y = (pixel.y() - region.y()) * image->height / region.height();
+    int row = image->flip_y ? y : image->height - 1 - y;
+    if (row >= image->rows_ready()) {
+        showMessage(QString("%1: not decoded yet").arg(name));
+        return;
+    }
+    probe_row.resize((size_t)image->width * 4);
+    image->row_to_float(row, &probe_row[0]);
+    const float* v = &probe_row[(size_t)x * 4];
+    showMessage(QString("%1: R %2  G %3  B %4  A %5  (Y %6)%7")
+                .arg(name)
+                .arg(v[0], 0, 'g', 5).arg(v[1], 0, 'g', 5)
+                .arg(v[2], 0, 'g', 5).arg(v[3], 0, 'g', 5)
+                .arg(0.2126f * v[0] + 0.7152f * v[1] + 0.0722f * v[2],
+                     0, 'g', 5)
+                .arg(image->width < region.width()
+                     ? QString(" at 1/%1").arg(region.width() / image->width)
+                     : QString()));
+}/*}}}*/
 void GLSurface::showMessage (const QString& message, int timeout)/*{{{*/
 {
     reinterpret_cast<QMainWindow*>(parent()) \
@@ -21,36 +21,101 @@
 
 #pragma once
 
-#include <GL/glew.h>  // include before gl.h
-#include <QGLWidget>
+#include "Image.h"
+#include "Decoder.h"
+#include "TextureUploader.h"
+#include "TextureResidency.h"
+#include "TileCache.h"
+#include "ToneMapper.h"
+#include "ImageStats.h"
 
-#include <Cg/cg.h>
+#include <vector>
 
-struct apr_pool_t;
+#include <GL/glew.h>  // include before gl.h
+#include <QGLWidget>
+#include <QTime>
+#include <QTimer>
 
 class GLSurface : public QGLWidget
 {
     Q_OBJECT
 
+public:
+    /// how many images are on screen, and where
+    enum Layout {
+        SINGLE,
+        SIDE_BY_SIDE,  ///< A | B
+        WIPE,          ///< A and B over each other, split by a line
+        QUAD           ///< A B over C D
+    };
+
+    static const int max_views = 4;
+
 protected:
+    static const int coarse_size = 256;  ///< longest side of the preview
+
+    /// an image shown against the current one
+    struct CompareView {
+        ImagePtr image;
+        ImagePtr texture_image;  ///< what tex holds: image, or a subsample
+        GLuint tex;
+
+        CompareView () : tex(0) {}
+    };
+    /// a subsample standing in for a compared image too big for a texture
+    struct StandIn {
+        QWeakPointer<Image> source;
+        ImagePtr image;
+    };
+
     bool flip_y;
-    GLuint tex_id;
-    apr_pool_t* pool;
+    ImagePtr current_image;
+    GLuint tex_id;             ///< current_image's, from residency
+    GLuint coarse_tex_id;
+    bool has_coarse;
+    ImagePtr detail_image;     ///< finer part of current_image, over it
+    GLuint detail_tex_id;
+    QRectF detail_region;      ///< what detail_tex_id covers, y up
+    TextureUploader uploader;
+    TextureUploader compare_uploader;  ///< whole images, in one go
+    TextureResidency residency;
+    TileCache tiles;
+    bool tiled;                ///< current_image is drawn by tiles
+    GLint max_texture_size;
+    qint64 tile_budget;        ///< GPU memory for one image's tiles
     QSize image_size;
+    QRectF image_region;  ///< what tex_id covers, in image pixels, y up
     QSize surface_size;
     QPointF image_position;
     QPointF prev_mouse_point;
     float scale;
 
-    bool use_shader;
-    CGcontext cg_context;
-    CGprofile cg_fragment_profile;
-    CGprogram cg_fragment_program;
-
-    struct {
-        CGparameter scene_tex;
-        CGparameter exposure;
-    } cg_params;
+    Layout layout_mode;
+    CompareView compare[max_views - 1];  ///< views 1 and up; 0 is current
+    QList<StandIn> stand_ins;            ///< latest first, a few only
+    int rotation;         ///< view drawn in the first cell
+    float wipe;           ///< the wipe line, as a fraction of the width
+    bool dragging_wipe;
+
+    bool probing;         ///< raw values under the cursor, as it moves
+    std::vector<float> probe_row;
+
+    bool use_shader;      ///< tone_op, rather than raw values
+    ToneMapper::Operator tone_op;
+    bool auto_exposure;   ///< expose every new image from its statistics
+    bool stats_dirty;     ///< image_stats are for an earlier image
+    ImageStats stats;
+    ImageStats::Result image_stats;
+    ToneMapper tonemapper;
+    GLuint vao;           ///< the unit square every quad is drawn from
+    GLuint vbo;
+    GLuint view_ubo;      ///< the View uniform block, written once a frame
+
+    bool show_profile;    ///< Profiler overlay in the corner
+    GLuint overlay_tex;
+    QSize overlay_size;
+    QTime overlay_age;    ///< since overlay_tex was last drawn into
+    QTimer overlay_timer; ///< repaints while the overlay is up
 
     struct {
         float exposure;
@@ -61,19 +126,64 @@ public:
     virtual ~GLSurface ();
 
     void load_image (QImage& image);
-    void load_image (const QString& fname);
+    void load_image (const ImagePtr& image);
+    void show_frame (const ImagePtr& image);
+    void cancel_upload ();
+    void set_tile_budget (qint64 bytes);
+    void set_texture_budget (qint64 bytes);
+    void set_bc6h (bool on);
+
+    void set_layout (Layout layout);
+    Layout view_layout () const;
+    int view_count () const;
+    void set_compare (int view, const ImagePtr& image);
+
+    DecodeHints view_hints () const;
+    bool satisfies (const DecodeHints& hints) const;
+    void load_detail (const ImagePtr& image);
+    void clear_detail ();
+    const ImagePtr& shown_image () const;
+
+public slots:
+    void rotate_views ();
+
+signals:
+    /// zoomed, panned or resized; what is on screen may need more pixels
+    void view_changed ();
 
 protected:
     virtual void initializeGL ();
     virtual void resizeGL (int w, int h);
     virtual void paintGL ();
+    virtual void glDraw ();
 
     virtual void mousePressEvent (QMouseEvent* evt);
     virtual void mouseMoveEvent (QMouseEvent* evt);
+    virtual void mouseReleaseEvent (QMouseEvent* evt);
     virtual void wheelEvent (QWheelEvent* evt);
     virtual void keyPressEvent (QKeyEvent* evt);
 
+private slots:
+    void upload_encoded ();
+    void texture_replaced (GLuint old_tex, GLuint new_tex);
+
 private:
+    static QGLFormat core_format ();
+
+    void set_view (const QRect& cell, const QSize& full_size);
+    void draw_current (const QRect& cell, bool uploading, bool* more);
+    void draw_compare (const QRect& cell, const CompareView& view);
+    QList<QRect> view_cells () const;
+    void update_shown ();
+    ImagePtr stand_in (const ImagePtr& image);
+    void probe (const QPoint& pos);
+    void draw_quad (GLuint tex, const QRectF& rect);
+    void draw_quad (GLuint tex, const QRectF& rect, const QRectF& tex_rect);
+    void upload_coarse ();
+    void expose ();
+    void draw_overlay ();
+    QRectF visible_rect () const;
+
     void showMessage (const QString& message, int timeout = 0);
 };
 
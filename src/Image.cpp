@@ -0,0 +1,279 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file Image.cpp
+ * @brief Image implementation
+ */
+
+/* includes {{{*/
+#include "Image.h"
+
+#include "BufferArena.h"
+#include "Kernels.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include <half.h>
+/*}}}*/
+
+Image::Image (int width, int height, GLenum format, GLenum type) :/*{{{*/
+    width(width),
+    height(height),
+    format(format),
+    type(type),
+    flip_y(true),
+    opaque(false),
+    data(NULL),
+    full_size(width, height),
+    region(0, 0, width, height),
+    ready_rows(height)
+{
+    opaque = channels() < 4;
+    data = (char*)BufferArena::allocate(byte_size());
+    if (data == NULL) {
+        throw "out of memory";
+    }
+}/*}}}*/
+Image::~Image ()/*{{{*/
+{
+    BufferArena::release(data, byte_size());
+}/*}}}*/
+
+int Image::channels () const/*{{{*/
+{
+    switch (format) {
+    case GL_LUMINANCE:
+        return 1;
+    case GL_RGB:
+    case GL_BGR:
+        return 3;
+    default:
+        return 4;
+    }
+}/*}}}*/
+int Image::bytes_per_pixel () const/*{{{*/
+{
+    switch (type) {
+    case GL_UNSIGNED_BYTE:
+        return channels();
+    case GL_UNSIGNED_INT_8_8_8_8:
+    case GL_UNSIGNED_INT_8_8_8_8_REV:
+        return 4;
+    case GL_UNSIGNED_SHORT:
+    case GL_HALF_FLOAT_ARB:
+        return channels() * 2;
+    default:
+        return channels() * 4;
+    }
+}/*}}}*/
+size_t Image::bytes_per_line () const/*{{{*/
+{
+    return (size_t)width * bytes_per_pixel();
+}/*}}}*/
+size_t Image::byte_size () const/*{{{*/
+{
+    return (size_t)height * bytes_per_line();
+}/*}}}*/
+QSize Image::size () const/*{{{*/
+{
+    return QSize(width, height);
+}/*}}}*/
+
+int Image::rows_ready () const/*{{{*/
+{
+    // pairs with the release in set_ready_rows()
+    return const_cast<QAtomicInt&>(ready_rows).fetchAndAddAcquire(0);
+}/*}}}*/
+void Image::set_ready_rows (int rows)/*{{{*/
+{
+    ready_rows.fetchAndStoreRelease(rows);
+}/*}}}*/
+bool Image::complete () const/*{{{*/
+{
+    return rows_ready() >= height;
+}/*}}}*/
+/**
+ * Whether this is less than the whole source at full resolution.
+ */
+bool Image::is_partial () const/*{{{*/
+{
+    return region != QRect(QPoint(0, 0), full_size) || size() != full_size;
+}/*}}}*/
+
+/**
+ * Row @a y, in memory order, as RGBA floats; @a rgba has room for width * 4
+ * of them.  Integer samples are normalized to 0-1 and missing alpha is one.
+ */
+void Image::row_to_float (int y, float* rgba) const/*{{{*/
+{
+    int n = channels();
+    size_t count = (size_t)width * n;
+    const char* src = line(y);
+
+    // samples first, packed at the end so they can be spread out in place
+    float* s = rgba + (size_t)width * 4 - count;
+    switch (type) {
+    case GL_UNSIGNED_BYTE:
+    case GL_UNSIGNED_INT_8_8_8_8_REV:
+        for (size_t i = 0; i < count; i++) {
+            s[i] = ((const uint8_t*)src)[i] * (1.0f / 255.0f);
+        }
+        break;
+    case GL_UNSIGNED_INT_8_8_8_8:
+        for (size_t i = 0; i < count; i++) {
+            s[i] = ((const uint8_t*)src)[i ^ 3] * (1.0f / 255.0f);
+        }
+        break;
+    case GL_UNSIGNED_SHORT:
+        for (size_t i = 0; i < count; i++) {
+            s[i] = ((const uint16_t*)src)[i] * (1.0f / 65535.0f);
+        }
+        break;
+    case GL_HALF_FLOAT_ARB:
+        Kernels::half_to_float((const uint16_t*)src, s, count);
+        break;
+    default:
+        memcpy(s, src, count * sizeof(float));
+    }
+
+    for (int x = 0; x < width; x++, s += n, rgba += 4) {
+        float r, g, b, a = 1.0f;
+        switch (format) {
+        case GL_LUMINANCE:
+            r = g = b = s[0];
+            break;
+        case GL_BGR:
+        case GL_BGRA:
+            r = s[2];
+            g = s[1];
+            b = s[0];
+            break;
+        default:
+            r = s[0];
+            g = s[1];
+            b = s[2];
+        }
+        if (n == 4) {
+            a = s[3];
+        }
+        rgba[0] = r;
+        rgba[1] = g;
+        rgba[2] = b;
+        rgba[3] = a;
+    }
+}/*}}}*/
+
+/**
+ * Point sampled copy no larger than @a max_size on either side.
+ *
+ * Meant for previews that have to exist before the first frame; it keeps
+ * the pixel format so the copy uploads exactly like the original.
+ */
+QSharedPointer<Image> Image::subsample (int max_size) const/*{{{*/
+{
+    int step = qMax(1, (qMax(width, height) + max_size - 1) / max_size);
+    int w = qMax(1, width / step);
+    int h = qMax(1, height / step);
+    int bpp = bytes_per_pixel();
+
+    QSharedPointer<Image> small (new Image(w, h, format, type));
+    small->flip_y = flip_y;
+    small->opaque = opaque;
+    small->full_size = full_size;
+    small->region = region;
+    for (int y = 0; y < h; y++) {
+        const char* src = line(y * step);
+        char* dst = small->line(y);
+        for (int x = 0; x < w; x++) {
+            memcpy(dst + x * bpp, src + x * step * bpp, bpp);
+        }
+    }
+    return small;
+}/*}}}*/
+/**
+ * Box filtered copy at half the resolution, rounding odd sizes up.
+ *
+ * Used to build mip levels on the CPU for images too large to hand to the
+ * GL in one piece.  Samples are averaged in their own type; half floats go
+ * through float and back.
+ */
+QSharedPointer<Image> Image::half_size () const/*{{{*/
+{
+    int w = (width + 1) / 2;
+    int h = (height + 1) / 2;
+    int bpp = bytes_per_pixel();
+
+    QSharedPointer<Image> half_image (new Image(w, h, format, type));
+    half_image->flip_y = flip_y;
+    half_image->opaque = opaque;
+    half_image->full_size = full_size;
+    half_image->region = region;
+
+    bool is_8bit = type == GL_UNSIGNED_BYTE
+                || type == GL_UNSIGNED_INT_8_8_8_8
+                || type == GL_UNSIGNED_INT_8_8_8_8_REV;
+    int samples = width * bpp / (is_8bit ? 1 : type == GL_FLOAT ? 4 : 2);
+    int n = samples / width;  // samples per pixel
+    std::vector<float> row0, row1;
+    if (type == GL_HALF_FLOAT_ARB) {
+        row0.resize(samples);
+        row1.resize(samples);
+    }
+
+    for (int y = 0; y < h; y++) {
+        const char* a = line(2 * y);
+        const char* b = line(qMin(2 * y + 1, height - 1));
+        char* dst = half_image->line(y);
+        if (type == GL_HALF_FLOAT_ARB) {
+            Kernels::half_to_float((const uint16_t*)a, &row0[0], samples);
+            Kernels::half_to_float((const uint16_t*)b, &row1[0], samples);
+        }
+        for (int x = 0; x < w; x++) {
+            int x0 = 2 * x * n;
+            int x1 = qMin(2 * x + 1, width - 1) * n;
+            for (int c = 0; c < n; c++) {
+                int i = x * n + c;
+                if (is_8bit) {
+                    const uint8_t* p = (const uint8_t*)a;
+                    const uint8_t* q = (const uint8_t*)b;
+                    ((uint8_t*)dst)[i] = (uint8_t)((p[x0 + c] + p[x1 + c]
+                                         + q[x0 + c] + q[x1 + c] + 2) >> 2);
+                } else if (type == GL_UNSIGNED_SHORT) {
+                    const uint16_t* p = (const uint16_t*)a;
+                    const uint16_t* q = (const uint16_t*)b;
+                    ((uint16_t*)dst)[i] = (uint16_t)((p[x0 + c] + p[x1 + c]
+                                          + q[x0 + c] + q[x1 + c] + 2) >> 2);
+                } else if (type == GL_HALF_FLOAT_ARB) {
+                    half v = 0.25f * (row0[x0 + c] + row0[x1 + c]
+                                      + row1[x0 + c] + row1[x1 + c]);
+                    ((uint16_t*)dst)[i] = v.bits();
+                } else {
+                    const float* p = (const float*)a;
+                    const float* q = (const float*)b;
+                    ((float*)dst)[i] = 0.25f * (p[x0 + c] + p[x1 + c]
+                                                + q[x0 + c] + q[x1 + c]);
+                }
+            }
+        }
+    }
+    return half_image;
+}/*}}}*/
+
+// vim: sw=4 fdm=marker
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file Image.h
+ * @brief Image definition
+ */
+
+#pragma once
+
+#include <GL/glew.h>  // include before gl.h
+#include <QSharedPointer>
+#include <QAtomicInt>
+#include <QMetaType>
+#include <QSize>
+#include <QRect>
+
+/**
+ * Decoded pixels in client memory, ready for upload.
+ *
+ * Decoders produce these on worker threads; the GL thread only ever uploads
+ * them.  The pixel layout is described in GL terms so the upload is a single
+ * glTexImage2D call.  The pixels come from the BufferArena, so the next image
+ * of the same size reuses them.
+ *
+ * An Image may be a reduced resolution level and/or a window of the source;
+ * full_size and region say where it sits.  By default it is all of it.
+ *
+ * A new Image counts as complete.  Streaming decoders reset the ready row
+ * count to zero and raise it as rows land; readers on other threads only
+ * look at rows below rows_ready().
+ */
+class Image
+{
+public:
+    int width;
+    int height;
+    GLenum format;      ///< e.g. GL_RGB, GL_RGBA, GL_BGRA
+    GLenum type;        ///< e.g. GL_UNSIGNED_SHORT, GL_HALF_FLOAT_ARB
+    bool flip_y;        ///< first row in memory is the top of the image
+    bool opaque;        ///< alpha is one throughout, or there is none
+    char* data;
+
+    QSize full_size;    ///< the whole source image at full resolution
+    QRect region;       ///< part of full_size these pixels cover, y down
+
+private:
+    QAtomicInt ready_rows;  ///< rows, in memory order, already decoded
+
+public:
+    Image (int width, int height, GLenum format, GLenum type);
+    ~Image ();
+
+    int channels () const;
+    int bytes_per_pixel () const;
+    size_t bytes_per_line () const;
+    size_t byte_size () const;
+    QSize size () const;
+
+    char* line (int y) { return data + y * bytes_per_line(); }
+    const char* line (int y) const { return data + y * bytes_per_line(); }
+
+    void row_to_float (int y, float* rgba) const;
+
+    QSharedPointer<Image> subsample (int max_size) const;
+    QSharedPointer<Image> half_size () const;
+
+    int rows_ready () const;
+    void set_ready_rows (int rows);
+    bool complete () const;
+    bool is_partial () const;
+
+private:
+    Image (const Image&);
+    Image& operator= (const Image&);
+};
+
+typedef QSharedPointer<Image> ImagePtr;
+
+Q_DECLARE_METATYPE(ImagePtr)
+
+// vim: sw=4 fdm=marker
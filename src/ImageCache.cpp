@@ -0,0 +1,92 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ImageCache.cpp
+ * @brief ImageCache implementation
+ */
+
+/* includes {{{*/
+#include "ImageCache.h"
+
+#include <QMutexLocker>
+
+#include <limits.h>
+/*}}}*/
+
+static int kib (qint64 bytes)/*{{{*/
+{
+    qint64 k = (bytes + 1023) / 1024;
+    return k > INT_MAX ? INT_MAX : (int)k;
+}/*}}}*/
+
+ImageCache::ImageCache (qint64 budget_bytes) :/*{{{*/
+    images(kib(budget_bytes))
+{
+}/*}}}*/
+ImageCache::~ImageCache ()/*{{{*/
+{
+}/*}}}*/
+
+ImagePtr ImageCache::find (const QString& key)/*{{{*/
+{
+    QMutexLocker lock (&mutex);
+    // QCache::object() also moves the entry to the front of the LRU list
+    ImagePtr* image = images.object(key);
+    return image ? *image : ImagePtr();
+}/*}}}*/
+bool ImageCache::contains (const QString& key) const/*{{{*/
+{
+    QMutexLocker lock (&mutex);
+    return images.contains(key);
+}/*}}}*/
+void ImageCache::insert (const QString& key, const ImagePtr& image)/*{{{*/
+{
+    if ( ! image) {
+        return;
+    }
+    QMutexLocker lock (&mutex);
+    // an image larger than the whole budget is simply not cached
+    images.insert(key, new ImagePtr(image), kib(image->byte_size()));
+}/*}}}*/
+void ImageCache::remove (const QString& key)/*{{{*/
+{
+    QMutexLocker lock (&mutex);
+    images.remove(key);
+}/*}}}*/
+void ImageCache::clear ()/*{{{*/
+{
+    QMutexLocker lock (&mutex);
+    images.clear();
+}/*}}}*/
+
+void ImageCache::set_budget (qint64 budget_bytes)/*{{{*/
+{
+    QMutexLocker lock (&mutex);
+    images.setMaxCost(kib(budget_bytes));
+}/*}}}*/
+qint64 ImageCache::budget () const/*{{{*/
+{
+    QMutexLocker lock (&mutex);
+    return (qint64)images.maxCost() * 1024;
+}/*}}}*/
+qint64 ImageCache::used () const/*{{{*/
+{
+    QMutexLocker lock (&mutex);
+    return (qint64)images.totalCost() * 1024;
+}/*}}}*/
+
+// vim: sw=4 fdm=marker
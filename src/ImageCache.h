@@ -0,0 +1,57 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ImageCache.h
+ * @brief ImageCache definition
+ */
+
+#pragma once
+
+#include "Image.h"
+
+#include <QCache>
+#include <QMutex>
+#include <QString>
+
+/**
+ * Thread safe LRU store of decoded images, bounded by a memory budget.
+ *
+ * Images are shared pointers, so evicting one that is still on screen or
+ * being uploaded only drops the cache's reference.
+ */
+class ImageCache
+{
+private:
+    mutable QMutex mutex;
+    QCache<QString, ImagePtr> images;  ///< cost is in KiB
+
+public:
+    ImageCache (qint64 budget_bytes);
+    virtual ~ImageCache ();
+
+    ImagePtr find (const QString& key);
+    bool contains (const QString& key) const;
+    void insert (const QString& key, const ImagePtr& image);
+    void remove (const QString& key);
+    void clear ();
+
+    void set_budget (qint64 budget_bytes);
+    qint64 budget () const;
+    qint64 used () const;
+};
+
+// vim: sw=4 fdm=marker
@@ -0,0 +1,435 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ImageLoader.cpp
+ * @brief ImageLoader implementation
+ */
+
+/* includes {{{*/
+#include "ImageLoader.moc"
+#include "Decoder.h"
+#include "InputFile.h"
+#include "Profiler.h"
+
+#include <QtCore>
+
+#include <exception>
+#include <limits.h>
+/*}}}*/
+
+class JobContext : public DecodeContext/*{{{*/
+{
+private:
+    ImageLoader* loader;
+    QString key;
+
+public:
+    JobContext (ImageLoader* loader, const QString& key,
+                const CancelToken& cancel, const DecodeHints& hints) :
+        DecodeContext(cancel, hints),
+        loader(loader),
+        key(key)
+    {
+    }
+
+    virtual void started (const ImagePtr& image)
+    {
+        emit loader->image_started(key, image);
+    }
+
+    virtual void preview (const ImagePtr& image)
+    {
+        // shown like a preview from the disk cache; never written to it
+        loader->cache.insert(key, image);
+        emit loader->image_ready(key, image);
+    }
+};/*}}}*/
+
+class DecodeJob : public QRunnable/*{{{*/
+{
+private:
+    ImageLoader* loader;
+    QString key;
+    CancelToken cancel;
+    DecodeHints hints;
+
+public:
+    DecodeJob (ImageLoader* loader, const QString& key,
+               const CancelToken& cancel, const DecodeHints& hints) :
+        loader(loader),
+        key(key),
+        cancel(cancel),
+        hints(hints)
+    {
+    }
+
+    virtual void run ()
+    {
+        loader->run_job(key, cancel, hints);
+    }
+};/*}}}*/
+
+class ReadaheadJob : public QRunnable/*{{{*/
+{
+private:
+    QStringList files;
+
+public:
+    ReadaheadJob (const QStringList& files) :
+        files(files)
+    {
+    }
+
+    virtual void run ()
+    {
+        foreach (const QString& fname, files) {
+            InputFile::readahead(fname);
+        }
+    }
+};/*}}}*/
+
+ImageLoader::ImageLoader (qint64 budget_bytes, QObject* parent) :/*{{{*/
+    QObject(parent),
+    cache(budget_bytes),
+    ahead(4),
+    behind(1),
+    readahead_count(8)
+{
+    qRegisterMetaType<ImagePtr>("ImagePtr");
+}/*}}}*/
+ImageLoader::~ImageLoader ()/*{{{*/
+{
+    mutex.lock();
+    wanted.clear();
+    cancel_unwanted();  // queued jobs become no-ops
+    mutex.unlock();
+    pool.waitForDone();
+}/*}}}*/
+
+DiskCache& ImageLoader::preview_cache ()/*{{{*/
+{
+    return disk_cache;
+}/*}}}*/
+
+void ImageLoader::set_prefetch (int ahead, int behind)/*{{{*/
+{
+    this->ahead = qMax(0, ahead);
+    this->behind = qMax(0, behind);
+}/*}}}*/
+int ImageLoader::prefetch_ahead () const/*{{{*/
+{
+    return ahead;
+}/*}}}*/
+int ImageLoader::prefetch_behind () const/*{{{*/
+{
+    return behind;
+}/*}}}*/
+/**
+ * How many files past the prefetch window the kernel is asked to start
+ * reading, so they are in the page cache by the time they are decoded.
+ */
+void ImageLoader::set_readahead (int count)/*{{{*/
+{
+    readahead_count = qMax(0, count);
+}/*}}}*/
+void ImageLoader::set_thread_count (int count)/*{{{*/
+{
+    pool.setMaxThreadCount(qMax(1, count));
+}/*}}}*/
+void ImageLoader::set_hints (const DecodeHints& hints)/*{{{*/
+{
+    QMutexLocker lock (&mutex);
+    this->hints = hints;
+}/*}}}*/
+
+static const char detail_mark[] = "#region=";
+
+QString ImageLoader::key_for (const QString& fname)/*{{{*/
+{
+    return QFileInfo(fname).absoluteFilePath();
+}/*}}}*/
+/**
+ * The file a key decodes; detail keys carry the region after the path.
+ */
+QString ImageLoader::path_for (const QString& key)/*{{{*/
+{
+    int mark = key.lastIndexOf(detail_mark);
+    return mark < 0 ? key : key.left(mark);
+}/*}}}*/
+
+/**
+ * The cached image for @a fname if it is decoded in full and good enough
+ * for the current hints, without scheduling anything.
+ */
+ImagePtr ImageLoader::find_ready (const QString& fname)/*{{{*/
+{
+    QString key = key_for(fname);
+    QMutexLocker lock (&mutex);
+    ImagePtr image = cache.find(key);
+    if (image && image->complete() && hints.satisfied_by(*image)) {
+        return image;
+    }
+    return ImagePtr();
+}/*}}}*/
+void ImageLoader::request (const QString& fname)/*{{{*/
+{
+    QString key = key_for(fname);
+    ImagePtr image = cache.find(key);
+
+    QMutexLocker lock (&mutex);
+    current = key;
+    wanted.insert(key);
+    bool good_enough = image && hints.satisfied_by(*image);
+    Profiler::count(good_enough ? "cache hit" : "cache miss");
+    if ( ! good_enough) {
+        schedule(key, INT_MAX);
+    }
+    lock.unlock();
+
+    if (image) {
+        emit image_ready(key, image);  // maybe just a stand-in
+    }
+}/*}}}*/
+/**
+ * Decodes the part of @a fname that @a hints ask for, at the resolution
+ * they ask for, without touching what is cached for the whole file.  The
+ * hints are snapped first, so panning and zooming a little reuse it, and
+ * cut down to what the file's format honours once a decode has found out,
+ * so panning over a raw file, which is only ever read whole, reuses it too.
+ *
+ * @return the key image_ready() will carry
+ */
+QString ImageLoader::request_detail (const QString& fname, const DecodeHints& hints)/*{{{*/
+{
+    mutex.lock();
+    int format = capabilities.value(key_for(fname), -1);
+    mutex.unlock();
+
+    DecodeHints snapped = hints.snapped().honoured_by(format);
+    QRectF v = snapped.view.isNull() ? QRectF(0, 0, 1, 1) : snapped.view;
+    QString key = key_for(fname)
+        + QString("%1%2,%3,%4,%5/%6").arg(detail_mark)
+          .arg(qRound(v.left() * 16)).arg(qRound(v.top() * 16))
+          .arg(qRound(v.right() * 16)).arg(qRound(v.bottom() * 16))
+          .arg(snapped.reduction());
+    ImagePtr image = cache.find(key);
+
+    QMutexLocker lock (&mutex);
+    if (key != detail) {
+        wanted.remove(detail);  // cancelled below, if still going
+        detail = key;
+    }
+    wanted.insert(key);
+    cancel_unwanted();
+    Profiler::count(image ? "cache hit" : "cache miss");
+    if ( ! image) {
+        schedule(key, INT_MAX, snapped);
+    }
+    lock.unlock();
+
+    if (image) {
+        emit image_ready(key, image);
+    }
+    return key;
+}/*}}}*/
+/**
+ * Decodes @a fnames, right behind the current file, and keeps them wanted
+ * until the next pin().  Cached ones come back through image_ready()
+ * straight away.  They are decoded whole at the current scale: only the
+ * current file gets details, so a crop to its view would leave the others
+ * blank once the view moves.
+ */
+void ImageLoader::pin (const QStringList& fnames)/*{{{*/
+{
+    QStringList keys;
+    QList<ImagePtr> images;
+    foreach (const QString& fname, fnames) {
+        keys << key_for(fname);
+        images << cache.find(keys.last());
+    }
+
+    // files no longer pinned fall out of wanted with the next prefetch()
+    QMutexLocker lock (&mutex);
+    DecodeHints whole;
+    whole.scale = hints.scale;
+    pinned = keys;
+    for (int i = 0; i < keys.size(); i++) {
+        wanted.insert(keys[i]);
+        if ( ! images[i] || ! whole.satisfied_by(*images[i])) {
+            schedule(keys[i], INT_MAX - 1, whole);
+        }
+    }
+    lock.unlock();
+
+    for (int i = 0; i < keys.size(); i++) {
+        if (images[i]) {
+            emit image_ready(keys[i], images[i]);
+        }
+    }
+}/*}}}*/
+void ImageLoader::prefetch (const QStringList& list, int index, int direction)/*{{{*/
+{
+    if (list.isEmpty()) {
+        return;
+    }
+    direction = direction < 0 ? -1 : 1;
+
+    QStringList order;
+    for (int i = 1; i <= qMax(ahead, behind); i++) {
+        if (i <= ahead) {
+            order << list[((index + i * direction) % list.size()
+                           + list.size()) % list.size()];
+        }
+        if (i <= behind) {
+            order << list[((index - i * direction) % list.size()
+                           + list.size()) % list.size()];
+        }
+    }
+
+    QMutexLocker lock (&mutex);
+    wanted.clear();
+    wanted.insert(current);
+    wanted.insert(key_for(list[index]));
+    foreach (const QString& key, pinned) {
+        wanted.insert(key);
+    }
+    for (int i = 0; i < order.size(); i++) {
+        QString key = key_for(order[i]);
+        if (wanted.contains(key)) {
+            continue;  // short lists wrap onto themselves
+        }
+        wanted.insert(key);
+        // nearest neighbours first, all behind the requested file
+        schedule(key, order.size() - i);
+    }
+    cancel_unwanted();
+
+    // opening a file can take a round trip on NFS, so not on this thread
+    QStringList next;
+    for (int i = ahead + 1; i <= ahead + readahead_count
+                            && i < list.size(); i++) {
+        QString fname = list[((index + i * direction) % list.size()
+                              + list.size()) % list.size()];
+        if ( ! read_ahead.contains(fname)) {
+            next << fname;
+        }
+    }
+    if ( ! next.isEmpty()) {
+        read_ahead = next;
+        QThreadPool::globalInstance()->start(new ReadaheadJob(next));
+    }
+}/*}}}*/
+
+bool ImageLoader::satisfied (const QString& key, const DecodeHints& hints)/*{{{*/
+{
+    // called with mutex held
+    ImagePtr image = cache.find(key);
+    return image && hints.satisfied_by(*image);
+}/*}}}*/
+void ImageLoader::schedule (const QString& key, int priority)/*{{{*/
+{
+    schedule(key, priority, hints);
+}/*}}}*/
+void ImageLoader::schedule (const QString& key, int priority, const DecodeHints& hints)/*{{{*/
+{
+    // called with mutex held
+    if (satisfied(key, hints)) {
+        return;
+    }
+    if (pending.contains(key) && ! pending[key].cancelled()) {
+        return;
+    }
+    CancelToken cancel;
+    pending.insert(key, cancel);
+    pool.start(new DecodeJob(this, key, cancel, hints), priority);
+}/*}}}*/
+void ImageLoader::cancel_unwanted ()/*{{{*/
+{
+    // called with mutex held
+    QHash<QString, CancelToken>::iterator it;
+    for (it = pending.begin(); it != pending.end(); ++it) {
+        if ( ! wanted.contains(it.key())) {
+            it.value().cancel();
+        }
+    }
+}/*}}}*/
+void ImageLoader::run_job (const QString& key, const CancelToken& cancel, const DecodeHints& hints)/*{{{*/
+{
+    ImagePtr image;
+    bool finished = false;
+    bool store = false;
+    int format = -1;
+    bool whole_file = path_for(key) == key;
+
+    // a preview from an earlier run may be all the view needs
+    if (whole_file && ! cancel.cancelled() && ! cache.contains(key)) {
+        image = disk_cache.preview(key);
+        if (image && hints.satisfied_by(*image)) {
+            finished = true;
+        } else if (image) {
+            cache.insert(key, image);
+            emit image_ready(key, image);  // a stand-in until the decode
+        }
+    }
+
+    // the window may have moved on while this job sat in the queue
+    if ( ! finished && ! cancel.cancelled()) {
+        try {
+            JobContext context (this, key, cancel, hints);
+            image = decode(key, context);
+            format = image ? context.capabilities : -1;
+            finished = true;
+            store = whole_file && image && ! image->is_partial()
+                    && ! disk_cache.contains(key);
+        } catch (const DecodeCancelled&) {
+        }
+    }
+
+    if (finished) {
+        cache.insert(key, image);
+    }
+
+    mutex.lock();
+    if (pending.contains(key) && pending[key] == cancel) {
+        pending.remove(key);
+    }
+    if (format != -1) {
+        capabilities.insert(path_for(key), format);
+    }
+    mutex.unlock();
+
+    if (finished) {
+        emit image_ready(key, image);
+    }
+    // only once it is on its way to the screen
+    if (store) {
+        disk_cache.store(key, *image);
+    }
+}/*}}}*/
+ImagePtr ImageLoader::decode (const QString& key, DecodeContext& context)/*{{{*/
+{
+    try {
+        return Decoder::decode(path_for(key), context);
+    } catch (const char* msg) {
+        qDebug() << key << msg;
+    } catch (const std::exception& e) {
+        qDebug() << key << e.what();
+    }
+    return ImagePtr();
+}/*}}}*/
+
+// vim: sw=4 fdm=marker
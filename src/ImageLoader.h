@@ -0,0 +1,129 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ImageLoader.h
+ * @brief ImageLoader definition
+ */
+
+#pragma once
+
+#include "ImageCache.h"
+#include "DiskCache.h"
+#include "Decoder.h"
+
+#include <QObject>
+#include <QThreadPool>
+#include <QStringList>
+#include <QHash>
+#include <QSet>
+
+/**
+ * Decodes images on a worker pool into an ImageCache.
+ *
+ * request() is the asynchronous front door: the decoded image comes back
+ * through image_ready(), queued to the GUI thread, which only uploads it.
+ * prefetch() keeps a window of neighbours around the current file decoded,
+ * biased towards the scroll direction.  Anything that falls out of the
+ * window, queued or already decoding, is cancelled.
+ *
+ * Decodes are made with the current DecodeHints.  A cached image that
+ * doesn't satisfy them is still shown, then replaced by a better one.
+ * Before decoding, a preview from the DiskCache is tried; if it satisfies
+ * the hints, as it does when zoomed out, the decode is skipped altogether.
+ * Whole images that were decoded are written to the DiskCache.  Files
+ * further along than the window are read ahead into the page cache.
+ *
+ * request_detail() decodes part of a file at a finer resolution than the
+ * image that is cached for it, under a key of its own, for the view after
+ * zooming in.  Only the latest detail request is kept going.
+ *
+ * pin() keeps other files decoded alongside the current one, whatever the
+ * prefetch window, for comparing against it.
+ */
+class ImageLoader : public QObject
+{
+    Q_OBJECT
+
+    friend class DecodeJob;
+    friend class JobContext;
+
+private:
+    ImageCache cache;
+    DiskCache disk_cache;
+    QThreadPool pool;
+
+    QMutex mutex;
+    QHash<QString, CancelToken> pending;  ///< keys being decoded right now
+    QSet<QString> wanted;                 ///< current file + prefetch window
+    QString current;
+    QString detail;                       ///< key of the latest detail
+    QStringList pinned;                   ///< keys compared against current
+    QHash<QString, int> capabilities;     ///< of the format each file read as
+    DecodeHints hints;
+
+    int ahead;
+    int behind;
+    int readahead_count;
+    QStringList read_ahead;               ///< last files handed to readahead
+
+public:
+    ImageLoader (qint64 budget_bytes, QObject* parent = NULL);
+    virtual ~ImageLoader ();
+
+    DiskCache& preview_cache ();
+
+    void set_prefetch (int ahead, int behind);
+    int prefetch_ahead () const;
+    int prefetch_behind () const;
+    void set_readahead (int count);
+    void set_thread_count (int count);
+    void set_hints (const DecodeHints& hints);
+
+    ImagePtr find_ready (const QString& fname);
+    void request (const QString& fname);
+    QString request_detail (const QString& fname, const DecodeHints& hints);
+    void pin (const QStringList& fnames);
+    void prefetch (const QStringList& list, int index, int direction);
+
+    static QString key_for (const QString& fname);
+    static QString path_for (const QString& key);
+
+signals:
+    /**
+     * Emitted from a worker thread for every finished decode, requested or
+     * prefetched.  @a image is null if the file could not be decoded.
+     */
+    void image_ready (const QString& key, ImagePtr image);
+
+    /**
+     * Emitted from a worker thread when a streaming decoder has allocated
+     * @a image but is still filling it in; see Image::rows_ready().
+     */
+    void image_started (const QString& key, ImagePtr image);
+
+private:
+    bool satisfied (const QString& key, const DecodeHints& hints);
+    void schedule (const QString& key, int priority);
+    void schedule (const QString& key, int priority,
+                   const DecodeHints& hints);
+    void cancel_unwanted ();
+    void run_job (const QString& key, const CancelToken& cancel,
+                  const DecodeHints& hints);
+    ImagePtr decode (const QString& key, DecodeContext& context);
+};
+
+// vim: sw=4 fdm=marker
@@ -0,0 +1,167 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ImageStats.cpp
+ * @brief ImageStats implementation
+ */
+
+/* includes {{{*/
+#include "ImageStats.h"
+
+#include <math.h>
+
+#include "shaders.h"
+/*}}}*/
+
+const int ImageStats::size;
+const int ImageStats::bins;
+
+/// histogram range in stops
+static const float min_ev = -16.0f;
+static const float max_ev = 16.0f;
+
+ImageStats::ImageStats () :/*{{{*/
+    fbo(0),
+    histogram_tex(0),
+    quad_vao(0),
+    points_vao(0)
+{
+    targets[0] = targets[1] = 0;
+}/*}}}*/
+ImageStats::~ImageStats ()/*{{{*/
+{
+}/*}}}*/
+
+void ImageStats::initialize (GLuint quad_vao, const QString& cache_dir)/*{{{*/
+{
+    this->quad_vao = quad_vao;
+
+    luminance_program.set_cache_dir(cache_dir);
+    luminance_program.build(fullscreen_vertex_source,
+                            luminance_fragment_source);
+    reduce_program.set_cache_dir(cache_dir);
+    reduce_program.build(fullscreen_vertex_source, reduce_fragment_source);
+    histogram_program.set_cache_dir(cache_dir);
+    histogram_program.build(histogram_vertex_source,
+                            histogram_fragment_source);
+
+    glGenTextures(2, targets);
+    for (int i = 0; i < 2; i++) {
+        glBindTexture(GL_TEXTURE_2D, targets[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, size, size, 0,
+                     GL_RGBA, GL_FLOAT, NULL);
+    }
+    glGenTextures(1, &histogram_tex);
+    glBindTexture(GL_TEXTURE_2D, histogram_tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, bins, 1, 0, GL_RED, GL_FLOAT, NULL);
+
+    glGenFramebuffers(1, &fbo);
+    glGenVertexArrays(1, &points_vao);
+}/*}}}*/
+void ImageStats::release ()/*{{{*/
+{
+    luminance_program.release();
+    reduce_program.release();
+    histogram_program.release();
+    glDeleteTextures(2, targets);
+    glDeleteTextures(1, &histogram_tex);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteVertexArrays(1, &points_vao);
+    targets[0] = targets[1] = histogram_tex = fbo = points_vao = 0;
+}/*}}}*/
+
+/**
+ * Statistics of mip mapped texture @a tex, sampled on the size x size grid.
+ */
+ImageStats::Result ImageStats::compute (GLuint tex)/*{{{*/
+{
+    Result result;
+    if (fbo == 0) {
+        return result;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glActiveTexture(GL_TEXTURE0);
+    glBindVertexArray(quad_vao);
+
+    /* log luminance {{{*/
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, targets[0], 0);
+    glViewport(0, 0, size, size);
+    glUseProgram(luminance_program.id());
+    glUniform1i(luminance_program.uniform("scene_tex"), 0);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    /*}}}*/
+
+    /* histogram {{{*/
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, histogram_tex, 0);
+    glViewport(0, 0, bins, 1);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    glUseProgram(histogram_program.id());
+    glUniform1i(histogram_program.uniform("luminance"), 0);
+    glUniform1i(histogram_program.uniform("size"), size);
+    glUniform1i(histogram_program.uniform("bins"), bins);
+    glUniform2f(histogram_program.uniform("range"), min_ev, max_ev);
+    glBindTexture(GL_TEXTURE_2D, targets[0]);
+    glBindVertexArray(points_vao);
+    glDrawArrays(GL_POINTS, 0, size * size);
+    glDisable(GL_BLEND);
+    glBindVertexArray(quad_vao);
+
+    result.histogram.resize(bins);
+    glReadPixels(0, 0, bins, 1, GL_RED, GL_FLOAT, result.histogram.data());
+    for (int i = 0; i < bins; i++) {
+        result.histogram[i] /= (float)(size * size);
+    }
+    /*}}}*/
+
+    /* mean, min and max {{{*/
+    glUseProgram(reduce_program.id());
+    glUniform1i(reduce_program.uniform("source"), 0);
+    int src = 0;
+    for (int s = size / 2; s >= 1; s /= 2, src ^= 1) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, targets[src ^ 1], 0);
+        glViewport(0, 0, s, s);
+        glBindTexture(GL_TEXTURE_2D, targets[src]);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    }
+    float texel[4];
+    glReadPixels(0, 0, 1, 1, GL_RGBA, GL_FLOAT, texel);
+    /*}}}*/
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    result.valid = true;
+    result.average_log = texel[0];
+    result.min = texel[1];
+    result.max = texel[2];
+    result.min_ev = min_ev;
+    result.max_ev = max_ev;
+    return result;
+}/*}}}*/
+
+// vim: sw=4 fdm=marker
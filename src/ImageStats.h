@@ -0,0 +1,80 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ImageStats.h
+ * @brief ImageStats definition
+ */
+
+#pragma once
+
+#include "ShaderProgram.h"
+
+#include <QVector>
+
+/**
+ * Luminance statistics of a texture, reduced on the GPU.
+ *
+ * The texture is drawn into a size x size grid of log2 luminance, which is
+ * halved pass by pass, ping-ponging between two render targets, down to
+ * one texel holding the mean log luminance and the minimum and maximum
+ * luminance.  The histogram scatters one point per grid texel into its bin
+ * with additive blending.  Only the results, a few hundred bytes, are read
+ * back.
+ *
+ * All methods must be called with the GL context current.  compute()
+ * leaves framebuffer 0 bound but changes the viewport.
+ */
+class ImageStats
+{
+public:
+    static const int size = 256;
+    static const int bins = 128;
+
+    struct Result {
+        bool valid;
+        float average_log;   ///< mean log2 luminance
+        float min;
+        float max;
+        float min_ev;        ///< log2 luminance of the first bin's lower edge
+        float max_ev;        ///< and of the last bin's upper edge
+        QVector<float> histogram;  ///< fraction of the image in each bin
+
+        Result () : valid(false), average_log(0.0f), min(0.0f), max(0.0f),
+                    min_ev(0.0f), max_ev(0.0f) {}
+    };
+
+private:
+    ShaderProgram luminance_program;
+    ShaderProgram reduce_program;
+    ShaderProgram histogram_program;
+    GLuint fbo;
+    GLuint targets[2];       ///< RGBA32F, size x size
+    GLuint histogram_tex;    ///< R32F, bins x 1
+    GLuint quad_vao;
+    GLuint points_vao;       ///< no attributes; points come from gl_VertexID
+
+public:
+    ImageStats ();
+    virtual ~ImageStats ();
+
+    void initialize (GLuint quad_vao, const QString& cache_dir);
+    void release ();
+
+    Result compute (GLuint tex);
+};
+
+// vim: sw=4 fdm=marker
@@ -0,0 +1,138 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file InputFile.cpp
+ * @brief InputFile implementation
+ */
+
+/* includes {{{*/
+#include "InputFile.h"
+#include "BufferArena.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <QFile>
+/*}}}*/
+
+InputFile::InputFile (const QString& fname) :/*{{{*/
+    fname(fname),
+    fd(-1),
+    length(0),
+    contents(NULL)
+{
+    fd = open(QFile::encodeName(fname).constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw "cannot open file";
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || ! S_ISREG(st.st_mode)) {
+        close(fd);
+        throw "not a regular file";
+    }
+    length = st.st_size;
+}/*}}}*/
+InputFile::~InputFile ()/*{{{*/
+{
+    if (contents != NULL) {
+        BufferArena::release(contents, length);
+    }
+    close(fd);
+}/*}}}*/
+
+/**
+ * The first @a count bytes, or all of them in a shorter file.
+ */
+QByteArray InputFile::header (size_t count) const/*{{{*/
+{
+    QByteArray bytes ((int)qMin(count, length), 0);
+    read(0, bytes.data(), bytes.size());
+    return bytes;
+}/*}}}*/
+/**
+ * @a count bytes from @a offset into @a dst.  Throws if the file ends
+ * before them, as it does when it was truncated after opening.
+ */
+void InputFile::read (size_t offset, char* dst, size_t count) const/*{{{*/
+{
+    if (contents != NULL && offset + count <= length) {
+        memcpy(dst, contents + offset, count);
+        return;
+    }
+    while (count > 0) {
+        ssize_t n = pread(fd, dst, count, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throw "file truncated while reading";
+        }
+        dst += n;
+        offset += n;
+        count -= n;
+    }
+}/*}}}*/
+/**
+ * Starts reading @a count bytes from @a offset into the page cache, and
+ * returns without waiting for them.
+ */
+void InputFile::will_read (size_t offset, size_t count) const/*{{{*/
+{
+    posix_fadvise(fd, offset, count, POSIX_FADV_WILLNEED);
+}/*}}}*/
+/**
+ * The whole file, read on first use; it stays until the InputFile goes.
+ */
+const char* InputFile::data () const/*{{{*/
+{
+    if (contents != NULL || length == 0) {
+        return contents;
+    }
+    // readahead on the descriptor reaches NFS, where it counts the most
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    char* buffer = (char*)BufferArena::allocate(length);
+    if (buffer == NULL) {
+        throw "out of memory";
+    }
+    try {
+        read(0, buffer, length);
+    } catch (const char*) {
+        BufferArena::release(buffer, length);
+        throw;
+    }
+    contents = buffer;
+    return contents;
+}/*}}}*/
+
+/**
+ * Asks the kernel to start reading @a fname into the page cache, and
+ * returns without waiting for it.
+ */
+void InputFile::readahead (const QString& fname)/*{{{*/
+{
+    int fd = open(QFile::encodeName(fname).constData(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+}/*}}}*/
+
+// vim: sw=4 fdm=marker
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file InputFile.h
+ * @brief InputFile definition
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#include <QByteArray>
+#include <QString>
+
+/**
+ * An input file, read with pread() only where a decoder asks.
+ *
+ * Files are not mapped: a renderer may truncate or rewrite a frame in a
+ * watched directory while it is being decoded, and touching a mapping past
+ * the new end of the file raises SIGBUS.  A read that comes up short
+ * throws instead, like a corrupt file.
+ *
+ * Decoders that seek, such as tiled or cropped OpenEXR reads, take just
+ * the ranges they need through read().  Those that need all of it call
+ * data(), which reads the whole file once into a BufferArena buffer, with
+ * the kernel told to stream it in large requests, which matters on
+ * network mounts.  will_read() passes on the ranges a decoder knows it is
+ * going to read, and readahead() does the same for files that are only
+ * going to be opened soon.
+ *
+ * Opening throws a const char* like the decoders do.
+ */
+class InputFile
+{
+private:
+    QString fname;
+    int fd;
+    size_t length;
+    mutable char* contents;  ///< all of it, once data() has been asked for
+
+public:
+    InputFile (const QString& fname);
+    ~InputFile ();
+
+    const QString& name () const { return fname; }
+    size_t size () const { return length; }
+
+    QByteArray header (size_t count) const;
+    void read (size_t offset, char* dst, size_t count) const;
+    void will_read (size_t offset, size_t count) const;
+    const char* data () const;
+
+    static void readahead (const QString& fname);
+
+private:
+    InputFile (const InputFile&);
+    InputFile& operator= (const InputFile&);
+};
+
+// vim: sw=4 fdm=marker
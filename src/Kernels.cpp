@@ -0,0 +1,408 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file Kernels.cpp
+ * @brief Kernels implementation
+ */
+
+/* includes {{{*/
+#include "Kernels.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELS_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#else
+#define KERNELS_X86 0
+#endif
+/*}}}*/
+
+#if KERNELS_X86
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2,f16c,ssse3")))
+#endif
+
+static int current_level = -1;
+
+/* scalar {{{*/
+static inline float half_to_float_1 (uint16_t h)/*{{{*/
+{
+    union { uint32_t u; float f; } o, magic;
+    const uint32_t shifted_exp = 0x7c00 << 13;
+
+    magic.u = 113 << 23;
+    o.u = (h & 0x7fff) << 13;
+    uint32_t exp = shifted_exp & o.u;
+    o.u += (127 - 15) << 23;
+    if (exp == shifted_exp) {
+        o.u += (128 - 16) << 23;  // inf, nan
+    } else if (exp == 0) {
+        o.u += 1 << 23;           // zero, denormal
+        o.f -= magic.f;
+    }
+    o.u |= (uint32_t)(h & 0x8000) << 16;
+    return o.f;
+}/*}}}*/
+
+static void swap16_scalar (uint16_t* data, size_t count)/*{{{*/
+{
+    for (size_t i = 0; i < count; i++) {
+        data[i] = (uint16_t)((data[i] << 8) | (data[i] >> 8));
+    }
+}/*}}}*/
+static void rgb16_to_rgba16_scalar (const uint16_t* src, uint16_t* dst, size_t pixels, bool swap)/*{{{*/
+{
+    for (size_t i = 0; i < pixels; i++) {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+        dst[3] = 0xffff;
+        if (swap) {
+            swap16_scalar(dst, 3);
+        }
+        src += 3;
+        dst += 4;
+    }
+}/*}}}*/
+static void half_to_float_scalar (const uint16_t* src, float* dst, size_t count)/*{{{*/
+{
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = half_to_float_1(src[i]);
+    }
+}/*}}}*/
+/**
+ * Clamps the way maxps and minps do, NaN to zero, so the vector versions
+ * match bit for bit; lrintf rounds to even like cvtps2dq.
+ */
+static inline uint8_t to_u8 (float v)/*{{{*/
+{
+    v = v > 0.0f ? v : 0.0f;
+    v = v < 1.0f ? v : 1.0f;
+    return (uint8_t)lrintf(v * 255.0f);
+}/*}}}*/
+static void scale_to_bgra8_scalar (const float* src, uint8_t* dst, size_t pixels, float gain)/*{{{*/
+{
+    for (size_t i = 0; i < pixels; i++) {
+        dst[0] = to_u8(src[2] * gain);
+        dst[1] = to_u8(src[1] * gain);
+        dst[2] = to_u8(src[0] * gain);
+        dst[3] = 0xff;
+        src += 4;
+        dst += 4;
+    }
+}/*}}}*/
+/*}}}*/
+
+#if KERNELS_X86
+/* sse2 {{{*/
+TARGET_SSE2
+static void swap16_sse2 (uint16_t* data, size_t count)/*{{{*/
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128((__m128i*)(data + i), v);
+    }
+    swap16_scalar(data + i, count - i);
+}/*}}}*/
+/**
+ * Four halves, zero extended to 32 bits, to floats.  Handles denormals,
+ * infinities and NaNs without branches.
+ */
+TARGET_SSE2
+static inline __m128 half4_to_float_sse2 (__m128i h)/*{{{*/
+{
+    const __m128i mask_nosign = _mm_set1_epi32(0x7fff);
+    const __m128 magic = _mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23));
+    const __m128i was_infnan = _mm_set1_epi32(0x7bff);
+    const __m128 exp_infnan = _mm_castsi128_ps(_mm_set1_epi32(255 << 23));
+
+    __m128i expmant = _mm_and_si128(mask_nosign, h);
+    __m128i justsign = _mm_xor_si128(h, expmant);
+    __m128i shifted = _mm_slli_epi32(expmant, 13);
+    __m128 scaled = _mm_mul_ps(_mm_castsi128_ps(shifted), magic);
+    __m128i wasinfnan = _mm_cmpgt_epi32(expmant, was_infnan);
+    __m128i sign = _mm_slli_epi32(justsign, 16);
+    __m128 infnanexp = _mm_and_ps(_mm_castsi128_ps(wasinfnan), exp_infnan);
+    __m128 sign_inf = _mm_or_ps(_mm_castsi128_ps(sign), infnanexp);
+    return _mm_or_ps(scaled, sign_inf);
+}/*}}}*/
+TARGET_SSE2
+static void half_to_float_sse2 (const uint16_t* src, float* dst, size_t count)/*{{{*/
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i h = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_ps(dst + i,
+                      half4_to_float_sse2(_mm_unpacklo_epi16(h, zero)));
+        _mm_storeu_ps(dst + i + 4,
+                      half4_to_float_sse2(_mm_unpackhi_epi16(h, zero)));
+    }
+    half_to_float_scalar(src + i, dst + i, count - i);
+}/*}}}*/
+/**
+ * One pixel per register: alpha masked off and set to one, gain on RGB,
+ * swizzled to BGRA, then four pixels packed down to bytes together.
+ */
+TARGET_SSE2
+static void scale_to_bgra8_sse2 (const float* src, uint8_t* dst, size_t pixels, float gain)/*{{{*/
+{
+    const __m128 rgb = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+    const __m128 scale = _mm_setr_ps(gain, gain, gain, 1.0f);
+    const __m128 opaque = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 full = _mm_set1_ps(255.0f);
+
+    size_t i = 0;
+    for (; i + 4 <= pixels; i += 4) {
+        __m128i p[4];
+        for (int k = 0; k < 4; k++) {
+            __m128 v = _mm_loadu_ps(src + (i + k) * 4);
+            v = _mm_or_ps(_mm_and_ps(v, rgb), opaque);
+            v = _mm_mul_ps(v, scale);
+            v = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 1, 2));
+            v = _mm_min_ps(_mm_max_ps(v, zero), one);
+            p[k] = _mm_cvtps_epi32(_mm_mul_ps(v, full));
+        }
+        __m128i lo = _mm_packs_epi32(p[0], p[1]);
+        __m128i hi = _mm_packs_epi32(p[2], p[3]);
+        _mm_storeu_si128((__m128i*)(dst + i * 4), _mm_packus_epi16(lo, hi));
+    }
+    scale_to_bgra8_scalar(src + i * 4, dst + i * 4, pixels - i, gain);
+}/*}}}*/
+/*}}}*/
+
+/* avx2 {{{*/
+TARGET_AVX2
+static void swap16_avx2 (uint16_t* data, size_t count)/*{{{*/
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+        v = _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8));
+        _mm256_storeu_si256((__m256i*)(data + i), v);
+    }
+    swap16_scalar(data + i, count - i);
+}/*}}}*/
+/**
+ * Eight pixels per iteration: three 16 byte loads cover 48 bytes of RGB,
+ * realigned so each pshufb sees two whole pixels, and the same shuffle
+ * spreads them to RGBA (swapping bytes too if asked).
+ */
+TARGET_AVX2
+static void rgb16_to_rgba16_avx2 (const uint16_t* src, uint16_t* dst, size_t pixels, bool swap)/*{{{*/
+{
+    const char z = (char)0x80;
+    const __m128i spread = swap ?
+        _mm_setr_epi8(1, 0, 3, 2, 5, 4, z, z, 7, 6, 9, 8, 11, 10, z, z) :
+        _mm_setr_epi8(0, 1, 2, 3, 4, 5, z, z, 6, 7, 8, 9, 10, 11, z, z);
+    const __m128i alpha = _mm_setr_epi16(0, 0, 0, -1, 0, 0, 0, -1);
+
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8) {
+        const __m128i* in = (const __m128i*)(src + i * 3);
+        __m128i* out = (__m128i*)(dst + i * 4);
+        __m128i a = _mm_loadu_si128(in);
+        __m128i b = _mm_loadu_si128(in + 1);
+        __m128i c = _mm_loadu_si128(in + 2);
+
+        __m128i p01 = a;
+        __m128i p23 = _mm_alignr_epi8(b, a, 12);
+        __m128i p45 = _mm_alignr_epi8(c, b, 8);
+        __m128i p67 = _mm_srli_si128(c, 4);
+
+        _mm_storeu_si128(out,
+                         _mm_or_si128(_mm_shuffle_epi8(p01, spread), alpha));
+        _mm_storeu_si128(out + 1,
+                         _mm_or_si128(_mm_shuffle_epi8(p23, spread), alpha));
+        _mm_storeu_si128(out + 2,
+                         _mm_or_si128(_mm_shuffle_epi8(p45, spread), alpha));
+        _mm_storeu_si128(out + 3,
+                         _mm_or_si128(_mm_shuffle_epi8(p67, spread), alpha));
+    }
+    rgb16_to_rgba16_scalar(src + i * 3, dst + i * 4, pixels - i, swap);
+}/*}}}*/
+TARGET_AVX2
+static void half_to_float_avx2 (const uint16_t* src, float* dst, size_t count)/*{{{*/
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i h0 = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i h1 = _mm_loadu_si128((const __m128i*)(src + i + 8));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h0));
+        _mm256_storeu_ps(dst + i + 8, _mm256_cvtph_ps(h1));
+    }
+    half_to_float_scalar(src + i, dst + i, count - i);
+}/*}}}*/
+/**
+ * Two pixels per register, eight per iteration.  The packs work within
+ * 128-bit lanes, which leaves the pixels in the order 0 2 4 6 1 3 5 7;
+ * one permute puts them back.
+ */
+TARGET_AVX2
+static void scale_to_bgra8_avx2 (const float* src, uint8_t* dst, size_t pixels, float gain)/*{{{*/
+{
+    const __m256 rgb = _mm256_castsi256_ps(
+        _mm256_setr_epi32(-1, -1, -1, 0, -1, -1, -1, 0));
+    const __m256 scale = _mm256_setr_ps(gain, gain, gain, 1.0f,
+                                        gain, gain, gain, 1.0f);
+    const __m256 opaque = _mm256_setr_ps(0.0f, 0.0f, 0.0f, 1.0f,
+                                         0.0f, 0.0f, 0.0f, 1.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 full = _mm256_set1_ps(255.0f);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8) {
+        __m256i p[4];
+        for (int k = 0; k < 4; k++) {
+            __m256 v = _mm256_loadu_ps(src + (i + k * 2) * 4);
+            v = _mm256_or_ps(_mm256_and_ps(v, rgb), opaque);
+            v = _mm256_mul_ps(v, scale);
+            v = _mm256_permute_ps(v, _MM_SHUFFLE(3, 0, 1, 2));
+            v = _mm256_min_ps(_mm256_max_ps(v, zero), one);
+            p[k] = _mm256_cvtps_epi32(_mm256_mul_ps(v, full));
+        }
+        __m256i lo = _mm256_packs_epi32(p[0], p[1]);
+        __m256i hi = _mm256_packs_epi32(p[2], p[3]);
+        __m256i bytes = _mm256_packus_epi16(lo, hi);
+        _mm256_storeu_si256((__m256i*)(dst + i * 4),
+                            _mm256_permutevar8x32_epi32(bytes, order));
+    }
+    scale_to_bgra8_scalar(src + i * 4, dst + i * 4, pixels - i, gain);
+}/*}}}*/
+/*}}}*/
+#endif
+
+Kernels::Level Kernels::supported ()/*{{{*/
+{
+#if KERNELS_X86
+    unsigned int eax, ebx, ecx, edx;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("ssse3")
+        && __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_F16C)) {
+        return AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return SSE2;
+    }
+#endif
+    return SCALAR;
+}/*}}}*/
+Kernels::Level Kernels::level ()/*{{{*/
+{
+    if (current_level < 0) {
+        // racing first calls all arrive at the same answer
+        Level best = supported();
+        const char* env = getenv("GAZER_KERNELS");
+        if (env != NULL) {
+            for (int l = SCALAR; l <= AVX2; l++) {
+                if (strcmp(env, level_name((Level)l)) == 0 && l < best) {
+                    best = (Level)l;
+                }
+            }
+        }
+        current_level = best;
+    }
+    return (Level)current_level;
+}/*}}}*/
+void Kernels::set_level (Level level)/*{{{*/
+{
+    Level best = supported();
+    current_level = level < best ? level : best;
+}/*}}}*/
+const char* Kernels::level_name (Level level)/*{{{*/
+{
+    switch (level) {
+    case SSE2:
+        return "sse2";
+    case AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}/*}}}*/
+
+void Kernels::swap16 (uint16_t* data, size_t count)/*{{{*/
+{
+    switch (level()) {
+#if KERNELS_X86
+    case AVX2:
+        swap16_avx2(data, count);
+        break;
+    case SSE2:
+        swap16_sse2(data, count);
+        break;
+#endif
+    default:
+        swap16_scalar(data, count);
+    }
+}/*}}}*/
+void Kernels::rgb16_to_rgba16 (const uint16_t* src, uint16_t* dst, size_t pixels, bool swap)/*{{{*/
+{
+    switch (level()) {
+#if KERNELS_X86
+    case AVX2:
+        rgb16_to_rgba16_avx2(src, dst, pixels, swap);
+        break;
+#endif
+    default:
+        // plain SSE2 has no byte shuffle; the compiler does as well here
+        rgb16_to_rgba16_scalar(src, dst, pixels, swap);
+    }
+}/*}}}*/
+void Kernels::half_to_float (const uint16_t* src, float* dst, size_t count)/*{{{*/
+{
+    switch (level()) {
+#if KERNELS_X86
+    case AVX2:
+        half_to_float_avx2(src, dst, count);
+        break;
+    case SSE2:
+        half_to_float_sse2(src, dst, count);
+        break;
+#endif
+    default:
+        half_to_float_scalar(src, dst, count);
+    }
+}/*}}}*/
+
+void Kernels::scale_to_bgra8 (const float* src, uint8_t* dst, size_t pixels, float gain)/*{{{*/
+{
+    switch (level()) {
+#if KERNELS_X86
+    case AVX2:
+        scale_to_bgra8_avx2(src, dst, pixels, gain);
+        break;
+    case SSE2:
+        scale_to_bgra8_sse2(src, dst, pixels, gain);
+        break;
+#endif
+    default:
+        scale_to_bgra8_scalar(src, dst, pixels, gain);
+    }
+}/*}}}*/
+
+// vim: sw=4 fdm=marker
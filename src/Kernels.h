@@ -0,0 +1,70 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file Kernels.h
+ * @brief Kernels definition
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Pixel conversion loops with SSE2 and AVX2 versions.
+ *
+ * The best level the CPU supports is picked on first use; set_level() can
+ * only lower it, which is what the benchmark uses to compare them.  The
+ * kernels work on runs of pixels, so callers flip images by choosing the
+ * destination row rather than through a separate pass.
+ */
+class Kernels
+{
+public:
+    enum Level {
+        SCALAR,
+        SSE2,
+        AVX2    ///< also requires F16C and SSSE3
+    };
+
+public:
+    static Level level ();
+    static Level supported ();
+    static void set_level (Level level);
+    static const char* level_name (Level level);
+
+    /// big-endian 16-bit samples to host order, in place
+    static void swap16 (uint16_t* data, size_t count);
+
+    /// RGB to RGBA with opaque alpha, optionally byte swapping on the way
+    static void rgb16_to_rgba16 (const uint16_t* src, uint16_t* dst,
+                                 size_t pixels, bool swap);
+
+    /// IEEE half to float; @a count is in samples, not pixels
+    static void half_to_float (const uint16_t* src, float* dst,
+                               size_t count);
+
+    /**
+     * RGBA floats times @a gain, clamped to [0,1] and rounded to the
+     * nearest 8-bit value, as BGRA bytes with opaque alpha: the layout of
+     * QImage::Format_RGB32 on little-endian hosts.  Alpha is not scaled.
+     */
+    static void scale_to_bgra8 (const float* src, uint8_t* dst,
+                                size_t pixels, float gain);
+};
+
+// vim: sw=4 fdm=marker
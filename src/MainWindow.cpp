@@ -22,17 +22,28 @@
 /* includes {{{*/
 #include "MainWindow.moc"
 #include "GLSurface.h"
+#include "ImageLoader.h"
+#include "FileListModel.h"
+#include "DirectoryScanner.h"
+#include "Playback.h"
+#include "Scopes.h"
+#include "ScopeView.h"
+#include "BufferArena.h"
+#include "Profiler.h"
 
 #include <assert.h>
 
 #include <QtCore>
 #include <QAction>
+#include <QActionGroup>
 #include <QMenuBar>
 #include <QStatusBar>
 #include <QFileDialog>
 #include <QApplication>
+#include <QDesktopServices>
 #include <QDockWidget>
-#include <QTreeWidget>
+#include <QListView>
+#include <QScrollBar>
 /*}}}*/
 
 MainWindow::MainWindow() :/*{{{*/
@@ -40,34 +51,172 @@ MainWindow::MainWindow() :/*{{{*/
     settings("MentalDistortion", "Gazer"),
     open_action(NULL),
     quit_action(NULL),
+    trace_action(NULL),
+    play_action(NULL),
+    drop_frames_action(NULL),
+    fps_group(NULL),
+    layout_group(NULL),
+    rotate_action(NULL),
     menu_bar(NULL),
     surface(NULL),
-    file_index(-1)
+    loader(NULL),
+    playback(NULL),
+    list_view(NULL),
+    file_model(NULL),
+    scanner(NULL),
+    scopes(NULL),
+    waveform_view(NULL),
+    vectorscope_view(NULL),
+    waveform_dock(NULL),
+    vectorscope_dock(NULL),
+    file_index(-1),
+    scroll_direction(1),
+    navigated_us(-1)
 {
     settings.beginGroup("MainWindow");
     resize(settings.value("size", QSize(400, 400)).toSize());
     move(settings.value("pos", QPoint(200, 200)).toPoint());
     settings.endGroup();
 
+    settings.beginGroup("Cache");
+    qint64 budget_mb = settings.value("budget_mb", 1024).toLongLong();
+    loader = new ImageLoader(budget_mb * 1024 * 1024, this);
+    loader->set_prefetch(settings.value("prefetch_ahead", 4).toInt(),
+                         settings.value("prefetch_behind", 1).toInt());
+    loader->set_readahead(settings.value("readahead", 8).toInt());
+    BufferArena::set_limit(
+        settings.value("arena_mb", 512).toLongLong() * 1024 * 1024);
+    loader->set_thread_count(
+        settings.value("threads", QThread::idealThreadCount()).toInt());
+    DiskCache& previews = loader->preview_cache();
+    previews.set_dir(settings.value("preview_dir", QDir(
+        QDesktopServices::storageLocation(QDesktopServices::CacheLocation))
+        .filePath("previews")).toString());
+    previews.set_preview_size(settings.value("preview_size", 2048).toInt());
+    previews.set_budget(
+        settings.value("preview_budget_mb", 2048).toLongLong() * 1024 * 1024);
+    settings.endGroup();
+
+    settings.beginGroup("Decode");
+    Decoder::set_exr_threads(
+        settings.value("exr_threads", QThread::idealThreadCount()).toInt());
+    settings.endGroup();
+
     create_actions();
     create_menus();
 
     surface = new GLSurface();
     setCentralWidget(surface);
+    connect(rotate_action, SIGNAL(triggered()),
+            surface, SLOT(rotate_views()));
+    detail_timer.setSingleShot(true);
+    detail_timer.setInterval(150);
+
+    playback = new Playback(loader, surface, this);
+    settings.beginGroup("Playback");
+    float fps = settings.value("fps", 24).toFloat();
+    bool drop_frames = settings.value("drop_frames", true).toBool();
+    playback->set_ring_size(settings.value("ring_size", 16).toInt());
+    settings.endGroup();
+    playback->set_fps(fps);
+    playback->set_policy(drop_frames ? Playback::DROP : Playback::HOLD);
+    drop_frames_action->setChecked(drop_frames);
+    foreach (QAction* action, fps_group->actions()) {
+        action->setChecked(action->data().toFloat() == fps);
+    }
+
+    file_model = new FileListModel(&loader->preview_cache(), this);
+    scanner = new DirectoryScanner(this);
+    list_view = new QListView();
+    list_view->setModel(file_model);
+    list_view->setUniformItemSizes(true);
+    // the current file, and any others selected to compare against it
+    list_view->setSelectionMode(QAbstractItemView::ExtendedSelection);
+
+    settings.beginGroup("Display");
+    surface->set_tile_budget(
+        settings.value("tile_budget_mb", 256).toLongLong() * 1024 * 1024);
+    surface->set_texture_budget(
+        settings.value("texture_budget_mb", 512).toLongLong() * 1024 * 1024);
+    surface->set_bc6h(settings.value("bc6h", false).toBool());
+    int thumbnail_size = settings.value("thumbnail_size", 64).toInt();
+    file_model->set_thumbnail_size(thumbnail_size);
+    list_view->setIconSize(QSize(thumbnail_size, thumbnail_size));
+    if (settings.value("thumbnail_grid", false).toBool()) {
+        list_view->setViewMode(QListView::IconMode);
+        list_view->setResizeMode(QListView::Adjust);
+        list_view->setMovement(QListView::Static);
+    }
+    settings.endGroup();
 
     statusBar()->showMessage("Ready");
 
     QDockWidget* list_dock = new QDockWidget(this);
     addDockWidget(Qt::LeftDockWidgetArea, list_dock);
-    tree_widget = new QTreeWidget();
-    list_dock->setWidget(tree_widget);
-    tree_widget->setHeaderLabels(QStringList("File"));
+    list_dock->setWidget(list_view);
+
+    // hidden until asked for; nothing is worked out for them until then
+    scopes = new Scopes(this);
+    waveform_view = new ScopeView(ScopeView::WAVEFORM);
+    waveform_dock = new QDockWidget("Waveform", this);
+    waveform_dock->setObjectName("waveform");
+    waveform_dock->setWidget(waveform_view);
+    addDockWidget(Qt::RightDockWidgetArea, waveform_dock);
+    waveform_dock->hide();
+    vectorscope_view = new ScopeView(ScopeView::VECTORSCOPE);
+    vectorscope_dock = new QDockWidget("Vectorscope", this);
+    vectorscope_dock->setObjectName("vectorscope");
+    vectorscope_dock->setWidget(vectorscope_view);
+    addDockWidget(Qt::RightDockWidgetArea, vectorscope_dock);
+    vectorscope_dock->hide();
+    view_menu->addAction(waveform_dock->toggleViewAction());
+    view_menu->addAction(vectorscope_dock->toggleViewAction());
 
     connect(qApp, SIGNAL(aboutToQuit()), this, SLOT(about_to_quit()));
     connect(
-        tree_widget,
-        SIGNAL(currentItemChanged(QTreeWidgetItem*,QTreeWidgetItem*)),
-        this, SLOT(current_item_changed(QTreeWidgetItem*,QTreeWidgetItem*)));
+        list_view->selectionModel(),
+        SIGNAL(currentChanged(QModelIndex,QModelIndex)),
+        this, SLOT(current_changed(QModelIndex,QModelIndex)));
+    connect(
+        list_view->selectionModel(),
+        SIGNAL(selectionChanged(QItemSelection,QItemSelection)),
+        this, SLOT(update_compare()));
+    connect(
+        list_view->verticalScrollBar(), SIGNAL(valueChanged(int)),
+        this, SLOT(update_visible()));
+    connect(
+        list_view->horizontalScrollBar(), SIGNAL(valueChanged(int)),
+        this, SLOT(update_visible()));
+    connect(
+        surface, SIGNAL(view_changed()),
+        &detail_timer, SLOT(start()));
+    connect(
+        &detail_timer, SIGNAL(timeout()),
+        this, SLOT(fetch_detail()));
+    connect(
+        scanner, SIGNAL(files_found(QStringList)),
+        this, SLOT(files_found(QStringList)));
+    connect(
+        scanner, SIGNAL(finished()),
+        this, SLOT(scan_finished()));
+    connect(
+        loader, SIGNAL(image_started(QString,ImagePtr)),
+        this, SLOT(image_ready(QString,ImagePtr)));
+    connect(
+        loader, SIGNAL(image_ready(QString,ImagePtr)),
+        this, SLOT(image_ready(QString,ImagePtr)));
+    connect(
+        playback, SIGNAL(stats(float,int)),
+        this, SLOT(playback_stats(float,int)));
+    connect(
+        waveform_dock, SIGNAL(visibilityChanged(bool)),
+        this, SLOT(scopes_toggled()));
+    connect(
+        vectorscope_dock, SIGNAL(visibilityChanged(bool)),
+        this, SLOT(scopes_toggled()));
+    connect(
+        scopes, SIGNAL(updated()),
+        this, SLOT(scopes_updated()));
 }/*}}}*/
 MainWindow::~MainWindow()/*{{{*/
 {
@@ -80,10 +229,56 @@ void MainWindow::create_actions(void)/*{{{*/
     open_action->setStatusTip("Open file");
     connect(open_action, SIGNAL(triggered()), this, SLOT(open()));
 
+    trace_action = new QAction("Export &Trace...", this);
+    trace_action->setStatusTip(
+        "Save what the profiler recorded as Chrome trace JSON");
+    connect(trace_action, SIGNAL(triggered()), this, SLOT(export_trace()));
+
     quit_action = new QAction("&Quit", this);
     quit_action->setShortcut(tr("Ctrl+Q"));
     quit_action->setStatusTip("Quit application");
     connect(quit_action, SIGNAL(triggered()), this, SLOT(quit()));
+
+    play_action = new QAction("&Play", this);
+    play_action->setShortcut(tr("Space"));
+    play_action->setStatusTip("Play the file list as a sequence");
+    play_action->setCheckable(true);
+    connect(play_action, SIGNAL(toggled(bool)), this, SLOT(play(bool)));
+
+    fps_group = new QActionGroup(this);
+    const int rates[] = { 24, 30, 60 };
+    for (int i = 0; i < 3; i++) {
+        QAction* action = fps_group->addAction(QString("%1 fps").arg(rates[i]));
+        action->setData(rates[i]);
+        action->setCheckable(true);
+    }
+    connect(fps_group, SIGNAL(triggered(QAction*)),
+            this, SLOT(set_fps(QAction*)));
+
+    drop_frames_action = new QAction("&Drop Late Frames", this);
+    drop_frames_action->setStatusTip(
+        "Keep to the clock instead of showing every frame");
+    drop_frames_action->setCheckable(true);
+    connect(drop_frames_action, SIGNAL(toggled(bool)),
+            this, SLOT(set_drop_frames(bool)));
+
+    layout_group = new QActionGroup(this);
+    const char* layouts[] = { "&Single", "Side by Si&de", "&Wipe", "&Four Up" };
+    for (int i = 0; i < 4; i++) {
+        QAction* action = layout_group->addAction(layouts[i]);
+        action->setShortcut(QString("Ctrl+%1").arg(i + 1));
+        action->setData(i);
+        action->setCheckable(true);
+        action->setChecked(i == GLSurface::SINGLE);
+    }
+    layout_group->actions()[GLSurface::SIDE_BY_SIDE]->setStatusTip(
+        "Show the files selected in the list next to the current one");
+    connect(layout_group, SIGNAL(triggered(QAction*)),
+            this, SLOT(set_layout(QAction*)));
+
+    rotate_action = new QAction("S&wap Views", this);
+    rotate_action->setShortcut(tr("X"));
+    rotate_action->setStatusTip("Move every image on to the next view");
 }/*}}}*/
 void MainWindow::create_menus(void)/*{{{*/
 {
@@ -92,8 +287,23 @@ void MainWindow::create_menus(void)/*{{{*/
 
     file_menu = menu_bar->addMenu("&File");
     file_menu->addAction(open_action);
+    file_menu->addAction(trace_action);
     file_menu->addSeparator();
     file_menu->addAction(quit_action);
+
+    playback_menu = menu_bar->addMenu("&Playback");
+    playback_menu->addAction(play_action);
+    playback_menu->addSeparator();
+    playback_menu->addActions(fps_group->actions());
+    playback_menu->addSeparator();
+    playback_menu->addAction(drop_frames_action);
+
+    compare_menu = menu_bar->addMenu("&Compare");
+    compare_menu->addActions(layout_group->actions());
+    compare_menu->addSeparator();
+    compare_menu->addAction(rotate_action);
+
+    view_menu = menu_bar->addMenu("&View");
 }/*}}}*/
 
 void MainWindow::open (void)/*{{{*/
@@ -104,10 +314,7 @@ void MainWindow::open (void)/*{{{*/
     }
 
     QFileInfo info (fname);
-    QDir dir (info.absolutePath());
-    QDir::setCurrent(dir.absolutePath());
-    QStringList list = dir.entryList(QDir::Files, QDir::Name);
-    set_file_list(list, list.indexOf(info.fileName()));
+    scan_directory(info.absolutePath(), info.fileName());
 }/*}}}*/
 void MainWindow::quit (void)/*{{{*/
 {
@@ -124,55 +331,286 @@ void MainWindow::about_to_quit (void)/*{{{*/
     qApp->quit();
 }/*}}}*/
 
-void MainWindow::set_file_list(const QStringList& list, int new_index)/*{{{*/
+void MainWindow::export_trace ()/*{{{*/
 {
-    this->file_list.clear();
-    tree_widget->clear();
-    this->file_list = list;
+    if ( ! Profiler::enabled()) {
+        statusBar()->showMessage("Nothing recorded; P in the image view"
+                                 " turns the profiler on", 5000);
+        return;
+    }
+    QString fname = QFileDialog::getSaveFileName(this, "Export Trace",
+                                                 "gazer-trace.json",
+                                                 "Chrome trace (*.json)");
+    if (fname.isEmpty()) {
+        return;
+    }
+    statusBar()->showMessage(Profiler::export_trace(fname)
+                             ? QString("Trace written to %1").arg(fname)
+                             : QString("Unable to write %1").arg(fname),
+                             5000);
+}/*}}}*/
 
+void MainWindow::set_file_list(const QStringList& list, int new_index)/*{{{*/
+{
     if (list.size() == 1) {
         QFileInfo finfo (list.first());
         if (finfo.isDir()) {
-            QDir dir (list.first());
-            QDir::setCurrent(dir.absolutePath());
-            set_file_list(dir.entryList(QDir::Files, QDir::Name));
+            scan_directory(finfo.absoluteFilePath(), QString());
             return;
         }
     }
 
-    QList<QTreeWidgetItem*> items;
-    foreach (QString f, file_list) {
-        items.append(new QTreeWidgetItem(tree_widget, QStringList(f)));
-    }
-    tree_widget->insertTopLevelItems(0, items);
+    scanner->stop();
+    file_model->set_files(list);
 
     go(new_index);
+    update_visible();
 }/*}}}*/
+/**
+ * Lists @a dir in the background.  The file the user picked, @a select, is
+ * shown straight away; the rest of the directory fills in around it.
+ */
+void MainWindow::scan_directory (const QString& dir, const QString& select)/*{{{*/
+{
+    QDir::setCurrent(dir);
+    QStringList first;
+    if ( ! select.isEmpty()) {
+        first << select;
+    }
+    file_model->set_files(first);
+    file_index = -1;
+    go(0);
+    update_visible();
 
-void MainWindow::current_item_changed (QTreeWidgetItem* item,QTreeWidgetItem* prev)/*{{{*/
+    scanner->scan(dir, select);
+    statusBar()->showMessage(QString("Scanning %1").arg(dir));
+}/*}}}*/
+void MainWindow::files_found (const QStringList& names)/*{{{*/
+{
+    file_model->add_files(names);
+    if (file_index < 0) {
+        go(0);  // nothing picked; the first file there is
+    } else {
+        // rows may have moved; the selection followed its file
+        file_index = list_view->currentIndex().row();
+    }
+    update_visible();
+    if (scanner->scanning()) {
+        statusBar()->showMessage(QString("Scanning %1: %2 files")
+                                 .arg(scanner->directory())
+                                 .arg(file_model->rowCount()));
+    }
+}/*}}}*/
+void MainWindow::scan_finished ()/*{{{*/
 {
-    if (item == NULL) {
+    statusBar()->showMessage(QString("%1 files").arg(file_model->rowCount()),
+                             5000);
+}/*}}}*/
+
+void MainWindow::current_changed (const QModelIndex& current, const QModelIndex& previous)/*{{{*/
+{
+    if ( ! current.isValid()) {
         return;
     }
-    file_index = file_list.indexOf(item->data(0, Qt::DisplayRole).toString());
+    PROFILE_SCOPE("navigate");
+    navigated_us = Profiler::now_us();
+    file_index = current.row();
     assert(file_index >= 0);
+    const QStringList& file_list = file_model->file_list();
     assert(file_index < file_list.size());
-    surface->load_image(file_list[file_index]);
+
+    current_key = ImageLoader::key_for(file_list[file_index]);
+    detail_key.clear();
+    surface->clear_detail();
+    loader->set_hints(surface->view_hints());
+    loader->request(file_list[file_index]);
+    loader->prefetch(file_list, file_index, scroll_direction);
+    update_compare();
+}/*}}}*/
+void MainWindow::image_ready (const QString& key, ImagePtr image)/*{{{*/
+{
+    if (key == detail_key) {
+        if (image) {
+            surface->load_detail(image);
+        }
+        return;
+    }
+    int view = compare_keys.indexOf(key);
+    if (view >= 0) {
+        if (image && image->complete()) {
+            surface->set_compare(view + 1, image);
+        }
+        return;
+    }
+    if (key != current_key) {
+        return;  // prefetched, or the user has already moved on
+    }
+    PROFILE_SCOPE("image ready");
+    if (navigated_us >= 0) {
+        // first pixels of the new file, stand-in or not
+        Profiler::record("navigate to image", navigated_us,
+                         Profiler::now_us());
+        navigated_us = -1;
+    }
+    if (image) {
+        surface->load_image(image);
+        if (waveform_dock->isVisible() || vectorscope_dock->isVisible()) {
+            scopes->analyze(image);
+        }
+    } else {
+        surface->cancel_upload();  // a streaming decode may have died midway
+        statusBar()->showMessage(QString("Unable to load %1").arg(key));
+    }
+}/*}}}*/
+/**
+ * After zooming in or panning, decodes the part of the file on screen at
+ * the resolution it is shown at, if what is there is too coarse or doesn't
+ * cover it.
+ */
+void MainWindow::fetch_detail ()/*{{{*/
+{
+    if (file_index < 0 || playback->playing()) {
+        return;
+    }
+    DecodeHints hints = surface->view_hints();
+    if (surface->satisfies(hints)) {
+        return;
+    }
+    detail_key = loader->request_detail(file_model->file_list()[file_index],
+                                        hints);
+}/*}}}*/
+/**
+ * Fills the views after the first with the files selected in the list
+ * besides the current one, in list order, as many as the layout has room
+ * for.  The loader keeps them decoded; image_ready() shows them.
+ */
+void MainWindow::update_compare ()/*{{{*/
+{
+    const QStringList& file_list = file_model->file_list();
+    QList<int> rows;
+    if (surface->view_layout() != GLSurface::SINGLE) {
+        foreach (const QModelIndex& index,
+                 list_view->selectionModel()->selectedRows()) {
+            if (index.row() != file_index && index.row() < file_list.size()) {
+                rows << index.row();
+            }
+        }
+        qSort(rows);
+    }
+
+    QStringList files;
+    QStringList keys;
+    for (int i = 0; i < rows.size() && i < surface->view_count() - 1; i++) {
+        files << file_list[rows[i]];
+        keys << ImageLoader::key_for(files.last());
+    }
+    if (keys == compare_keys) {
+        return;
+    }
+    for (int view = 1; view < GLSurface::max_views; view++) {
+        if (view > keys.size() || view > compare_keys.size()
+            || keys[view - 1] != compare_keys[view - 1]) {
+            surface->set_compare(view, ImagePtr());
+        }
+    }
+    compare_keys = keys;
+    loader->pin(files);
+}/*}}}*/
+void MainWindow::set_layout (QAction* action)/*{{{*/
+{
+    GLSurface::Layout layout = (GLSurface::Layout)action->data().toInt();
+    surface->set_layout(layout);
+    update_compare();
+    if (layout != GLSurface::SINGLE && compare_keys.isEmpty()) {
+        statusBar()->showMessage("Select files in the list to compare"
+                                 " against the current one", 5000);
+    }
+}/*}}}*/
+/**
+ * Scopes of the image on screen while either panel is up, and of nothing
+ * once both are closed.
+ */
+void MainWindow::scopes_toggled ()/*{{{*/
+{
+    if (waveform_dock->isVisible() || vectorscope_dock->isVisible()) {
+        scopes->analyze(surface->shown_image());
+    } else {
+        scopes->clear();
+    }
+}/*}}}*/
+void MainWindow::scopes_updated ()/*{{{*/
+{
+    waveform_view->set_image(scopes->waveform());
+    vectorscope_view->set_image(scopes->vectorscope());
+}/*}}}*/
+/**
+ * Tells the model which rows are on screen, so thumbnails for rows that
+ * have scrolled past are not made.
+ */
+void MainWindow::update_visible ()/*{{{*/
+{
+    QRect r = list_view->viewport()->rect();
+    QModelIndex first = list_view->indexAt(r.topLeft());
+    QModelIndex last = list_view->indexAt(r.bottomRight());
+    if ( ! last.isValid()) {
+        last = list_view->indexAt(r.bottomLeft());
+    }
+    file_model->set_visible(first.isValid() ? first.row() : 0,
+                            last.isValid() ? last.row()
+                                           : file_model->rowCount() - 1);
+}/*}}}*/
+
+void MainWindow::play (bool on)/*{{{*/
+{
+    if (on) {
+        // frames go straight to the surface, not through image_ready
+        current_key.clear();
+        playback->start(file_model->file_list(), file_index);
+        return;
+    }
+    if (playback->playing()) {
+        playback->stop();
+        go(playback->current());
+        current_changed(file_model->index(file_index), QModelIndex());
+    }
+}/*}}}*/
+void MainWindow::set_fps (QAction* action)/*{{{*/
+{
+    float fps = action->data().toFloat();
+    playback->set_fps(fps);
+    settings.setValue("Playback/fps", fps);
+}/*}}}*/
+void MainWindow::set_drop_frames (bool drop)/*{{{*/
+{
+    playback->set_policy(drop ? Playback::DROP : Playback::HOLD);
+    settings.setValue("Playback/drop_frames", drop);
+}/*}}}*/
+void MainWindow::playback_stats (float achieved_fps, int late)/*{{{*/
+{
+    statusBar()->showMessage(
+        QString("Playing at %1 fps, %2 frames %3")
+        .arg(achieved_fps, 0, 'f', 1).arg(late)
+        .arg(drop_frames_action->isChecked() ? "dropped" : "held"));
 }/*}}}*/
 
 void MainWindow::next (int direction)/*{{{*/
 {
+    const QStringList& file_list = file_model->file_list();
     if (file_list.isEmpty()) {
         file_index = -1;
         return;
     }
+    if (direction != 0) {
+        scroll_direction = direction;
+    }
     file_index += direction;
     file_index = file_index < 0 ?
         file_index + file_list.size() : file_index % file_list.size();
-    tree_widget->setCurrentItem(tree_widget->topLevelItem(file_index));
+    select_row(file_index);
 }/*}}}*/
 void MainWindow::go (int index)/*{{{*/
 {
+    const QStringList& file_list = file_model->file_list();
     if (file_list.isEmpty()) {
         file_index = -1;
         return;
@@ -180,7 +618,19 @@ void MainWindow::go (int index)/*{{{*/
     file_index = index;
     file_index = file_index < 0 ?
         file_index + file_list.size() : file_index % file_list.size();
-    tree_widget->setCurrentItem(tree_widget->topLevelItem(file_index));
+    select_row(file_index);
+}/*}}}*/
+/**
+ * Makes @a row current.  While comparing, the selection is left as it is,
+ * so stepping through files keeps the ones compared against on screen.
+ */
+void MainWindow::select_row (int row)/*{{{*/
+{
+    list_view->selectionModel()->setCurrentIndex(
+        file_model->index(row),
+        surface->view_layout() == GLSurface::SINGLE
+            ? QItemSelectionModel::ClearAndSelect
+            : QItemSelectionModel::NoUpdate);
 }/*}}}*/
 
 // vim: sw=4 fdm=marker
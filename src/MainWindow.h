@@ -23,11 +23,22 @@
 
 #include <QMainWindow>
 #include <QSettings>
+#include <QTimer>
+
+#include "Image.h"
 
 class QAction;
-class QTreeWidget;
-class QTreeWidgetItem;
+class QListView;
+class QModelIndex;
 class GLSurface;
+class ImageLoader;
+class FileListModel;
+class DirectoryScanner;
+class Playback;
+class QActionGroup;
+class QDockWidget;
+class Scopes;
+class ScopeView;
 
 class MainWindow : public QMainWindow
 {
@@ -41,15 +52,38 @@ private:
 
     QAction *open_action;
     QAction *quit_action;
+    QAction *trace_action;
+    QAction *play_action;
+    QAction *drop_frames_action;
+    QActionGroup *fps_group;
+    QActionGroup *layout_group;
+    QAction *rotate_action;
 
     QMenuBar *menu_bar;
     QMenu *file_menu;
+    QMenu *playback_menu;
+    QMenu *compare_menu;
+    QMenu *view_menu;
 
     GLSurface* surface;
-
-    QTreeWidget* tree_widget;
-    QStringList file_list;
+    ImageLoader* loader;
+    Playback* playback;
+
+    QListView* list_view;
+    FileListModel* file_model;
+    DirectoryScanner* scanner;
+    Scopes* scopes;
+    ScopeView* waveform_view;
+    ScopeView* vectorscope_view;
+    QDockWidget* waveform_dock;
+    QDockWidget* vectorscope_dock;
     int file_index;
+    int scroll_direction;
+    QString current_key;  ///< ImageLoader key of the file on screen
+    QString detail_key;   ///< and of the finer part of it asked for last
+    QStringList compare_keys;  ///< and of the files in views 1 and up
+    QTimer detail_timer;  ///< lets zooming and panning settle first
+    qint64 navigated_us;  ///< when current_key was asked for, until shown
 
 public:
     MainWindow();
@@ -62,13 +96,31 @@ public:
 private:
     void create_actions(void);
     void create_menus(void);
+    void scan_directory (const QString& dir, const QString& select);
+    void select_row (int row);
 
 private slots:
     void open ();
     void quit ();
     void about_to_quit ();
-
-    void current_item_changed (QTreeWidgetItem* item, QTreeWidgetItem* prev);
+    void export_trace ();
+
+    void current_changed (const QModelIndex& current,
+                          const QModelIndex& previous);
+    void update_visible ();
+    void files_found (const QStringList& names);
+    void fetch_detail ();
+    void update_compare ();
+    void set_layout (QAction* action);
+    void scopes_toggled ();
+    void scopes_updated ();
+    void scan_finished ();
+
+    void play (bool on);
+    void set_fps (QAction* action);
+    void set_drop_frames (bool drop);
+    void playback_stats (float achieved_fps, int late);
+    void image_ready (const QString& key, ImagePtr image);
 };
 
 // vim: sw=4 fdm=marker
@@ -0,0 +1,191 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file Playback.cpp
+ * @brief Playback implementation
+ */
+
+/* includes {{{*/
+#include "Playback.moc"
+#include "GLSurface.h"
+#include "ImageLoader.h"
+/*}}}*/
+
+static const int hold_limit = 2000;  ///< ms to wait for one frame
+
+Playback::Playback (ImageLoader* loader, GLSurface* surface, QObject* parent) :/*{{{*/
+    QObject(parent),
+    loader(loader),
+    surface(surface),
+    first(0),
+    position(0),
+    origin(0),
+    requested(-1),
+    fps(24.0f),
+    policy(DROP),
+    ring_size(16),
+    saved_ahead(0),
+    saved_behind(0),
+    stats_shown(0),
+    late(0),
+    held(-1)
+{
+    connect(&timer, SIGNAL(timeout()), this, SLOT(tick()));
+}/*}}}*/
+Playback::~Playback ()/*{{{*/
+{
+}/*}}}*/
+
+void Playback::set_fps (float fps)/*{{{*/
+{
+    this->fps = qMax(1.0f, fps);
+    // twice per frame, so a frame is never more than half a frame late
+    timer.setInterval(qMax(1, (int)(500.0f / this->fps)));
+    if (playing()) {
+        origin = position;
+        clock.start();
+    }
+}/*}}}*/
+void Playback::set_policy (Policy policy)/*{{{*/
+{
+    this->policy = policy;
+}/*}}}*/
+void Playback::set_ring_size (int frames)/*{{{*/
+{
+    ring_size = qMax(1, frames);
+}/*}}}*/
+
+void Playback::start (const QStringList& files, int index)/*{{{*/
+{
+    if (files.isEmpty()) {
+        return;
+    }
+    this->files = files;
+    first = qBound(0, index, files.size() - 1);
+    position = 0;
+    origin = 0;
+    requested = -1;
+    late = 0;
+    held = -1;
+    stats_shown = 0;
+
+    saved_ahead = loader->prefetch_ahead();
+    saved_behind = loader->prefetch_behind();
+    loader->set_prefetch(ring_size, 0);
+    request(0);
+
+    set_fps(fps);
+    clock.start();
+    stats_clock.start();
+    timer.start();
+}/*}}}*/
+void Playback::stop ()/*{{{*/
+{
+    if ( ! playing()) {
+        return;
+    }
+    timer.stop();
+    loader->set_prefetch(saved_ahead, saved_behind);
+}/*}}}*/
+bool Playback::playing () const/*{{{*/
+{
+    return timer.isActive();
+}/*}}}*/
+/**
+ * Index into the file list of the frame on screen.
+ */
+int Playback::current () const/*{{{*/
+{
+    return index_of(position);
+}/*}}}*/
+
+void Playback::tick ()/*{{{*/
+{
+    int now = due();
+
+    if (policy == DROP) {
+        // the frame the clock says; anything before it is too late
+        if (now > position) {
+            request(now);
+            if (show(now)) {
+                late += now - position - 1;
+                position = now;
+            }
+        }
+    } else if (now > position) {
+        request(position + 1);
+        if (show(position + 1)) {
+            position++;
+            if (now > position) {
+                // behind: every frame still gets its full time
+                origin = position;
+                clock.start();
+            }
+        } else if (clock.elapsed() - (position + 1 - origin) * 1000.0f / fps
+                   > hold_limit) {
+            // a file that won't decode mustn't stop playback for good
+            position++;
+            origin = position;
+            clock.start();
+        } else if (held != position + 1) {
+            // counted once, however many ticks it keeps the screen
+            held = position + 1;
+            late++;
+        }
+    }
+
+    int elapsed = stats_clock.elapsed();
+    if (elapsed >= 1000) {
+        emit stats(stats_shown * 1000.0f / elapsed, late);
+        stats_shown = 0;
+        stats_clock.start();
+    }
+}/*}}}*/
+
+int Playback::index_of (int position) const/*{{{*/
+{
+    return (first + position) % files.size();
+}/*}}}*/
+int Playback::due () const/*{{{*/
+{
+    return origin + (int)(clock.elapsed() * fps / 1000.0f);
+}/*}}}*/
+/**
+ * Moves the decoded ring to start at @a position.
+ */
+void Playback::request (int position)/*{{{*/
+{
+    if (position == requested) {
+        return;
+    }
+    requested = position;
+    int index = index_of(position);
+    loader->request(files[index]);
+    loader->prefetch(files, index, 1);
+}/*}}}*/
+bool Playback::show (int position)/*{{{*/
+{
+    ImagePtr image = loader->find_ready(files[index_of(position)]);
+    if ( ! image) {
+        return false;
+    }
+    surface->show_frame(image);
+    stats_shown++;
+    return true;
+}/*}}}*/
+
+// vim: sw=4 fdm=marker
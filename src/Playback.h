@@ -0,0 +1,104 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file Playback.h
+ * @brief Playback definition
+ */
+
+#pragma once
+
+#include "Image.h"
+
+#include <QObject>
+#include <QStringList>
+#include <QTimer>
+#include <QTime>
+
+class GLSurface;
+class ImageLoader;
+
+/**
+ * Plays the file list as an image sequence at a fixed frame rate.
+ *
+ * The loader keeps a ring of frames ahead of the play head decoded; a frame
+ * is only shown once it is decoded in full, and GLSurface::show_frame()
+ * swaps it in whole.  When decoding can't keep up there are two policies:
+ * DROP keeps to the clock and skips the frames that weren't ready when
+ * their time came, HOLD shows every frame and lets the clock slip.  Either
+ * way the decision depends only on what is decoded at each tick.
+ */
+class Playback : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Policy {
+        DROP,
+        HOLD
+    };
+
+private:
+    ImageLoader* loader;
+    GLSurface* surface;
+
+    QStringList files;
+    int first;          ///< index of the frame playback started on
+    int position;       ///< frames since then that are on screen
+    int origin;         ///< position the clock was last started at
+    int requested;      ///< position last handed to the loader
+
+    QTimer timer;
+    QTime clock;
+    float fps;
+    Policy policy;
+    int ring_size;
+    int saved_ahead;
+    int saved_behind;
+
+    QTime stats_clock;
+    int stats_shown;
+    int late;           ///< frames dropped, or frames held
+    int held;           ///< position last counted as held
+
+public:
+    Playback (ImageLoader* loader, GLSurface* surface, QObject* parent = NULL);
+    virtual ~Playback ();
+
+    void set_fps (float fps);
+    void set_policy (Policy policy);
+    void set_ring_size (int frames);
+
+    void start (const QStringList& files, int index);
+    void stop ();
+    bool playing () const;
+    int current () const;
+
+signals:
+    /// about once a second: frames shown per second and frames late so far
+    void stats (float achieved_fps, int late);
+
+private slots:
+    void tick ();
+
+private:
+    int index_of (int position) const;
+    int due () const;
+    void request (int position);
+    bool show (int position);
+};
+
+// vim: sw=4 fdm=marker
@@ -0,0 +1,166 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file Profiler.cpp
+ * @brief Profiler implementation
+ */
+
+/* includes {{{*/
+#include "Profiler.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+#include <QtCore>
+/*}}}*/
+
+struct ProfileEvent/*{{{*/
+{
+    const char* name;
+    int thread;
+    qint64 start_us;
+    qint64 duration_us;
+    qint64 bytes;
+};/*}}}*/
+
+struct ProfileState/*{{{*/
+{
+    QMutex mutex;
+    std::vector<ProfileEvent> ring;
+    qint64 recorded;                        ///< events ever; ring index
+    QHash<QByteArray, Profiler::Stat> stats;
+    QHash<QByteArray, qint64> counters;
+    QHash<Qt::HANDLE, int> threads;         ///< small ids for the trace
+
+    ProfileState () : ring(Profiler::ring_size), recorded(0) {}
+};/*}}}*/
+
+static QAtomicInt profiling (0);
+
+static ProfileState& state ()/*{{{*/
+{
+    static ProfileState s;
+    return s;
+}/*}}}*/
+
+bool Profiler::enabled ()/*{{{*/
+{
+    return profiling != 0;
+}/*}}}*/
+void Profiler::set_enabled (bool on)/*{{{*/
+{
+    profiling = on ? 1 : 0;
+}/*}}}*/
+void Profiler::reset ()/*{{{*/
+{
+    ProfileState& s = state();
+    QMutexLocker lock (&s.mutex);
+    s.recorded = 0;
+    s.stats.clear();
+    s.counters.clear();
+}/*}}}*/
+
+qint64 Profiler::now_us ()/*{{{*/
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (qint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}/*}}}*/
+void Profiler::record (const char* name, qint64 start_us, qint64 end_us, qint64 bytes)/*{{{*/
+{
+    if ( ! enabled()) {
+        return;
+    }
+    ProfileState& s = state();
+    QMutexLocker lock (&s.mutex);
+
+    Qt::HANDLE id = QThread::currentThreadId();
+    if ( ! s.threads.contains(id)) {
+        s.threads.insert(id, s.threads.size() + 1);
+    }
+    ProfileEvent& e = s.ring[s.recorded % ring_size];
+    e.name = name;
+    e.thread = s.threads[id];
+    e.start_us = start_us;
+    e.duration_us = end_us - start_us;
+    e.bytes = bytes;
+    s.recorded++;
+
+    Stat& stat = s.stats[QByteArray::fromRawData(name, strlen(name))];
+    double ms = e.duration_us * 1e-3;
+    stat.average_ms = stat.count == 0 ? ms
+                      : stat.average_ms + (ms - stat.average_ms) / 12.0;
+    stat.count++;
+    stat.last_ms = ms;
+    stat.total_ms += ms;
+    stat.bytes += bytes;
+}/*}}}*/
+void Profiler::count (const char* name, qint64 n)/*{{{*/
+{
+    if ( ! enabled()) {
+        return;
+    }
+    ProfileState& s = state();
+    QMutexLocker lock (&s.mutex);
+    s.counters[QByteArray::fromRawData(name, strlen(name))] += n;
+}/*}}}*/
+
+Profiler::Stat Profiler::stat (const char* name)/*{{{*/
+{
+    ProfileState& s = state();
+    QMutexLocker lock (&s.mutex);
+    return s.stats.value(QByteArray::fromRawData(name, strlen(name)));
+}/*}}}*/
+qint64 Profiler::counter (const char* name)/*{{{*/
+{
+    ProfileState& s = state();
+    QMutexLocker lock (&s.mutex);
+    return s.counters.value(QByteArray::fromRawData(name, strlen(name)));
+}/*}}}*/
+
+/**
+ * Writes the events in the ring as Chrome trace JSON, complete ("X")
+ * events in microseconds.
+ */
+bool Profiler::export_trace (const QString& path)/*{{{*/
+{
+    FILE* f = fopen(QFile::encodeName(path).constData(), "w");
+    if (f == NULL) {
+        return false;
+    }
+
+    ProfileState& s = state();
+    QMutexLocker lock (&s.mutex);
+    qint64 first = qMax((qint64)0, s.recorded - ring_size);
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (qint64 i = first; i < s.recorded; i++) {
+        const ProfileEvent& e = s.ring[i % ring_size];
+        fprintf(f, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, "
+                   "\"tid\": %d, \"ts\": %lld, \"dur\": %lld, "
+                   "\"args\": {\"bytes\": %lld}}",
+                i == first ? "" : ",\n", e.name, e.thread,
+                (long long)e.start_us, (long long)e.duration_us,
+                (long long)e.bytes);
+    }
+    fprintf(f, "\n]}\n");
+    return fclose(f) == 0;
+}/*}}}*/
+
+// vim: sw=4 fdm=marker
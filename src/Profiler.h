@@ -0,0 +1,114 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file Profiler.h
+ * @brief Profiler definition
+ */
+
+#pragma once
+
+#include <QtGlobal>
+#include <QString>
+
+/**
+ * Where the time goes: scoped timers around the load, decode, upload and
+ * paint stages, kept for an on-screen summary and a Chrome trace.
+ *
+ * Recording is off until set_enabled(); a disabled PROFILE_SCOPE costs a
+ * flag test.  Every finished scope is kept in a ring of the last
+ * ring_size events, which export_trace() writes as Chrome trace event
+ * JSON (chrome://tracing, Perfetto), and folded into a per-name Stat for
+ * the overlay.  Names must be string literals; only the pointer is kept.
+ *
+ * Safe to use from any thread.
+ */
+class Profiler
+{
+public:
+    static const int ring_size = 1 << 16;
+
+    struct Stat {
+        qint64 count;
+        double last_ms;
+        double average_ms;  ///< moving average over the last dozen or so
+        double total_ms;
+        qint64 bytes;       ///< moved by all of them together
+
+        Stat () : count(0), last_ms(0.0), average_ms(0.0), total_ms(0.0),
+                  bytes(0) {}
+
+        double mb_per_s () const
+        {
+            return total_ms > 0.0 ? bytes / total_ms * 1e3 / (1 << 20) : 0.0;
+        }
+    };
+
+public:
+    static bool enabled ();
+    static void set_enabled (bool on);
+    static void reset ();
+
+    static qint64 now_us ();
+    static void record (const char* name, qint64 start_us, qint64 end_us,
+                        qint64 bytes = 0);
+    static void count (const char* name, qint64 n = 1);
+
+    static Stat stat (const char* name);
+    static qint64 counter (const char* name);
+
+    static bool export_trace (const QString& path);
+};
+
+/**
+ * Times the enclosing scope as @a name; add_bytes() makes it a
+ * throughput too.
+ */
+class ScopedTimer
+{
+private:
+    const char* name;
+    qint64 start;
+    qint64 bytes;
+
+public:
+    ScopedTimer (const char* name) :
+        name(name),
+        start(Profiler::enabled() ? Profiler::now_us() : -1),
+        bytes(0)
+    {
+    }
+
+    ~ScopedTimer ()
+    {
+        if (start >= 0) {
+            Profiler::record(name, start, Profiler::now_us(), bytes);
+        }
+    }
+
+    void add_bytes (qint64 n) { bytes += n; }
+
+private:
+    ScopedTimer (const ScopedTimer&);
+    ScopedTimer& operator= (const ScopedTimer&);
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_SCOPE(name) \
+    ScopedTimer PROFILE_CONCAT(profile_scope_, __LINE__) (name)
+
+// vim: sw=4 fdm=marker
@@ -0,0 +1,355 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file RawDecoder.cpp
+ * @brief RawDecoder implementation
+ */
+
+#define DCRAW_4 1
+
+/* includes {{{*/
+#include "RawDecoder.h"
+
+#include "Kernels.h"
+#include "Profiler.h"
+
+#include <assert.h>
+
+#include <QtCore>
+#include <QImage>
+
+#ifdef HAVE_LIBRAW
+#include <QTransform>
+#include <libraw/libraw.h>
+#endif
+/*}}}*/
+
+/**
+ * The embedded preview if it is enough for the hints, else the preview as
+ * a stand-in and then the cheapest demosaic that is enough.  Returns a null
+ * image for a file that isn't raw after all.
+ *
+ * dcraw's previews don't say how big the raw image is, so without LibRaw
+ * the preview is only ever a stand-in.
+ */
+ImagePtr RawDecoder::decode (const InputFile& file, DecodeContext& context)/*{{{*/
+{
+    const DecodeHints& hints = context.hints;
+
+    ImagePtr preview;
+    try {
+        preview = decode(file, PREVIEW, context);
+    } catch (const char*) {
+        // no usable preview; the demosaic will do
+    }
+    if (preview) {
+#ifdef HAVE_LIBRAW
+        if (hints.satisfied_by(*preview)) {
+            return preview;
+        }
+#endif
+        context.preview(preview);
+    }
+
+    bool half = hints.scale > 0.0f && hints.scale <= 0.5f;
+    return decode(file, half ? HALF : FULL, context);
+}/*}}}*/
+ImagePtr RawDecoder::decode (const InputFile& file, Tier tier, DecodeContext& context)/*{{{*/
+{
+    static const char* const names[] = {
+        "decode raw preview", "decode raw half", "decode raw full"
+    };
+    ScopedTimer timer (names[tier]);
+    context.check();
+#ifdef HAVE_LIBRAW
+    return libraw_decode(file, tier, context);
+#else
+    if (tier == PREVIEW) {
+        return dcraw_preview(file.name(), context);
+    }
+    return dcraw_decode(file.name(), tier == HALF, context);
+#endif
+}/*}}}*/
+
+#ifdef HAVE_LIBRAW
+/* libraw {{{*/
+static int libraw_progress (void* data, enum LibRaw_progress stage, int iteration, int expected)/*{{{*/
+{
+    Q_UNUSED(stage);
+    Q_UNUSED(iteration);
+    Q_UNUSED(expected);
+    // non-zero makes LibRaw give up with LIBRAW_CANCELLED_BY_CALLBACK
+    return ((const DecodeContext*)data)->cancel.cancelled() ? 1 : 0;
+}/*}}}*/
+
+/**
+ * Every tier in process.  Settings match dcraw -w -4: camera white balance,
+ * linear 16-bit output without auto brightening.
+ */
+ImagePtr RawDecoder::libraw_decode (const InputFile& file, Tier tier, DecodeContext& context)/*{{{*/
+{
+    // far too big for a worker thread's stack
+    QScopedPointer<LibRaw> raw (new LibRaw);
+    // LibRaw reads what it needs itself: for a preview, only the preview
+    if (raw->open_file(QFile::encodeName(file.name()).constData())
+        != LIBRAW_SUCCESS) {
+        return ImagePtr();  // not a raw file after all
+    }
+    const libraw_image_sizes_t& sizes = raw->imgdata.sizes;
+    QSize full_size = (sizes.flip & 4) ? QSize(sizes.height, sizes.width)
+                                       : QSize(sizes.width, sizes.height);
+    context.check();
+
+    /* preview {{{*/
+    if (tier == PREVIEW) {
+        if (raw->unpack_thumb() != LIBRAW_SUCCESS) {
+            return ImagePtr();
+        }
+        int error = 0;
+        libraw_processed_image_t* thumb = raw->dcraw_make_mem_thumb(&error);
+        if (thumb == NULL) {
+            return ImagePtr();
+        }
+        QImage decoded;
+        if (thumb->type == LIBRAW_IMAGE_JPEG) {
+            decoded = QImage::fromData(thumb->data, thumb->data_size, "JPEG");
+        } else if (thumb->colors == 3 && thumb->bits == 8) {
+            decoded = QImage(thumb->data, thumb->width, thumb->height,
+                             thumb->width * 3, QImage::Format_RGB888).copy();
+        }
+        LibRaw::dcraw_clear_mem(thumb);
+        if (decoded.isNull()) {
+            return ImagePtr();
+        }
+
+        // stored the way the sensor sees it; turn it like the demosaic
+        QTransform turn;
+        switch (sizes.flip) {
+        case 3:
+            turn.rotate(180);
+            break;
+        case 5:
+            turn.rotate(-90);
+            break;
+        case 6:
+            turn.rotate(90);
+            break;
+        }
+        if ( ! turn.isIdentity()) {
+            decoded = decoded.transformed(turn);
+        }
+
+        ImagePtr image = Decoder::from_qimage(decoded);
+        image->full_size = full_size;
+        image->region = QRect(QPoint(0, 0), full_size);
+        return image;
+    }
+    /*}}}*/
+
+    libraw_output_params_t& params = raw->imgdata.params;
+    params.use_camera_wb = 1;
+    params.output_bps = 16;
+    params.gamm[0] = params.gamm[1] = 1.0;
+    params.no_auto_bright = 1;
+    params.half_size = tier == HALF ? 1 : 0;
+    raw->set_progress_handler(libraw_progress, &context);
+
+    int status = raw->unpack();
+    if (status == LIBRAW_SUCCESS) {
+        status = raw->dcraw_process();
+    }
+    if (status == LIBRAW_CANCELLED_BY_CALLBACK) {
+        throw DecodeCancelled();
+    }
+    if (status != LIBRAW_SUCCESS) {
+        throw libraw_strerror(status);
+    }
+
+    int error = 0;
+    libraw_processed_image_t* out = raw->dcraw_make_mem_image(&error);
+    if (out == NULL) {
+        throw libraw_strerror(error);
+    }
+    ImagePtr image;
+    try {
+        image = ImagePtr(new Image(out->width, out->height,
+                                   GL_RGBA, GL_UNSIGNED_SHORT));
+    } catch (const char*) {
+        LibRaw::dcraw_clear_mem(out);
+        throw;
+    }
+    // three native order shorts a pixel, padded to RGBA like dcraw's
+    size_t bpl = (size_t)out->width * 3 * sizeof(uint16_t);
+    for (int y = 0; y < out->height; y++) {
+        Kernels::rgb16_to_rgba16((const uint16_t*)(out->data + y * bpl),
+                                 (uint16_t*)image->line(y), out->width, false);
+    }
+    LibRaw::dcraw_clear_mem(out);
+
+    image->flip_y = true;
+    image->opaque = true;
+    image->full_size = full_size;
+    image->region = QRect(QPoint(0, 0), full_size);
+    return image;
+}/*}}}*/
+/*}}}*/
+#endif
+
+/* dcraw {{{*/
+/**
+ * dcraw -e: the embedded preview, JPEG or PPM, as the camera stored it.
+ */
+ImagePtr RawDecoder::dcraw_preview (const QString& fname, DecodeContext& context)/*{{{*/
+{
+    QProcess dcraw;
+    QStringList args;
+    args << "-e" << "-c" << qPrintable(fname);
+    dcraw.start("dcraw", args);
+    if ( ! dcraw.waitForStarted()) {
+        return ImagePtr();
+    }
+
+    QByteArray data;
+    while (wait_ready_read(dcraw, context)) {
+        data.append(dcraw.readAll());
+    }
+    QImage decoded = QImage::fromData(data);
+    if (decoded.isNull()) {
+        return ImagePtr();  // no preview, or not a raw file
+    }
+    return Decoder::from_qimage(decoded);
+}/*}}}*/
+/**
+ * Runs dcraw once and streams its PPM output straight into the image;
+ * with @a half, dcraw -h, which makes one pixel of each 2x2 block.
+ *
+ * There is no separate "dcraw -i" probe: a file dcraw doesn't understand
+ * simply produces no header.  Rows are byte swapped, padded to RGBA and
+ * published as they come off the pipe, so the GL thread can upload them
+ * while dcraw is still writing and QProcess never buffers more than what
+ * the pipe delivered.
+ */
+ImagePtr RawDecoder::dcraw_decode (const QString& fname, bool half, DecodeContext& context)/*{{{*/
+{
+    QProcess dcraw;
+    QStringList args;
+    args << "-c";
+
+#if 1
+    args << "-w";  // camera white balance
+#else
+    args << "-a";  // whole image average white balance
+#endif
+
+#if DCRAW_4
+    args << "-4";
+#endif
+    if (half) {
+        args << "-h";
+    }
+    args << qPrintable(fname);
+    dcraw.start("dcraw", args);
+    if ( ! dcraw.waitForStarted()) {
+        qDebug() << "dcraw didn't start";
+        return ImagePtr();
+    }
+
+    // "P6\n<w> <h>\n<max>\n"
+    QList<QByteArray> header;
+    while (header.size() < 3) {
+        if (dcraw.canReadLine()) {
+            header << dcraw.readLine().trimmed();
+        } else if ( ! wait_ready_read(dcraw, context)) {
+            return ImagePtr();  // not a raw file
+        }
+    }
+    if (header[0] != "P6") {
+        return ImagePtr();
+    }
+    QList<QByteArray> wh = header[1].split(' ');
+    if (wh.size() != 2) {
+        throw "bad dcraw header";
+    }
+    int w = wh[0].toInt();
+    int h = wh[1].toInt();
+    int max = header[2].toInt();
+#if DCRAW_4
+    assert(max == 0xffff);
+    // padded to RGBA on the way in; drivers take four channels much faster
+    ImagePtr image (new Image(w, h, GL_RGBA, GL_UNSIGNED_SHORT));
+    image->opaque = true;  // the padding
+    qint64 ppm_bpl = (qint64)w * 3 * sizeof(quint16);
+#else
+    assert(max == 0xff);
+    ImagePtr image (new Image(w, h, GL_RGB, GL_UNSIGNED_BYTE));
+    qint64 ppm_bpl = (qint64)w * 3 * sizeof(quint8);
+#endif
+    image->flip_y = true;
+    if (half) {
+        image->full_size = QSize(w * 2, h * 2);
+        image->region = QRect(QPoint(0, 0), image->full_size);
+    }
+    image->set_ready_rows(0);
+    context.started(image);
+
+    QByteArray scratch;  // whole rows of dcraw output plus a partial one
+    int rows = 0;
+    while (rows < h) {
+        if ( ! wait_ready_read(dcraw, context)) {
+            throw "dcraw output truncated";
+        }
+        scratch.append(dcraw.readAll());
+
+        int complete = qMin((int)(scratch.size() / ppm_bpl), h - rows);
+        for (int i = 0; i < complete; i++) {
+            const char* src = scratch.constData() + i * ppm_bpl;
+#if DCRAW_4
+            Kernels::rgb16_to_rgba16((const uint16_t*)src,
+                                     (uint16_t*)image->line(rows + i),
+                                     w, true);
+#else
+            memcpy(image->line(rows + i), src, ppm_bpl);
+#endif
+        }
+        scratch.remove(0, complete * ppm_bpl);
+        rows += complete;
+        image->set_ready_rows(rows);
+    }
+
+    dcraw.waitForFinished();
+    return image;
+}/*}}}*/
+
+/**
+ * Waits for more output, polling for cancellation.
+ *
+ * @return false once the process has exited and everything has been read
+ */
+bool RawDecoder::wait_ready_read (QProcess& process, const DecodeContext& context)/*{{{*/
+{
+    while (process.bytesAvailable() == 0) {
+        if (process.state() == QProcess::NotRunning) {
+            return false;
+        }
+        context.check();  // ~QProcess kills dcraw on the way out
+        process.waitForReadyRead(50);
+    }
+    return true;
+}/*}}}*/
+/*}}}*/
+
+// vim: sw=4 fdm=marker
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file RawDecoder.h
+ * @brief RawDecoder definition
+ */
+
+#pragma once
+
+#include "Decoder.h"
+
+class QProcess;
+
+/**
+ * Camera raw files, at three levels of effort.
+ *
+ * PREVIEW is the JPEG the camera embedded, which takes milliseconds;
+ * HALF demosaics each 2x2 Bayer block into one pixel, four times fewer
+ * pixels for a fraction of the time; FULL is the full quality demosaic.
+ * decode() hands the preview to DecodeContext::preview() straight away
+ * and keeps it if it satisfies the hints, as it does for thumbnails and
+ * a zoomed out view; otherwise it goes on to the cheapest demosaic the
+ * hints allow.  A later, closer view asks again and gets the upgrade.
+ *
+ * With LibRaw (HAVE_LIBRAW) all of it runs in process.  Without it dcraw
+ * is run instead, once per tier: dcraw -e for the preview, which only
+ * copies the embedded JPEG out, then the demosaic.  dcraw's previews don't
+ * say how big the raw image is, so they are only ever a stand-in.
+ */
+class RawDecoder
+{
+public:
+    enum Tier {
+        PREVIEW,
+        HALF,
+        FULL
+    };
+
+public:
+    static ImagePtr decode (const InputFile& file, DecodeContext& context);
+    static ImagePtr decode (const InputFile& file, Tier tier,
+                            DecodeContext& context);
+
+private:
+#ifdef HAVE_LIBRAW
+    static ImagePtr libraw_decode (const InputFile& file, Tier tier,
+                                   DecodeContext& context);
+#endif
+    static ImagePtr dcraw_preview (const QString& fname,
+                                   DecodeContext& context);
+    static ImagePtr dcraw_decode (const QString& fname, bool half,
+                                  DecodeContext& context);
+
+    static bool wait_ready_read (QProcess& process,
+                                 const DecodeContext& context);
+};
+
+// vim: sw=4 fdm=marker
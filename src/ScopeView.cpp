@@ -0,0 +1,109 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ScopeView.cpp
+ * @brief ScopeView implementation
+ */
+
+/* includes {{{*/
+#include "ScopeView.moc"
+
+#include <QtCore>
+#include <QPainter>
+/*}}}*/
+
+ScopeView::ScopeView (Kind kind, QWidget* parent) :/*{{{*/
+    QWidget(parent),
+    kind(kind)
+{
+    setAttribute(Qt::WA_OpaquePaintEvent);
+    setMinimumSize(128, 128);
+}/*}}}*/
+ScopeView::~ScopeView ()/*{{{*/
+{
+}/*}}}*/
+
+void ScopeView::set_image (const QImage& image)/*{{{*/
+{
+    this->image = image;
+    update();
+}/*}}}*/
+
+QSize ScopeView::sizeHint () const/*{{{*/
+{
+    return QSize(256, 256);
+}/*}}}*/
+
+/**
+ * Where the picture goes: all of the widget for the waveform, the largest
+ * centred square for the vectorscope, whose axes mean the same thing.
+ */
+QRect ScopeView::picture_rect () const/*{{{*/
+{
+    QRect r = rect().adjusted(4, 4, -4, -4);
+    if (kind == VECTORSCOPE) {
+        int side = qMin(r.width(), r.height());
+        r = QRect(r.x() + (r.width() - side) / 2,
+                  r.y() + (r.height() - side) / 2, side, side);
+    }
+    return r;
+}/*}}}*/
+
+void ScopeView::paintEvent (QPaintEvent* evt)/*{{{*/
+{
+    Q_UNUSED(evt);
+    QPainter painter (this);
+    painter.fillRect(rect(), Qt::black);
+    QRect r = picture_rect();
+    if ( ! image.isNull()) {
+        painter.drawImage(r, image);
+    }
+
+    painter.setPen(QColor(96, 96, 96));
+    if (kind == WAVEFORM) {
+        // quarters of the value range, 0 at the bottom
+        for (int i = 0; i <= 4; i++) {
+            int y = r.bottom() - i * (r.height() - 1) / 4;
+            painter.drawLine(r.left(), y, r.right(), y);
+            painter.drawText(r.left() + 2, y - 2, QString::number(i * 0.25));
+        }
+        return;
+    }
+
+    // the centre, and where the primaries and secondaries land
+    QPointF c = QRectF(r).center();
+    painter.drawLine(QPointF(r.left(), c.y()), QPointF(r.right(), c.y()));
+    painter.drawLine(QPointF(c.x(), r.top()), QPointF(c.x(), r.bottom()));
+    static const struct {
+        float r, g, b;
+        const char* name;
+    } targets[] = {
+        { 1, 0, 0, "R" }, { 1, 1, 0, "Yl" }, { 0, 1, 0, "G" },
+        { 0, 1, 1, "Cy" }, { 0, 0, 1, "B" }, { 1, 0, 1, "Mg" }
+    };
+    for (int i = 0; i < 6; i++) {
+        float y = 0.2126f * targets[i].r + 0.7152f * targets[i].g
+                  + 0.0722f * targets[i].b;
+        float cb = (targets[i].b - y) / 1.8556f;
+        float cr = (targets[i].r - y) / 1.5748f;
+        QPointF p (c.x() + cb * r.width(), c.y() - cr * r.height());
+        painter.drawRect(QRectF(p.x() - 4, p.y() - 4, 8, 8));
+        painter.drawText(p + QPointF(6, -6), targets[i].name);
+    }
+}/*}}}*/
+
+// vim: sw=4 fdm=marker
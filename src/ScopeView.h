@@ -0,0 +1,60 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ScopeView.h
+ * @brief ScopeView definition
+ */
+
+#pragma once
+
+#include <QImage>
+#include <QWidget>
+
+/**
+ * Shows one of the pictures Scopes makes, with its graticule over it.
+ * Painting is a scaled blit and a few lines, whatever the image.
+ */
+class ScopeView : public QWidget
+{
+    Q_OBJECT
+
+public:
+    enum Kind {
+        WAVEFORM,
+        VECTORSCOPE
+    };
+
+private:
+    Kind kind;
+    QImage image;
+
+public:
+    ScopeView (Kind kind, QWidget* parent = NULL);
+    virtual ~ScopeView ();
+
+    void set_image (const QImage& image);
+
+    virtual QSize sizeHint () const;
+
+protected:
+    virtual void paintEvent (QPaintEvent* evt);
+
+private:
+    QRect picture_rect () const;
+};
+
+// vim: sw=4 fdm=marker
@@ -0,0 +1,234 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file Scopes.cpp
+ * @brief Scopes implementation
+ */
+
+/* includes {{{*/
+#include "Scopes.moc"
+#include "Profiler.h"
+
+#include <math.h>
+
+#include <vector>
+
+#include <QtCore>
+/*}}}*/
+
+/**
+ * Counts as brightness, on a log scale so a few stray pixels still show
+ * next to the bulk of the image.
+ */
+static uint8_t level (quint32 count, float log_max)/*{{{*/
+{
+    if (count == 0) {
+        return 0;
+    }
+    return (uint8_t)qMin(255.0f, 48.0f + 207.0f * log1pf(count) / log_max);
+}/*}}}*/
+static float log_max (const QVector<quint32>& counts)/*{{{*/
+{
+    quint32 max = 1;
+    for (int i = 0; i < counts.size(); i++) {
+        max = qMax(max, counts[i]);
+    }
+    return log1pf(max);
+}/*}}}*/
+
+class ScopeJob : public QRunnable/*{{{*/
+{
+private:
+    Scopes* scopes;
+    QSharedPointer<Scopes::Accumulator> state;
+
+public:
+    ScopeJob (Scopes* scopes,
+              const QSharedPointer<Scopes::Accumulator>& state) :
+        scopes(scopes),
+        state(state)
+    {
+    }
+
+    virtual void run ()
+    {
+        PROFILE_SCOPE("scopes");
+        Scopes::Accumulator& a = *state;
+        const Image& image = *a.image;
+        const int size = Scopes::size;
+        const float top = size - 1;
+        quint32* wave = a.waveform.data();
+        quint32* vector = a.vectorscope.data();
+
+        // no further than what is decoded now; more_rows() brings us back
+        int ready = image.rows_ready();
+        std::vector<float> row ((size_t)image.width * 4);
+        for (; a.next_row < ready && ! a.cancel.cancelled();
+             a.next_row += a.step) {
+            image.row_to_float(a.next_row, &row[0]);
+            for (int x = 0; x < image.width; x += a.step) {
+                const float* p = &row[(size_t)x * 4];
+                float r = qBound(0.0f, p[0], 1.0f);
+                float g = qBound(0.0f, p[1], 1.0f);
+                float b = qBound(0.0f, p[2], 1.0f);
+
+                int column = (int)((qint64)x * size / image.width);
+                wave[(int)(r * top) * size + column]++;
+                wave[(size + (int)(g * top)) * size + column]++;
+                wave[(2 * size + (int)(b * top)) * size + column]++;
+
+                float y = 0.2126f * r + 0.7152f * g + 0.0722f * b;
+                float cb = (b - y) / 1.8556f;
+                float cr = (r - y) / 1.5748f;
+                int u = qBound(0, (int)((cb + 0.5f) * top + 0.5f), size - 1);
+                int v = qBound(0, (int)((0.5f - cr) * top + 0.5f), size - 1);
+                vector[v * size + u]++;
+            }
+        }
+
+        // the pictures are made here too, so the GUI thread only shows them
+        QImage waveform (size, size, QImage::Format_RGB32);
+        float wave_max = log_max(a.waveform);
+        for (int y = 0; y < size; y++) {
+            QRgb* line = (QRgb*)waveform.scanLine(size - 1 - y);  // 1 on top
+            for (int x = 0; x < size; x++) {
+                line[x] = qRgb(level(wave[y * size + x], wave_max),
+                               level(wave[(size + y) * size + x], wave_max),
+                               level(wave[(2 * size + y) * size + x],
+                                     wave_max));
+            }
+        }
+        QImage vectorscope (size, size, QImage::Format_RGB32);
+        float vector_max = log_max(a.vectorscope);
+        for (int y = 0; y < size; y++) {
+            QRgb* line = (QRgb*)vectorscope.scanLine(y);
+            for (int x = 0; x < size; x++) {
+                uint8_t l = level(vector[y * size + x], vector_max);
+                line[x] = qRgb(l * 3 / 4, l, l * 3 / 4);
+            }
+        }
+
+        emit scopes->rows_done(a.generation, waveform, vectorscope,
+                               a.next_row < image.height);
+    }
+};/*}}}*/
+
+Scopes::Scopes (QObject* parent) :/*{{{*/
+    QObject(parent),
+    generation(0),
+    running(0)
+{
+    pool.setMaxThreadCount(1);
+    poll.setSingleShot(true);
+    poll.setInterval(50);
+
+    connect(this, SIGNAL(rows_done(int,QImage,QImage,bool)),
+            this, SLOT(deliver(int,QImage,QImage,bool)),
+            Qt::QueuedConnection);
+    connect(&poll, SIGNAL(timeout()), this, SLOT(more_rows()));
+}/*}}}*/
+Scopes::~Scopes ()/*{{{*/
+{
+    clear();
+    pool.waitForDone();
+}/*}}}*/
+
+/**
+ * Starts over on @a image; whatever was being done for the last one is
+ * dropped.  The same image again carries on where it was.
+ */
+void Scopes::analyze (const ImagePtr& image)/*{{{*/
+{
+    if (state && state->image == image) {
+        return;
+    }
+    clear();
+    if ( ! image) {
+        return;
+    }
+
+    state = QSharedPointer<Accumulator>(new Accumulator);
+    state->image = image;
+    state->generation = generation;
+    state->step = qMax(1, (qMax(image->width, image->height) + samples - 1)
+                          / samples);
+    state->next_row = 0;
+    state->waveform.fill(0, 3 * size * size);
+    state->vectorscope.fill(0, size * size);
+    running++;
+    pool.start(new ScopeJob(this, state));
+}/*}}}*/
+/**
+ * Drops the current image; the pictures stay until the next one.
+ */
+void Scopes::clear ()/*{{{*/
+{
+    if (state) {
+        state->cancel.cancel();
+        state.clear();
+    }
+    generation++;
+    poll.stop();
+}/*}}}*/
+
+const QImage& Scopes::waveform () const/*{{{*/
+{
+    return waveform_image;
+}/*}}}*/
+const QImage& Scopes::vectorscope () const/*{{{*/
+{
+    return vectorscope_image;
+}/*}}}*/
+
+void Scopes::deliver (int generation, const QImage& waveform, const QImage& vectorscope, bool more)/*{{{*/
+{
+    running--;
+    if (generation != this->generation) {
+        return;
+    }
+    waveform_image = waveform;
+    vectorscope_image = vectorscope;
+    emit updated();
+    if (more) {
+        poll.start();
+    }
+}/*}}}*/
+/**
+ * Adds the rows a streaming decode has finished since the last job.  Jobs
+ * for an earlier image may still be winding down; the counts are only
+ * ever touched by one job at a time anyway.
+ */
+void Scopes::more_rows ()/*{{{*/
+{
+    if ( ! state) {
+        return;
+    }
+    if (running > 0) {
+        poll.start();
+        return;
+    }
+    if (state->image->rows_ready() <= state->next_row) {
+        if (state->image->rows_ready() < state->image->height) {
+            poll.start();  // nothing new yet
+        }
+        return;
+    }
+    running++;
+    pool.start(new ScopeJob(this, state));
+}/*}}}*/
+
+// vim: sw=4 fdm=marker
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file Scopes.h
+ * @brief Scopes definition
+ */
+
+#pragma once
+
+#include "Image.h"
+#include "Decoder.h"
+
+#include <QImage>
+#include <QObject>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QTimer>
+#include <QVector>
+
+/**
+ * A waveform and a vectorscope of an image, worked out on a worker thread.
+ *
+ * Only a grid of at most samples pixels on the longest side is read, which
+ * is the downsampled copy the scopes are made of, without making it.  Rows
+ * are taken as soon as Image::rows_ready() covers them: a streaming decode
+ * is added to the scopes a batch of rows at a time while it runs, and
+ * updated() says each time there is more to show.  The GUI thread never
+ * does more than look at the finished pictures.
+ *
+ * Both scopes show the raw values, clamped to [0,1]: the waveform per
+ * channel against image columns, the vectorscope Rec. 709 Cb and Cr.
+ */
+class Scopes : public QObject
+{
+    Q_OBJECT
+
+    friend class ScopeJob;
+
+public:
+    static const int size = 256;     ///< on either side of both scopes
+    static const int samples = 512;  ///< longest side of the sampled grid
+
+private:
+    /// the counts so far; one job at a time adds to them
+    struct Accumulator {
+        ImagePtr image;
+        CancelToken cancel;
+        int generation;
+        int step;           ///< between sampled rows and columns
+        int next_row;       ///< in memory order
+        QVector<quint32> waveform;  ///< size * size for each of R, G, B
+        QVector<quint32> vectorscope;
+    };
+
+    QThreadPool pool;
+    int generation;     ///< of the current image; stale results are dropped
+    int running;        ///< jobs started and not delivered yet
+    QSharedPointer<Accumulator> state;
+    QTimer poll;        ///< looks for more rows of a streaming image
+
+    QImage waveform_image;
+    QImage vectorscope_image;
+
+public:
+    Scopes (QObject* parent = NULL);
+    virtual ~Scopes ();
+
+    void analyze (const ImagePtr& image);
+    void clear ();
+
+    const QImage& waveform () const;
+    const QImage& vectorscope () const;
+
+signals:
+    void updated ();
+
+    /// from the ScopeJob to deliver(), across threads
+    void rows_done (int generation, const QImage& waveform,
+                    const QImage& vectorscope, bool more);
+
+private slots:
+    void deliver (int generation, const QImage& waveform,
+                  const QImage& vectorscope, bool more);
+    void more_rows ();
+};
+
+// vim: sw=4 fdm=marker
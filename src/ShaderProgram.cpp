@@ -0,0 +1,222 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ShaderProgram.cpp
+ * @brief ShaderProgram implementation
+ */
+
+/* includes {{{*/
+#include "ShaderProgram.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QVector>
+/*}}}*/
+
+ShaderProgram::ShaderProgram () :/*{{{*/
+    program(0)
+{
+}/*}}}*/
+ShaderProgram::~ShaderProgram ()/*{{{*/
+{
+}/*}}}*/
+
+/**
+ * Where program binaries are kept; empty, the default, keeps none.
+ */
+void ShaderProgram::set_cache_dir (const QString& dir)/*{{{*/
+{
+    cache_dir = dir;
+}/*}}}*/
+
+/**
+ * @a source with @a defines inserted after its #version line.
+ */
+static QByteArray specialize (const char* source, const QByteArray& defines)/*{{{*/
+{
+    QByteArray text (source);
+    if (defines.isEmpty()) {
+        return text;
+    }
+    int version = text.indexOf("#version");
+    int end = version < 0 ? -1 : text.indexOf('\n', version);
+    return text.insert(end + 1, defines);
+}/*}}}*/
+
+void ShaderProgram::build (const char* vertex_text, const char* fragment_text, const QByteArray& defines)/*{{{*/
+{
+    release();
+    QByteArray vertex_source = specialize(vertex_text, defines);
+    QByteArray fragment_source = specialize(fragment_text, defines);
+    program = glCreateProgram();
+
+    bool binary = GLEW_ARB_get_program_binary && ! cache_dir.isEmpty();
+    QString path;
+    if (binary) {
+        path = cache_path(vertex_source, fragment_source);
+        if (load_binary(path)) {
+            return;
+        }
+    }
+
+    GLuint vs = compile(GL_VERTEX_SHADER, vertex_source);
+    GLuint fs = compile(GL_FRAGMENT_SHADER, fragment_source);
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    glBindAttribLocation(program, 0, "corner");
+    glBindFragDataLocation(program, 0, "color");
+    if (binary) {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                            GL_TRUE);
+    }
+    bool linked = link();
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+    if ( ! linked) {
+        throw "shader program failed to link";
+    }
+
+    if (binary) {
+        save_binary(path);
+    }
+}/*}}}*/
+void ShaderProgram::release ()/*{{{*/
+{
+    if (program != 0) {
+        glDeleteProgram(program);
+        program = 0;
+    }
+}/*}}}*/
+
+GLuint ShaderProgram::id () const/*{{{*/
+{
+    return program;
+}/*}}}*/
+GLint ShaderProgram::uniform (const char* name) const/*{{{*/
+{
+    return glGetUniformLocation(program, name);
+}/*}}}*/
+/**
+ * Connects uniform block @a name to buffer binding point @a binding.  Not
+ * part of a program binary, so this is needed after every build().
+ */
+void ShaderProgram::bind_block (const char* name, GLuint binding)/*{{{*/
+{
+    GLuint index = glGetUniformBlockIndex(program, name);
+    if (index != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program, index, binding);
+    }
+}/*}}}*/
+
+/**
+ * Binaries only work on the driver that made them, so the driver is part
+ * of the name.
+ */
+QString ShaderProgram::cache_path (const QByteArray& vertex_source, const QByteArray& fragment_source) const/*{{{*/
+{
+    QCryptographicHash hash (QCryptographicHash::Sha1);
+    hash.addData(vertex_source);
+    hash.addData(fragment_source);
+    hash.addData((const char*)glGetString(GL_VENDOR));
+    hash.addData((const char*)glGetString(GL_RENDERER));
+    hash.addData((const char*)glGetString(GL_VERSION));
+    return QDir(cache_dir).filePath(hash.result().toHex() + ".bin");
+}/*}}}*/
+bool ShaderProgram::load_binary (const QString& path)/*{{{*/
+{
+    QFile file (path);
+    if ( ! file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QDataStream in (&file);
+    quint32 format;
+    QByteArray data;
+    in >> format >> data;
+    if (in.status() != QDataStream::Ok || data.isEmpty()) {
+        return false;
+    }
+
+    glProgramBinary(program, format, data.constData(), data.size());
+    GLint status = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE) {
+        // a driver update; start over with a clean program
+        file.remove();
+        glDeleteProgram(program);
+        program = glCreateProgram();
+        return false;
+    }
+    return true;
+}/*}}}*/
+void ShaderProgram::save_binary (const QString& path)/*{{{*/
+{
+    GLint size = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+    if (size <= 0) {
+        return;  // the driver supports the call but has no formats
+    }
+    QByteArray data (size, 0);
+    GLenum format;
+    glGetProgramBinary(program, size, NULL, &format, data.data());
+
+    QDir().mkpath(cache_dir);
+    QFile file (path);
+    if (file.open(QIODevice::WriteOnly)) {
+        QDataStream out (&file);
+        out << (quint32)format << data;
+    }
+}/*}}}*/
+
+GLuint ShaderProgram::compile (GLenum type, const QByteArray& source)/*{{{*/
+{
+    GLuint shader = glCreateShader(type);
+    const char* text = source.constData();
+    glShaderSource(shader, 1, &text, NULL);
+    glCompileShader(shader);
+
+    GLint status = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (status != GL_TRUE) {
+        GLint length = 0;
+        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+        QVector<char> log (qMax(1, length));
+        glGetShaderInfoLog(shader, log.size(), NULL, log.data());
+        qWarning("shader compile error:\n%s", log.data());
+        glDeleteShader(shader);
+        throw "shader failed to compile";
+    }
+    return shader;
+}/*}}}*/
+bool ShaderProgram::link ()/*{{{*/
+{
+    glLinkProgram(program);
+
+    GLint status = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE) {
+        GLint length = 0;
+        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+        QVector<char> log (qMax(1, length));
+        glGetProgramInfoLog(program, log.size(), NULL, log.data());
+        qWarning("shader link error:\n%s", log.data());
+    }
+    return status == GL_TRUE;
+}/*}}}*/
+
+// vim: sw=4 fdm=marker
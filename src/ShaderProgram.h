@@ -0,0 +1,71 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ShaderProgram.h
+ * @brief ShaderProgram definition
+ */
+
+#pragma once
+
+#include <GL/glew.h>  // include before gl.h
+#include <QByteArray>
+#include <QString>
+
+/**
+ * A linked GLSL program, cached on disk as a program binary.
+ *
+ * build() first looks for a binary saved by an earlier run with the same
+ * sources on the same driver; only if there is none, or the driver refuses
+ * it, are the sources compiled, and the result is saved for next time.
+ * Without ARB_get_program_binary it always compiles.
+ *
+ * Variants of one source are made with @a defines, lines such as
+ * "#define FOO 1\n" that go right after the #version line.
+ *
+ * Vertex attribute 0 is "corner" and fragment output 0 is "color".  All
+ * methods must be called with the GL context current.
+ */
+class ShaderProgram
+{
+private:
+    GLuint program;
+    QString cache_dir;
+
+public:
+    ShaderProgram ();
+    virtual ~ShaderProgram ();
+
+    void set_cache_dir (const QString& dir);
+
+    void build (const char* vertex_source, const char* fragment_source,
+                const QByteArray& defines = QByteArray());
+    void release ();
+
+    GLuint id () const;
+    GLint uniform (const char* name) const;
+    void bind_block (const char* name, GLuint binding);
+
+private:
+    QString cache_path (const QByteArray& vertex_source,
+                        const QByteArray& fragment_source) const;
+    bool load_binary (const QString& path);
+    void save_binary (const QString& path);
+    GLuint compile (GLenum type, const QByteArray& source);
+    bool link ();
+};
+
+// vim: sw=4 fdm=marker
@@ -0,0 +1,462 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file TextureResidency.cpp
+ * @brief TextureResidency implementation
+ */
+
+/* includes {{{*/
+#include "TextureResidency.moc"
+#include "TextureUploader.h"
+#include "Profiler.h"
+
+#include <string.h>
+
+#include <QtCore>
+/*}}}*/
+
+/* BC6H {{{*/
+static const int bc6h_weights[16] = {
+    0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64
+};
+
+/**
+ * Half bits to the integer space BC6H interpolates in; the decoder scales
+ * by 31/64 on the way out.  Negatives and non-finite values are clamped.
+ */
+static int bc6h_unquantized (uint16_t h)/*{{{*/
+{
+    if (h & 0x8000) {
+        return 0;
+    }
+    h = qMin(h, (uint16_t)0x7bff);
+    return (h * 64 + 30) / 31;
+}/*}}}*/
+/// the nearest 10-bit endpoint; they decode to q * 64 + 32
+static int bc6h_quantize (int v)/*{{{*/
+{
+    return qBound(0, v / 64, 1023);
+}/*}}}*/
+static int bc6h_dequantize (int q)/*{{{*/
+{
+    return q == 0 ? 0 : q == 1023 ? 0xffff : ((q << 16) + 0x8000) >> 10;
+}/*}}}*/
+static void put_bits (uint8_t* block, int& pos, int value, int bits)/*{{{*/
+{
+    for (int i = 0; i < bits; i++, pos++) {
+        if (value & (1 << i)) {
+            block[pos >> 3] |= 1 << (pos & 7);
+        }
+    }
+}/*}}}*/
+
+/**
+ * Sixteen RGB half float pixels to a BC6H block in mode 11: one subset,
+ * 10-bit endpoints at the corners of the block's colour box, 4-bit indices.
+ * Not the best BC6H can do, but fast enough to keep up with browsing.
+ */
+static void bc6h_encode_block (const uint16_t* const pixels[16], uint8_t* block)/*{{{*/
+{
+    int p[16][3];
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < 3; c++) {
+            p[i][c] = bc6h_unquantized(pixels[i][c]);
+        }
+    }
+
+    // channels that fall as the widest one rises run the other way
+    int lo[3], hi[3];
+    double mean[3] = { 0.0, 0.0, 0.0 };
+    for (int c = 0; c < 3; c++) {
+        lo[c] = hi[c] = p[0][c];
+        for (int i = 0; i < 16; i++) {
+            lo[c] = qMin(lo[c], p[i][c]);
+            hi[c] = qMax(hi[c], p[i][c]);
+            mean[c] += p[i][c] / 16.0;
+        }
+    }
+    int widest = 0;
+    for (int c = 1; c < 3; c++) {
+        if (hi[c] - lo[c] > hi[widest] - lo[widest]) {
+            widest = c;
+        }
+    }
+    int a[3], b[3];
+    for (int c = 0; c < 3; c++) {
+        double cov = 0.0;
+        for (int i = 0; i < 16; i++) {
+            cov += (p[i][c] - mean[c]) * (p[i][widest] - mean[widest]);
+        }
+        a[c] = bc6h_quantize(cov < 0.0 ? hi[c] : lo[c]);
+        b[c] = bc6h_quantize(cov < 0.0 ? lo[c] : hi[c]);
+    }
+
+    // the nearest of the sixteen points between them
+    int ea[3], eb[3];
+    for (int c = 0; c < 3; c++) {
+        ea[c] = bc6h_dequantize(a[c]);
+        eb[c] = bc6h_dequantize(b[c]);
+    }
+    int index[16];
+    for (int i = 0; i < 16; i++) {
+        qint64 best = -1;
+        for (int k = 0; k < 16; k++) {
+            int w = bc6h_weights[k];
+            qint64 err = 0;
+            for (int c = 0; c < 3; c++) {
+                qint64 d = ((ea[c] * (64 - w) + eb[c] * w + 32) >> 6) - p[i][c];
+                err += d * d;
+            }
+            if (best < 0 || err < best) {
+                best = err;
+                index[i] = k;
+            }
+        }
+    }
+    // the first index has its top bit left out, so it must be zero
+    if (index[0] >= 8) {
+        for (int c = 0; c < 3; c++) {
+            qSwap(a[c], b[c]);
+        }
+        for (int i = 0; i < 16; i++) {
+            index[i] = 15 - index[i];
+        }
+    }
+
+    memset(block, 0, 16);
+    int pos = 0;
+    put_bits(block, pos, 0x03, 5);  // mode 11
+    for (int c = 0; c < 3; c++) {
+        put_bits(block, pos, a[c], 10);
+    }
+    for (int c = 0; c < 3; c++) {
+        put_bits(block, pos, b[c], 10);
+    }
+    put_bits(block, pos, index[0], 3);
+    for (int i = 1; i < 16; i++) {
+        put_bits(block, pos, index[i], 4);
+    }
+}/*}}}*/
+/**
+ * The top left @a width by @a height of an RGBA half float @a image as
+ * BC6H blocks, rows in memory order like the uploads.  Blocks that hang
+ * over the edge repeat the last row and column.
+ */
+static QByteArray bc6h_encode (const Image& image, int width, int height)/*{{{*/
+{
+    int bw = (width + 3) / 4;
+    int bh = (height + 3) / 4;
+    QByteArray blocks (bw * bh * 16, 0);
+    uint8_t* out = (uint8_t*)blocks.data();
+    const uint16_t* pixels[16];
+    for (int by = 0; by < bh; by++) {
+        for (int bx = 0; bx < bw; bx++) {
+            for (int i = 0; i < 16; i++) {
+                int x = qMin(bx * 4 + i % 4, width - 1);
+                int y = qMin(by * 4 + i / 4, height - 1);
+                pixels[i] = (const uint16_t*)image.line(y) + x * 4;
+            }
+            bc6h_encode_block(pixels, out);
+            out += 16;
+        }
+    }
+    return blocks;
+}/*}}}*/
+/*}}}*/
+
+class EncodeJob : public QRunnable/*{{{*/
+{
+private:
+    TextureResidency* residency;
+    ImagePtr image;
+
+public:
+    EncodeJob (TextureResidency* residency, const ImagePtr& image) :
+        residency(residency),
+        image(image)
+    {
+    }
+
+    virtual void run ()
+    {
+        PROFILE_SCOPE("encode bc6h");
+        TextureResidency::Encoded result;
+        result.image = image.toWeakRef();
+
+        // GL's mip sizes round down, half_size() rounds up
+        ImagePtr level = image;
+        int w = image->width;
+        int h = image->height;
+        for (;;) {
+            result.levels << bc6h_encode(*level, w, h);
+            result.sizes << QSize(w, h);
+            if (w == 1 && h == 1) {
+                break;
+            }
+            level = level->half_size();
+            w = qMax(1, w / 2);
+            h = qMax(1, h / 2);
+        }
+
+        residency->mutex.lock();
+        residency->encoded << result;
+        residency->mutex.unlock();
+        emit residency->encode_finished();
+    }
+};/*}}}*/
+
+TextureResidency::TextureResidency (qint64 budget_bytes) :/*{{{*/
+    budget(budget_bytes),
+    bytes(0),
+    clock(0),
+    hits(0),
+    misses(0),
+    use_bc6h(false),
+    have_bptc(false)
+{
+    // behind the decoders; a compressed copy is a nicety
+    pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() / 2));
+}/*}}}*/
+TextureResidency::~TextureResidency ()/*{{{*/
+{
+    pool.waitForDone();
+}/*}}}*/
+
+void TextureResidency::initialize ()/*{{{*/
+{
+    have_bptc = GLEW_VERSION_4_2 || GLEW_ARB_texture_compression_bptc;
+}/*}}}*/
+void TextureResidency::release ()/*{{{*/
+{
+    pool.waitForDone();
+    while ( ! entries.isEmpty()) {
+        remove(entries.begin());
+    }
+    QMutexLocker lock (&mutex);
+    encoded.clear();
+}/*}}}*/
+
+void TextureResidency::set_budget (qint64 bytes)/*{{{*/
+{
+    budget = qMax((qint64)0, bytes);
+    evict(0);
+}/*}}}*/
+void TextureResidency::set_bc6h (bool on)/*{{{*/
+{
+    use_bc6h = on;
+}/*}}}*/
+
+/**
+ * The texture holding all of @a image, or 0 if it has to be uploaded.
+ */
+GLuint TextureResidency::find (const ImagePtr& image)/*{{{*/
+{
+    QHash<const Image*, Entry>::iterator it = entries.find(image.data());
+    if (it == entries.end()) {
+        return 0;
+    }
+    if (it->image.toStrongRef() != image) {
+        remove(it);  // an earlier image at the same address
+        return 0;
+    }
+    if ( ! it->complete) {
+        return 0;
+    }
+    it->last_used = ++clock;
+    hits++;
+    Profiler::count("texture resident");
+    return it->tex;
+}/*}}}*/
+/**
+ * A texture for @a image to be uploaded into, counted against the budget
+ * from now on.  An image that already has one gets the same one back.
+ */
+GLuint TextureResidency::allocate (const ImagePtr& image)/*{{{*/
+{
+    GLenum format = TextureUploader::internal_format(*image);
+    // a third more for the mip levels
+    qint64 size = TextureUploader::texel_bytes(format)
+                  * image->width * image->height * 4 / 3;
+    misses++;
+
+    QHash<const Image*, Entry>::iterator it = entries.find(image.data());
+    if (it != entries.end() && it->image.toStrongRef() == image) {
+        bytes += size - it->bytes;
+        it->bytes = size;
+        it->last_used = ++clock;
+        it->complete = false;
+        it->compressed = false;
+        evict(0);
+        return it->tex;
+    }
+    if (it != entries.end()) {
+        remove(it);
+    }
+
+    evict(size);
+    Entry entry;
+    entry.image = image.toWeakRef();
+    glGenTextures(1, &entry.tex);
+    entry.bytes = size;
+    entry.last_used = ++clock;
+    entry.complete = false;
+    entry.compressed = false;
+    entries.insert(image.data(), entry);
+    bytes += size;
+    return entry.tex;
+}/*}}}*/
+/**
+ * The last row of @a image is in its texture.  Opaque half float images
+ * are queued for BC6H, if that's on.
+ */
+void TextureResidency::uploaded (const ImagePtr& image)/*{{{*/
+{
+    QHash<const Image*, Entry>::iterator it = entries.find(image.data());
+    if (it == entries.end() || it->image.toStrongRef() != image) {
+        return;
+    }
+    it->complete = true;
+
+    if (use_bc6h && have_bptc && ! it->compressed
+        && image->type == GL_HALF_FLOAT_ARB && image->channels() == 4
+        && image->opaque && image->complete()) {
+        pool.start(new EncodeJob(this, image));
+    }
+}/*}}}*/
+/**
+ * @a images are on screen; their textures are not to be evicted.
+ */
+void TextureResidency::set_shown (const QList<ImagePtr>& images)/*{{{*/
+{
+    shown.clear();
+    foreach (const ImagePtr& image, images) {
+        if ( ! image) {
+            continue;
+        }
+        shown.insert(image.data());
+        QHash<const Image*, Entry>::iterator it = entries.find(image.data());
+        if (it != entries.end()) {
+            it->last_used = ++clock;
+        }
+    }
+}/*}}}*/
+/**
+ * Swaps in the BC6H textures encoded since the last call, for images that
+ * are still resident and haven't been uploaded again meanwhile.
+ */
+void TextureResidency::upload_encoded ()/*{{{*/
+{
+    QList<Encoded> done;
+    mutex.lock();
+    done.swap(encoded);
+    mutex.unlock();
+
+    foreach (const Encoded& e, done) {
+        ImagePtr image = e.image.toStrongRef();
+        if ( ! image) {
+            continue;
+        }
+        QHash<const Image*, Entry>::iterator it = entries.find(image.data());
+        if (it == entries.end() || it->image.toStrongRef() != image
+            || ! it->complete || it->compressed) {
+            continue;
+        }
+
+        GLuint tex;
+        glGenTextures(1, &tex);
+        glBindTexture(GL_TEXTURE_2D, tex);
+        qint64 size = 0;
+        for (int level = 0; level < e.levels.size(); level++) {
+            const QByteArray& blocks = e.levels[level];
+            glCompressedTexImage2D(GL_TEXTURE_2D, level,
+                                   GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT_ARB,
+                                   e.sizes[level].width(),
+                                   e.sizes[level].height(), 0,
+                                   blocks.size(), blocks.constData());
+            size += blocks.size();
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                        e.levels.size() - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                        GL_LINEAR_MIPMAP_LINEAR);
+
+        GLuint old_tex = it->tex;
+        it->tex = tex;
+        bytes += size - it->bytes;
+        it->bytes = size;
+        it->compressed = true;
+        emit replaced(old_tex, tex);
+        glDeleteTextures(1, &old_tex);
+    }
+}/*}}}*/
+
+TextureResidency::Stats TextureResidency::stats () const/*{{{*/
+{
+    Stats s;
+    s.bytes = bytes;
+    s.budget = budget;
+    s.textures = entries.size();
+    s.compressed = 0;
+    foreach (const Entry& entry, entries) {
+        s.compressed += entry.compressed ? 1 : 0;
+    }
+    s.hits = hits;
+    s.misses = misses;
+    return s;
+}/*}}}*/
+
+/**
+ * Deletes textures until @a needed more bytes fit: those of images nothing
+ * holds any more first, then the least recently shown.
+ */
+void TextureResidency::evict (qint64 needed)/*{{{*/
+{
+    QHash<const Image*, Entry>::iterator it = entries.begin();
+    while (it != entries.end()) {
+        if (it->image.isNull() && ! shown.contains(it.key())) {
+            glDeleteTextures(1, &it->tex);
+            bytes -= it->bytes;
+            it = entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    while (bytes + needed > budget) {
+        QHash<const Image*, Entry>::iterator oldest = entries.end();
+        for (it = entries.begin(); it != entries.end(); ++it) {
+            if ( ! shown.contains(it.key())
+                && (oldest == entries.end()
+                    || it->last_used < oldest->last_used)) {
+                oldest = it;
+            }
+        }
+        if (oldest == entries.end()) {
+            break;  // only what is on screen is left
+        }
+        remove(oldest);
+    }
+}/*}}}*/
+void TextureResidency::remove (QHash<const Image*, Entry>::iterator it)/*{{{*/
+{
+    glDeleteTextures(1, &it->tex);
+    bytes -= it->bytes;
+    entries.erase(it);
+}/*}}}*/
+
+// vim: sw=4 fdm=marker
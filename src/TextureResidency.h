@@ -0,0 +1,128 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file TextureResidency.h
+ * @brief TextureResidency definition
+ */
+
+#pragma once
+
+#include "Image.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QSet>
+#include <QSize>
+#include <QThreadPool>
+#include <QWeakPointer>
+
+/**
+ * Keeps decoded images on the GPU, within a video memory budget.
+ *
+ * Each image gets a texture of its own, in the format
+ * TextureUploader::internal_format() picks for it.  Going back to an image
+ * whose texture is still resident is a bind, not an upload; the least
+ * recently shown textures are deleted once the budget is reached, never
+ * those on screen.  Textures are kept by image, not by file, and go with the
+ * image once nothing holds it any more.
+ *
+ * With BC6H turned on, and where the GL has it, opaque half float images
+ * are also encoded to BC6H on a worker pool once uploaded, mip levels and
+ * all, and their texture swapped for the compressed one at an eighth of
+ * the size.  replaced() says when.
+ *
+ * All methods must be called with the GL context current.
+ */
+class TextureResidency : public QObject
+{
+    Q_OBJECT
+
+    friend class EncodeJob;
+
+public:
+    struct Stats {
+        qint64 bytes;
+        qint64 budget;
+        int textures;
+        int compressed;
+        int hits;
+        int misses;
+    };
+
+private:
+    struct Entry {
+        QWeakPointer<Image> image;
+        GLuint tex;
+        qint64 bytes;
+        int last_used;
+        bool complete;     ///< every row uploaded
+        bool compressed;
+    };
+    struct Encoded {
+        QWeakPointer<Image> image;
+        QList<QByteArray> levels;
+        QList<QSize> sizes;
+    };
+
+    QHash<const Image*, Entry> entries;
+    qint64 budget;
+    qint64 bytes;
+    int clock;
+    QSet<const Image*> shown;
+    int hits;
+    int misses;
+
+    bool use_bc6h;
+    bool have_bptc;
+    QThreadPool pool;
+    QMutex mutex;
+    QList<Encoded> encoded;  ///< finished off the GL thread, not yet uploaded
+
+public:
+    TextureResidency (qint64 budget_bytes = 512 << 20);
+    virtual ~TextureResidency ();
+
+    void initialize ();
+    void release ();
+
+    void set_budget (qint64 bytes);
+    void set_bc6h (bool on);
+
+    GLuint find (const ImagePtr& image);
+    GLuint allocate (const ImagePtr& image);
+    void uploaded (const ImagePtr& image);
+    void set_shown (const QList<ImagePtr>& images);
+    void upload_encoded ();
+
+    Stats stats () const;
+
+signals:
+    /// a BC6H encode is ready for upload_encoded(); queued from the pool
+    void encode_finished ();
+
+    /// @a old_tex is gone; what showed it should show @a new_tex
+    void replaced (GLuint old_tex, GLuint new_tex);
+
+private:
+    void evict (qint64 needed);
+    void remove (QHash<const Image*, Entry>::iterator it);
+};
+
+// vim: sw=4 fdm=marker
@@ -0,0 +1,196 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file TextureUploader.cpp
+ * @brief TextureUploader implementation
+ */
+
+/* includes {{{*/
+#include "TextureUploader.h"
+
+#include "Profiler.h"
+
+#include <string.h>
+/*}}}*/
+
+const int TextureUploader::ring_size;
+const size_t TextureUploader::band_bytes;
+
+TextureUploader::TextureUploader (size_t frame_budget) :/*{{{*/
+    use_pbo(false),
+    pbo_index(0),
+    frame_budget(frame_budget),
+    tex_id(0),
+    rows_done(0)
+{
+    memset(pbo, 0, sizeof(pbo));
+}/*}}}*/
+TextureUploader::~TextureUploader ()/*{{{*/
+{
+}/*}}}*/
+
+void TextureUploader::initialize ()/*{{{*/
+{
+    use_pbo = GLEW_VERSION_2_1;  // pixel buffer objects are core there
+    if (use_pbo) {
+        glGenBuffers(ring_size, pbo);
+    }
+}/*}}}*/
+void TextureUploader::release ()/*{{{*/
+{
+    if (use_pbo) {
+        glDeleteBuffers(ring_size, pbo);
+        memset(pbo, 0, sizeof(pbo));
+    }
+    image.clear();
+}/*}}}*/
+
+void TextureUploader::start (const ImagePtr& image, GLuint tex_id)/*{{{*/
+{
+    this->image = image;
+    this->tex_id = tex_id;
+    rows_done = 0;
+
+    // storage only; no mipmaps until the last band has arrived
+    glBindTexture(GL_TEXTURE_2D, tex_id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D, 0, internal_format(*image),
+                 image->width, image->height,
+                 0, image->format, image->type, NULL);
+}/*}}}*/
+bool TextureUploader::step ()/*{{{*/
+{
+    if ( ! busy()) {
+        return false;
+    }
+
+    // CPU side only: time to hand the rows to the driver
+    ScopedTimer timer ("upload");
+    size_t bpl = image->bytes_per_line();
+    int band_rows = qMax(1, (int)(band_bytes / bpl));
+    size_t sent = 0;
+
+    // a streaming decode may still be filling in the rows further down
+    int ready = image->rows_ready();
+
+    glBindTexture(GL_TEXTURE_2D, tex_id);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    while (rows_done < ready && sent < frame_budget) {
+        int count = qMin(band_rows, ready - rows_done);
+        upload_rows(rows_done, count);
+        rows_done += count;
+        sent += count * bpl;
+    }
+    timer.add_bytes(sent);
+
+    if (rows_done == image->height) {
+        PROFILE_SCOPE("mipmap");
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                        GL_LINEAR_MIPMAP_LINEAR);
+        image.clear();
+        return false;
+    }
+    return true;
+}/*}}}*/
+void TextureUploader::finish ()/*{{{*/
+{
+    size_t budget = frame_budget;
+    frame_budget = (size_t)-1;
+    step();
+    frame_budget = budget;
+}/*}}}*/
+void TextureUploader::cancel ()/*{{{*/
+{
+    image.clear();
+}/*}}}*/
+
+bool TextureUploader::busy () const/*{{{*/
+{
+    return ! image.isNull();
+}/*}}}*/
+int TextureUploader::rows () const/*{{{*/
+{
+    return rows_done;
+}/*}}}*/
+const ImagePtr& TextureUploader::current () const/*{{{*/
+{
+    return image;
+}/*}}}*/
+
+/**
+ * 8-bit sources keep 8 bits a sample, at half the memory of half floats;
+ * the values are the same ones RGBA16F would hold, so they look the same.
+ * Deeper sources need half floats, without alpha if they are opaque.
+ */
+GLenum TextureUploader::internal_format (const Image& image)/*{{{*/
+{
+    switch (image.type) {
+    case GL_UNSIGNED_BYTE:
+    case GL_UNSIGNED_INT_8_8_8_8:
+    case GL_UNSIGNED_INT_8_8_8_8_REV:
+        return GL_RGBA8;
+    default:
+        return image.opaque ? GL_RGB16F_ARB : GL_RGBA16F_ARB;
+    }
+}/*}}}*/
+/**
+ * What a texel of @a internal_format takes in video memory, as far as can
+ * be told.  RGB16F counts as RGBA16F: most drivers pad it to that.
+ */
+qint64 TextureUploader::texel_bytes (GLenum internal_format)/*{{{*/
+{
+    switch (internal_format) {
+    case GL_RGBA8:
+        return 4;
+    default:
+        return 8;
+    }
+}/*}}}*/
+
+void TextureUploader::upload_rows (int y, int count)/*{{{*/
+{
+    const char* src = image->line(y);
+    size_t size = count * image->bytes_per_line();
+
+    if ( ! use_pbo) {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, image->width, count,
+                        image->format, image->type, src);
+        return;
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[pbo_index]);
+    // orphan the previous contents so the driver never waits on the GPU
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, qMax(size, band_bytes),
+                 NULL, GL_STREAM_DRAW);
+    void* dst = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+    if (dst != NULL) {
+        memcpy(dst, src, size);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, image->width, count,
+                        image->format, image->type, (const GLvoid*)0);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (dst == NULL) {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, image->width, count,
+                        image->format, image->type, src);
+    }
+    pbo_index = (pbo_index + 1) % ring_size;
+}/*}}}*/
+
+// vim: sw=4 fdm=marker
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file TextureUploader.h
+ * @brief TextureUploader definition
+ */
+
+#pragma once
+
+#include "Image.h"
+
+/**
+ * Streams an Image into a texture a band of rows at a time.
+ *
+ * Each step() moves at most frame_budget bytes through a ring of pixel
+ * buffer objects, so a huge frame is spread over several paints instead of
+ * stalling one.  Rows are taken as soon as Image::rows_ready() covers them,
+ * so a streaming decode is uploaded while it runs.  Mipmaps are generated
+ * once the last band is in.  Without pixel buffer objects the bands are
+ * sent straight from client memory.  The texture is given the cheapest
+ * internal format that holds the image, see internal_format().
+ *
+ * All methods must be called with the GL context current.
+ */
+class TextureUploader
+{
+public:
+    static const int ring_size = 3;
+    static const size_t band_bytes = 4 << 20;
+
+private:
+    bool use_pbo;
+    GLuint pbo[ring_size];
+    int pbo_index;
+    size_t frame_budget;
+
+    ImagePtr image;
+    GLuint tex_id;
+    int rows_done;
+
+public:
+    TextureUploader (size_t frame_budget = 32 << 20);
+    virtual ~TextureUploader ();
+
+    void initialize ();
+    void release ();
+
+    void start (const ImagePtr& image, GLuint tex_id);
+    bool step ();
+    void finish ();
+    void cancel ();
+
+    bool busy () const;
+    int rows () const;
+    const ImagePtr& current () const;
+
+    static GLenum internal_format (const Image& image);
+    static qint64 texel_bytes (GLenum internal_format);
+
+private:
+    void upload_rows (int y, int count);
+};
+
+// vim: sw=4 fdm=marker
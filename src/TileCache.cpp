@@ -0,0 +1,293 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file TileCache.cpp
+ * @brief TileCache implementation
+ */
+
+/* includes {{{*/
+#include "TileCache.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <QMutex>
+#include <QRunnable>
+#include <QThreadPool>
+/*}}}*/
+
+const int TileCache::tile_size;
+const int TileCache::tile_bytes;
+const int TileCache::uploads_per_frame;
+
+/// texels of image in a tile, the rest is border
+static const int content_size = TileCache::tile_size - 2;
+
+struct TileCache::Pyramid/*{{{*/
+{
+    QMutex mutex;
+    QList<ImagePtr> levels;  ///< levels[0] is the decoded image
+    QAtomicInt stop;
+    bool started;
+    bool done;
+
+    Pyramid () : stop(0), started(false), done(false) {}
+};/*}}}*/
+
+/**
+ * Halves the last level until one tile holds it.  Holds its own reference
+ * to the pyramid, so a cache that moved on to another image just sets stop
+ * and forgets about it.
+ */
+class PyramidJob : public QRunnable/*{{{*/
+{
+    QSharedPointer<TileCache::Pyramid> pyramid;
+
+public:
+    PyramidJob (const QSharedPointer<TileCache::Pyramid>& pyramid) :
+        pyramid(pyramid)
+    {
+    }
+
+    virtual void run ()
+    {
+        ImagePtr level;
+        {
+            QMutexLocker lock (&pyramid->mutex);
+            level = pyramid->levels.last();
+        }
+        while (qMax(level->width, level->height) > content_size
+               && ! (int)pyramid->stop) {
+            level = level->half_size();
+            QMutexLocker lock (&pyramid->mutex);
+            pyramid->levels.append(level);
+        }
+        QMutexLocker lock (&pyramid->mutex);
+        pyramid->done = true;
+    }
+};/*}}}*/
+
+TileCache::TileCache (qint64 budget_bytes) :/*{{{*/
+    max_tiles(0),
+    frame(0),
+    staging(tile_bytes * 2, 0)  // room for RGBA float
+{
+    set_budget(budget_bytes);
+}/*}}}*/
+TileCache::~TileCache ()/*{{{*/
+{
+    if (pyramid) {
+        pyramid->stop = 1;
+    }
+}/*}}}*/
+
+void TileCache::set_budget (qint64 bytes)/*{{{*/
+{
+    max_tiles = qMax<qint64>(4, bytes / tile_bytes);
+}/*}}}*/
+
+/**
+ * Whether @a image has to be drawn in tiles: it is larger than a texture
+ * can be, or its texture alone would be over the budget.
+ */
+bool TileCache::needed (const Image& image, GLint max_texture_size, qint64 budget_bytes)/*{{{*/
+{
+    qint64 bytes = (qint64)image.width * image.height * 8 * 4 / 3;
+    return image.width > max_texture_size || image.height > max_texture_size
+        || bytes > budget_bytes;
+}/*}}}*/
+
+void TileCache::start (const ImagePtr& image, const QRectF& region)/*{{{*/
+{
+    release();
+    this->region = region;
+    pyramid = QSharedPointer<Pyramid>(new Pyramid);
+    pyramid->levels.append(image);
+}/*}}}*/
+void TileCache::release ()/*{{{*/
+{
+    foreach (const Tile& tile, tiles) {
+        glDeleteTextures(1, &tile.tex);
+    }
+    tiles.clear();
+    if (pyramid) {
+        pyramid->stop = 1;
+        pyramid.clear();
+    }
+}/*}}}*/
+
+/**
+ * Makes the tiles under @a visible resident, uploading a few, and returns
+ * what to draw.  @a scale is screen pixels per image pixel.  @a more is set
+ * if the picture is not final yet and another frame should follow.
+ */
+QList<TileCache::Quad> TileCache::prepare (const QRectF& visible, float scale, bool* more)/*{{{*/
+{
+    QList<Quad> quads;
+    *more = false;
+    if ( ! pyramid) {
+        return quads;
+    }
+    frame++;
+
+    QList<ImagePtr> levels;
+    {
+        QMutexLocker lock (&pyramid->mutex);
+        levels = pyramid->levels;
+        if ( ! pyramid->started && levels[0]->complete()) {
+            pyramid->started = true;
+            QThreadPool::globalInstance()->start(new PyramidJob(pyramid));
+        }
+        *more = ! pyramid->done;
+    }
+
+    // the level with about one texel per screen pixel
+    float texel = scale * region.width() / levels[0]->width;
+    int want = texel >= 1.0f ? 0 : (int)floorf(-log2f(texel));
+    int l = qMin(want, levels.size() - 1);
+    const Image& level = *levels[l];
+
+    QRectF v = visible & region;
+    if (v.isEmpty()) {
+        return quads;
+    }
+
+    // visible part in level texels, rows in memory order
+    float sx = level.width / region.width();
+    float sy = level.height / region.height();
+    float top = level.flip_y ? region.bottom() - v.bottom()
+                             : v.top() - region.top();
+    float bottom = top + v.height();
+    int tx0 = qMax(0, (int)floorf((v.left() - region.left()) * sx)) / content_size;
+    int tx1 = qMin(level.width - 1,
+                   (int)ceilf((v.right() - region.left()) * sx)) / content_size;
+    int ty0 = qMax(0, (int)floorf(top * sy)) / content_size;
+    int ty1 = qMin(level.height - 1, (int)ceilf(bottom * sy)) / content_size;
+    if ((tx1 - tx0 + 1) * (ty1 - ty0 + 1) > max_tiles) {
+        // only a coarser level that isn't built yet fits
+        *more = true;
+        return quads;
+    }
+
+    int uploads = 0;
+    int ready = level.rows_ready();
+    for (int ty = ty0; ty <= ty1; ty++) {
+        int ch = qMin(content_size, level.height - ty * content_size);
+        for (int tx = tx0; tx <= tx1; tx++) {
+            int cw = qMin(content_size, level.width - tx * content_size);
+            quint64 key = ((quint64)l << 48) | ((quint64)ty << 24) | tx;
+
+            QHash<quint64, Tile>::iterator it = tiles.find(key);
+            if (it == tiles.end()) {
+                bool rows_in = ready >= qMin(level.height,
+                                             ty * content_size + ch + 1);
+                if ( ! rows_in || uploads == uploads_per_frame
+                     || (tiles.size() >= max_tiles && ! evict())) {
+                    *more = true;
+                    continue;
+                }
+                Tile tile;
+                tile.tex = upload(level, tx, ty);
+                it = tiles.insert(key, tile);
+                uploads++;
+            }
+            it->last_used = frame;
+
+            Quad quad;
+            quad.tex = it->tex;
+            float x = region.left() + tx * content_size / sx;
+            float y = ty * content_size / sy;
+            float h = ch / sy;
+            y = level.flip_y ? region.bottom() - y - h : region.top() + y;
+            quad.rect = QRectF(x, y, cw / sx, h);
+
+            float s0 = 1.0f / tile_size;
+            float s1 = (1.0f + cw) / tile_size;
+            float t0 = 1.0f / tile_size;
+            float t1 = (1.0f + ch) / tile_size;
+            if (level.flip_y) {
+                qSwap(t0, t1);
+            }
+            quad.tex_rect = QRectF(QPointF(s0, t0), QPointF(s1, t1));
+            quads.append(quad);
+        }
+    }
+    return quads;
+}/*}}}*/
+
+/**
+ * Copies tile (@a tx, @a ty) of @a level and its border into a new texture.
+ */
+GLuint TileCache::upload (const Image& level, int tx, int ty)/*{{{*/
+{
+    int bpp = level.bytes_per_pixel();
+    int x0 = tx * content_size - 1;
+    int y0 = ty * content_size - 1;
+    // columns that exist; the rest repeat the edge
+    int first = qMax(0, x0);
+    int last = qMin(level.width - 1, x0 + tile_size - 1);
+
+    char* out = staging.data();
+    for (int j = 0; j < tile_size; j++) {
+        const char* src = level.line(qBound(0, y0 + j, level.height - 1));
+        char* dst = out + (size_t)j * tile_size * bpp;
+        int i = 0;
+        for (; x0 + i < first; i++) {
+            memcpy(dst + i * bpp, src + first * bpp, bpp);
+        }
+        memcpy(dst + i * bpp, src + first * bpp, (last - first + 1) * bpp);
+        i += last - first + 1;
+        for (; i < tile_size; i++) {
+            memcpy(dst + i * bpp, src + last * bpp, bpp);
+        }
+    }
+
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F_ARB, tile_size, tile_size,
+                 0, level.format, level.type, out);
+    return tex;
+}/*}}}*/
+/**
+ * Deletes the least recently drawn tile, unless every tile is in use this
+ * frame.
+ */
+bool TileCache::evict ()/*{{{*/
+{
+    QHash<quint64, Tile>::iterator oldest = tiles.end();
+    for (QHash<quint64, Tile>::iterator it = tiles.begin();
+         it != tiles.end(); ++it) {
+        if (it->last_used < frame
+            && (oldest == tiles.end() || it->last_used < oldest->last_used)) {
+            oldest = it;
+        }
+    }
+    if (oldest == tiles.end()) {
+        return false;
+    }
+    glDeleteTextures(1, &oldest->tex);
+    tiles.erase(oldest);
+    return true;
+}/*}}}*/
+
+// vim: sw=4 fdm=marker
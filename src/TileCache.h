@@ -0,0 +1,95 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file TileCache.h
+ * @brief TileCache definition
+ */
+
+#pragma once
+
+#include "Image.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QRectF>
+
+/**
+ * Shows an image too large for one texture as fixed size tiles.
+ *
+ * The image is cut into tile_size squares on each level of a mip pyramid
+ * built on the CPU, in the background, once the decode has finished.  Only
+ * tiles under the view at the level matching the zoom are uploaded, a few
+ * per frame, and the least recently drawn ones are deleted once the budget
+ * is reached, so GPU memory stays bounded however large the image is.
+ *
+ * Tiles carry a one texel border copied from their neighbours so linear
+ * filtering doesn't show seams.
+ *
+ * All methods but the constructor must be called with the GL context
+ * current.
+ */
+class TileCache
+{
+public:
+    static const int tile_size = 512;
+    static const int tile_bytes = tile_size * tile_size * 8;  ///< RGBA16F
+    static const int uploads_per_frame = 8;
+
+    /// one tile's worth of drawing, in image pixels with y up
+    struct Quad {
+        GLuint tex;
+        QRectF rect;
+        QRectF tex_rect;
+    };
+
+private:
+    struct Tile {
+        GLuint tex;
+        int last_used;
+    };
+    struct Pyramid;
+    friend class PyramidJob;
+
+    QSharedPointer<Pyramid> pyramid;
+    QHash<quint64, Tile> tiles;
+    int max_tiles;
+    int frame;
+
+    QRectF region;  ///< what the image covers, in image pixels, y up
+    QByteArray staging;
+
+public:
+    TileCache (qint64 budget_bytes = 256 << 20);
+    virtual ~TileCache ();
+
+    void set_budget (qint64 bytes);
+
+    void start (const ImagePtr& image, const QRectF& region);
+    void release ();
+
+    QList<Quad> prepare (const QRectF& visible, float scale, bool* more);
+
+    static bool needed (const Image& image, GLint max_texture_size,
+                        qint64 budget_bytes);
+
+private:
+    GLuint upload (const Image& level, int tx, int ty);
+    bool evict ();
+};
+
+// vim: sw=4 fdm=marker
@@ -0,0 +1,130 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ToneMapper.cpp
+ * @brief ToneMapper implementation
+ */
+
+/* includes {{{*/
+#include "ToneMapper.h"
+
+#include "shaders.h"
+/*}}}*/
+
+ToneMapper::ToneMapper () :/*{{{*/
+    current(CURVE)
+{
+    for (int i = 0; i < OPERATOR_COUNT; i++) {
+        variants[i].rect = -1;
+        variants[i].tex_rect = -1;
+    }
+}/*}}}*/
+ToneMapper::~ToneMapper ()/*{{{*/
+{
+}/*}}}*/
+
+/**
+ * Builds every variant; throws what ShaderProgram::build() throws.
+ */
+void ToneMapper::initialize (const QString& cache_dir)/*{{{*/
+{
+    for (int i = 0; i < OPERATOR_COUNT; i++) {
+        Variant& v = variants[i];
+        v.program.set_cache_dir(cache_dir);
+        v.program.build(quad_vertex_source, tonemap_fragment_source,
+                        defines((Operator)i));
+        v.program.bind_block("View", 0);
+        v.rect = v.program.uniform("rect");
+        v.tex_rect = v.program.uniform("tex_rect");
+
+        glUseProgram(v.program.id());
+        glUniform1i(v.program.uniform("scene_tex"), 0);
+    }
+    glUseProgram(variants[current].program.id());
+}/*}}}*/
+void ToneMapper::release ()/*{{{*/
+{
+    for (int i = 0; i < OPERATOR_COUNT; i++) {
+        variants[i].program.release();
+    }
+}/*}}}*/
+
+void ToneMapper::use (Operator op)/*{{{*/
+{
+    current = op;
+    glUseProgram(variants[op].program.id());
+}/*}}}*/
+ToneMapper::Operator ToneMapper::active () const/*{{{*/
+{
+    return current;
+}/*}}}*/
+/**
+ * Per-quad uniforms of the active variant; see quad.vert.
+ */
+void ToneMapper::set_rects (const QRectF& rect, const QRectF& tex_rect)/*{{{*/
+{
+    const Variant& v = variants[current];
+    glUniform4f(v.rect, rect.x(), rect.y(), rect.width(), rect.height());
+    glUniform4f(v.tex_rect, tex_rect.x(), tex_rect.y(),
+                tex_rect.width(), tex_rect.height());
+}/*}}}*/
+
+const char* ToneMapper::name (Operator op)/*{{{*/
+{
+    switch (op) {
+    case RAW:
+        return "raw";
+    case CURVE:
+        return "curve";
+    case REINHARD:
+        return "Reinhard";
+    case ACES:
+        return "ACES filmic";
+    case SRGB:
+        return "linear sRGB";
+    case FALSE_COLOR:
+        return "false colour";
+    default:
+        return "?";
+    }
+}/*}}}*/
+/**
+ * The constants each variant is compiled with.  The curve keeps the old
+ * defaults of tonemap.cg.
+ */
+QByteArray ToneMapper::defines (Operator op)/*{{{*/
+{
+    switch (op) {
+    case CURVE:
+        return "#define TONEMAP_CURVE 1\n"
+               "#define BRIGHT_THRESHOLD 1.2\n"
+               "#define GAMMA 1.0\n";
+    case REINHARD:
+        return "#define TONEMAP_REINHARD 1\n";
+    case ACES:
+        return "#define TONEMAP_ACES 1\n";
+    case SRGB:
+        return "#define TONEMAP_SRGB 1\n";
+    case FALSE_COLOR:
+        return "#define TONEMAP_FALSE_COLOR 1\n"
+               "#define MIDDLE_GREY 0.18\n";
+    default:
+        return QByteArray();
+    }
+}/*}}}*/
+
+// vim: sw=4 fdm=marker
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ToneMapper.h
+ * @brief ToneMapper definition
+ */
+
+#pragma once
+
+#include "ShaderProgram.h"
+
+#include <QRectF>
+
+/**
+ * The tone mapping operators, one specialized program each.
+ *
+ * tonemap.frag is built once per operator with that operator's TONEMAP_*
+ * define and its constants baked in, so no pixel branches on which one is
+ * active.  All of them are built in initialize(), from the program binary
+ * cache after the first run, and use() only switches programs, so changing
+ * operator costs nothing while drawing.
+ *
+ * All methods must be called with the GL context current.
+ */
+class ToneMapper
+{
+public:
+    enum Operator {
+        RAW,            ///< scene values as they are
+        CURVE,          ///< gazer's original exposure curve
+        REINHARD,
+        ACES,           ///< filmic, Narkowicz's ACES fit
+        SRGB,           ///< linear gain and the sRGB transfer function
+        FALSE_COLOR,    ///< bands of two stops around middle grey
+        OPERATOR_COUNT
+    };
+
+private:
+    struct Variant {
+        ShaderProgram program;
+        GLint rect;
+        GLint tex_rect;
+    };
+
+    Variant variants[OPERATOR_COUNT];
+    Operator current;
+
+public:
+    ToneMapper ();
+    virtual ~ToneMapper ();
+
+    void initialize (const QString& cache_dir);
+    void release ();
+
+    void use (Operator op);
+    Operator active () const;
+    void set_rects (const QRectF& rect, const QRectF& tex_rect);
+
+    static const char* name (Operator op);
+
+private:
+    static QByteArray defines (Operator op);
+};
+
+// vim: sw=4 fdm=marker
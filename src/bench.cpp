@@ -0,0 +1,638 @@
+/*
+ * Copyright 2008 Blanton Black
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file bench.cpp
+ * @brief gazer_bench implementation
+ *
+ * Times the viewer's load path and prints one JSON object per line.
+ *
+ * The pixel kernels are timed at every level the CPU supports.  Every level
+ * is checked against the scalar result first, so a fast but wrong kernel
+ * fails loudly instead of winning.
+ *
+ * Then the inputs are synthesized into a temporary directory from a fixed
+ * seed: OpenEXR in each compression at two sizes plus a tiled, mipmapped
+ * one, a 16-bit PPM as dcraw writes it, and 8-bit PNG and JPEG.  Each goes
+ * through the stages GLSurface::load_image takes it through: reading,
+ * decoding, the coarse preview, and the texture upload with its mipmaps.
+ * The upload runs on an offscreen context, which needs EGL; Mesa provides
+ * one without a display.
+ *
+ *   gazer_bench [--quick] [--no-gl] [--keep]
+ */
+
+/* includes {{{*/
+#include "Kernels.h"
+#include "Decoder.h"
+#include "InputFile.h"
+#include "Image.h"
+#include "TextureUploader.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+#include <QtCore>
+#include <QImage>
+
+#include <ImfRgbaFile.h>
+#include <ImfTiledRgbaFile.h>
+
+#ifdef HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+/*}}}*/
+
+static const size_t pixels = 4096 * 4096;  ///< a 16 megapixel frame
+static int repeats = 10;
+
+static double now ()/*{{{*/
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}/*}}}*/
+static void report (const char* stage, const char* input, size_t bytes, double seconds)/*{{{*/
+{
+    printf("{\"stage\": \"%s\", \"input\": \"%s\", \"level\": \"%s\", "
+           "\"bytes\": %lu, \"seconds\": %.6f, \"gb_per_s\": %.3f}\n",
+           stage, input, Kernels::level_name(Kernels::level()),
+           (unsigned long)bytes, seconds, bytes / seconds * 1e-9);
+    fflush(stdout);
+}/*}}}*/
+static void report_error (const char* stage, const char* input, const char* error)/*{{{*/
+{
+    printf("{\"stage\": \"%s\", \"input\": \"%s\", \"error\": \"%s\"}\n",
+           stage, input, error);
+    fflush(stdout);
+}/*}}}*/
+static void fail (const char* kernel, Kernels::Level level)/*{{{*/
+{
+    fprintf(stderr, "%s: %s result differs from scalar\n",
+            kernel, Kernels::level_name(level));
+    exit(1);
+}/*}}}*/
+
+static void bench_kernels ()/*{{{*/
+{
+    std::vector<uint16_t> rgb (pixels * 3);
+    std::vector<uint16_t> half (pixels * 4);
+    srand(1);
+    for (size_t i = 0; i < rgb.size(); i++) {
+        rgb[i] = (uint16_t)rand();
+    }
+    for (size_t i = 0; i < half.size(); i++) {
+        half[i] = (uint16_t)rand();
+    }
+
+    std::vector<uint16_t> rgba_ref (pixels * 4), rgba (pixels * 4);
+    std::vector<uint16_t> swap_ref (rgb), swapped (rgb.size());
+    std::vector<float> float_ref (half.size()), floats (half.size());
+    std::vector<uint8_t> bgra_ref (pixels * 4), bgra (pixels * 4);
+
+    Kernels::Level best = Kernels::level();
+    Kernels::set_level(Kernels::SCALAR);
+    Kernels::swap16(&swap_ref[0], swap_ref.size());
+    Kernels::rgb16_to_rgba16(&rgb[0], &rgba_ref[0], pixels, true);
+    Kernels::half_to_float(&half[0], &float_ref[0], half.size());
+    Kernels::scale_to_bgra8(&float_ref[0], &bgra_ref[0], pixels, 1.1f);
+
+    for (int l = Kernels::SCALAR; l <= best; l++) {
+        Kernels::Level level = (Kernels::Level)l;
+        Kernels::set_level(level);
+
+        /* swap16 {{{*/
+        double t = 0;
+        for (int r = 0; r < repeats; r++) {
+            memcpy(&swapped[0], &rgb[0], rgb.size() * sizeof(uint16_t));
+            double t0 = now();
+            Kernels::swap16(&swapped[0], swapped.size());
+            t += now() - t0;
+        }
+        if (swapped != swap_ref) {
+            fail("swap16", level);
+        }
+        report("swap16", "random", repeats * rgb.size() * sizeof(uint16_t), t);
+        /*}}}*/
+
+        /* rgb16_to_rgba16 {{{*/
+        double t0 = now();
+        for (int r = 0; r < repeats; r++) {
+            Kernels::rgb16_to_rgba16(&rgb[0], &rgba[0], pixels, true);
+        }
+        t = now() - t0;
+        if (rgba != rgba_ref) {
+            fail("rgb16_to_rgba16", level);
+        }
+        report("rgb16_to_rgba16", "random",
+               repeats * pixels * 7 * sizeof(uint16_t), t);
+        /*}}}*/
+
+        /* half_to_float {{{*/
+        t0 = now();
+        for (int r = 0; r < repeats; r++) {
+            Kernels::half_to_float(&half[0], &floats[0], half.size());
+        }
+        t = now() - t0;
+        // bit exact, except F16C quiets signalling NaNs
+        for (size_t i = 0; i < floats.size(); i++) {
+            if (memcmp(&floats[i], &float_ref[i], sizeof(float)) != 0
+                && ! (floats[i] != floats[i] && float_ref[i] != float_ref[i])) {
+                fail("half_to_float", level);
+            }
+        }
+        report("half_to_float", "random",
+               repeats * half.size() * (sizeof(uint16_t) + sizeof(float)), t);
+        /*}}}*/
+
+        /* scale_to_bgra8 {{{*/
+        t0 = now();
+        for (int r = 0; r < repeats; r++) {
+            Kernels::scale_to_bgra8(&float_ref[0], &bgra[0], pixels, 1.1f);
+        }
+        t = now() - t0;
+        if (bgra != bgra_ref) {
+            fail("scale_to_bgra8", level);
+        }
+        report("scale_to_bgra8", "random",
+               repeats * pixels * 4 * (sizeof(float) + sizeof(uint8_t)), t);
+        /*}}}*/
+    }
+
+    // the pipeline runs at the level the viewer would pick
+    Kernels::set_level(best);
+}/*}}}*/
+
+/* synthesized inputs {{{*/
+/**
+ * A scene the codecs can't cheat on: a gradient over five stops, a few
+ * specular highlights, fine detail and a little noise.  Same pixels every
+ * run for a given size.
+ */
+static std::vector<float> scene (int w, int h)/*{{{*/
+{
+    std::vector<float> rgb ((size_t)w * h * 3);
+    srand(1);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            float u = (float)x / w;
+            float v = (float)y / h;
+            float base = 0.02f * exp2f(5.0f * u);
+            float detail = 0.5f + 0.5f * sinf(x * 0.37f) * cosf(y * 0.23f);
+            float spot = (x % 509 < 3 && y % 311 < 3) ? 40.0f : 0.0f;
+            float* p = &rgb[((size_t)y * w + x) * 3];
+            for (int c = 0; c < 3; c++) {
+                float noise = (rand() & 0xff) * (1.0f / 255.0f) - 0.5f;
+                p[c] = base * (0.6f + 0.4f * detail) * (0.8f + 0.2f * v * c)
+                       + spot + 0.01f * noise * base;
+            }
+        }
+    }
+    return rgb;
+}/*}}}*/
+static uint16_t to_u16 (float v)/*{{{*/
+{
+    v = v / (v + 1.0f);  // keep the highlights apart
+    return (uint16_t)(v * 65535.0f + 0.5f);
+}/*}}}*/
+
+static void write_exr (const QString& path, int w, int h, const std::vector<float>& rgb, Imf::Compression compression, bool tiled)/*{{{*/
+{
+    std::vector<Imf::Rgba> pixels ((size_t)w * h);
+    for (size_t i = 0; i < pixels.size(); i++) {
+        pixels[i] = Imf::Rgba(rgb[i * 3], rgb[i * 3 + 1], rgb[i * 3 + 2], 1.0f);
+    }
+    if ( ! tiled) {
+        Imf::RgbaOutputFile file (qPrintable(path), w, h, Imf::WRITE_RGBA,
+                                  1, Imath::V2f(0, 0), 1,
+                                  Imf::INCREASING_Y, compression);
+        file.setFrameBuffer(&pixels[0], 1, w);
+        file.writePixels(h);
+        return;
+    }
+
+    Imf::TiledRgbaOutputFile file (qPrintable(path), w, h, 256, 256,
+                                   Imf::MIPMAP_LEVELS, Imf::ROUND_DOWN,
+                                   Imf::WRITE_RGBA, Imath::V2f(0, 0), 1,
+                                   Imf::INCREASING_Y, compression);
+    for (int level = 0; level < file.numLevels(); level++) {
+        int lw = file.levelWidth(level);
+        int lh = file.levelHeight(level);
+        // box filtered from the top level, good enough to have pixels
+        int step = 1 << level;
+        std::vector<Imf::Rgba> reduced ((size_t)lw * lh);
+        for (int y = 0; y < lh; y++) {
+            for (int x = 0; x < lw; x++) {
+                reduced[(size_t)y * lw + x] = pixels[(size_t)y * step * w + x * step];
+            }
+        }
+        file.setFrameBuffer(&reduced[0], 1, lw);
+        file.writeTiles(0, file.numXTiles(level) - 1,
+                        0, file.numYTiles(level) - 1, level);
+    }
+}/*}}}*/
+/**
+ * 16-bit binary PPM, big-endian, the way `dcraw -4 -c` writes it.
+ */
+static void write_ppm16 (const QString& path, int w, int h, const std::vector<float>& rgb)/*{{{*/
+{
+    QFile file (path);
+    if ( ! file.open(QIODevice::WriteOnly)) {
+        throw "could not write input";
+    }
+    file.write(QString("P6\n%1 %2\n65535\n").arg(w).arg(h).toAscii());
+    QByteArray row (w * 3 * 2, 0);
+    for (int y = 0; y < h; y++) {
+        uchar* dst = (uchar*)row.data();
+        const float* src = &rgb[(size_t)y * w * 3];
+        for (int i = 0; i < w * 3; i++) {
+            uint16_t v = to_u16(src[i]);
+            dst[i * 2] = v >> 8;
+            dst[i * 2 + 1] = v & 0xff;
+        }
+        file.write(row);
+    }
+}/*}}}*/
+static void write_qimage (const QString& path, int w, int h, const std::vector<float>& rgb, const char* format)/*{{{*/
+{
+    QImage image (w, h, QImage::Format_RGB32);
+    for (int y = 0; y < h; y++) {
+        QRgb* dst = (QRgb*)image.scanLine(y);
+        const float* src = &rgb[(size_t)y * w * 3];
+        for (int x = 0; x < w; x++) {
+            dst[x] = qRgb(to_u16(src[x * 3]) >> 8,
+                          to_u16(src[x * 3 + 1]) >> 8,
+                          to_u16(src[x * 3 + 2]) >> 8);
+        }
+    }
+    if ( ! image.save(path, format, 90)) {
+        throw "could not write input";
+    }
+}/*}}}*/
+
+/**
+ * Writes every input into @a dir and returns their paths.  The file names
+ * are what the results are labelled with.
+ */
+static QStringList synthesize (const QString& dir, bool quick)/*{{{*/
+{
+    static const struct {
+        Imf::Compression compression;
+        const char* name;
+    } compressions[] = {
+        { Imf::NO_COMPRESSION, "none" },
+        { Imf::RLE_COMPRESSION, "rle" },
+        { Imf::ZIPS_COMPRESSION, "zips" },
+        { Imf::ZIP_COMPRESSION, "zip" },
+        { Imf::PIZ_COMPRESSION, "piz" },
+        { Imf::PXR24_COMPRESSION, "pxr24" },
+        { Imf::B44_COMPRESSION, "b44" },
+    };
+    QList<QSize> sizes;
+    sizes << QSize(1920, 1080);
+    if ( ! quick) {
+        sizes << QSize(4096, 2160);
+    }
+
+    QStringList inputs;
+    foreach (QSize size, sizes) {
+        int w = size.width();
+        int h = size.height();
+        std::vector<float> rgb = scene(w, h);
+        QString prefix = QString("%1/%2x%3").arg(dir).arg(w).arg(h);
+
+        for (size_t i = 0; i < sizeof(compressions) / sizeof(compressions[0]); i++) {
+            QString path = prefix + "-" + compressions[i].name + ".exr";
+            write_exr(path, w, h, rgb, compressions[i].compression, false);
+            inputs << path;
+        }
+        inputs << prefix + "-zip-tiled.exr";
+        write_exr(inputs.last(), w, h, rgb, Imf::ZIP_COMPRESSION, true);
+
+        inputs << prefix + "-16bit.ppm";
+        write_ppm16(inputs.last(), w, h, rgb);
+        inputs << prefix + ".png";
+        write_qimage(inputs.last(), w, h, rgb, "png");
+        inputs << prefix + ".jpg";
+        write_qimage(inputs.last(), w, h, rgb, "jpg");
+    }
+    return inputs;
+}/*}}}*/
+/*}}}*/
+
+/* offscreen GL {{{*/
+#ifdef HAVE_EGL
+/**
+ * A 3.2 core context with no surface at all; the texture is all the upload
+ * needs.  Mesa's surfaceless platform works without a display server.
+ */
+class OffscreenContext
+{
+private:
+    EGLDisplay display;
+    EGLContext context;
+
+public:
+    OffscreenContext () : display(EGL_NO_DISPLAY), context(EGL_NO_CONTEXT) {}
+    ~OffscreenContext ()/*{{{*/
+    {
+        if (context != EGL_NO_CONTEXT) {
+            eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                           EGL_NO_CONTEXT);
+            eglDestroyContext(display, context);
+        }
+        if (display != EGL_NO_DISPLAY) {
+            eglTerminate(display);
+        }
+    }/*}}}*/
+
+    const char* create ()/*{{{*/
+    {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+            eglGetProcAddress("eglGetPlatformDisplayEXT");
+        const char* client = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+        if (get_platform_display != NULL && client != NULL
+            && strstr(client, "EGL_MESA_platform_surfaceless") != NULL) {
+            display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                           EGL_DEFAULT_DISPLAY, NULL);
+        } else {
+            display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        }
+        if (display == EGL_NO_DISPLAY || ! eglInitialize(display, NULL, NULL)) {
+            return "no EGL display";
+        }
+
+        static const EGLint config_attribs[] = {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_NONE
+        };
+        EGLConfig config;
+        EGLint count = 0;
+        if ( ! eglChooseConfig(display, config_attribs, &config, 1, &count)
+             || count == 0) {
+            return "no EGL config";
+        }
+
+        eglBindAPI(EGL_OPENGL_API);
+        static const EGLint context_attribs[] = {
+            EGL_CONTEXT_MAJOR_VERSION, 3,
+            EGL_CONTEXT_MINOR_VERSION, 2,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT,
+                                   context_attribs);
+        if (context == EGL_NO_CONTEXT) {
+            return "no 3.2 core context";
+        }
+        if ( ! eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+            return "could not make the context current";
+        }
+
+        // glewInit() also wants a GLX display; only the GL entry points matter
+        glewExperimental = GL_TRUE;
+        if (glewContextInit() != GLEW_OK) {
+            return "GLEW could not load the GL entry points";
+        }
+        glGetError();
+        return NULL;
+    }/*}}}*/
+};
+#endif
+/*}}}*/
+
+/* pipeline {{{*/
+/**
+ * The dcraw stage of RawDecoder: 16-bit PPM rows, byte swapped and padded
+ * to RGBA into an Image.  Read from the file here rather than a pipe,
+ * so only the conversion is timed.
+ */
+static ImagePtr convert_ppm16 (const InputFile& file)/*{{{*/
+{
+    int w, h, max, offset;
+    QByteArray header = file.header(64);
+    if (sscanf(header.constData(), "P6 %d %d %d%n", &w, &h, &max, &offset) != 3
+        || max != 0xffff) {
+        throw "not a 16-bit PPM";
+    }
+    offset++;  // the single whitespace after the maximum
+    size_t ppm_bpl = (size_t)w * 3 * sizeof(uint16_t);
+    if (file.size() < (size_t)offset + ppm_bpl * h) {
+        throw "PPM truncated";
+    }
+
+    ImagePtr image (new Image(w, h, GL_RGBA, GL_UNSIGNED_SHORT));
+    image->flip_y = true;
+    for (int y = 0; y < h; y++) {
+        Kernels::rgb16_to_rgba16((const uint16_t*)(file.data() + offset + y * ppm_bpl),
+                                 (uint16_t*)image->line(y), w, true);
+    }
+    return image;
+}/*}}}*/
+
+static void bench_input (const QString& path, TextureUploader* uploader, GLuint tex_id, GLuint coarse_tex_id)/*{{{*/
+{
+    QByteArray name = QFileInfo(path).fileName().toUtf8();
+    const char* input = name.constData();
+
+    /* read {{{*/
+    // warm in the page cache, as the readahead leaves it for the viewer
+    size_t file_size = 0;
+    double t0 = now();
+    for (int r = 0; r < repeats; r++) {
+        InputFile file (path);
+        file.data();
+        file_size = file.size();
+    }
+    report("read", input, repeats * file_size, now() - t0);
+    /*}}}*/
+
+    /* decode {{{*/
+    ImagePtr image;
+    const char* stage = "decode";
+    try {
+        t0 = now();
+        for (int r = 0; r < repeats; r++) {
+            image.clear();  // so the arena can hand the buffer straight back
+            if (path.endsWith(".ppm")) {
+                stage = "convert ppm16";
+                InputFile file (path);
+                image = convert_ppm16(file);
+            } else {
+                image = Decoder::decode(path);
+            }
+        }
+        report(stage, input, repeats * image->byte_size(), now() - t0);
+    } catch (const char* error) {
+        report_error(stage, input, error);
+        return;
+    }
+    /*}}}*/
+
+    /* coarse preview {{{*/
+    ImagePtr coarse;
+    t0 = now();
+    for (int r = 0; r < repeats; r++) {
+        coarse = image->subsample(256);
+    }
+    report("subsample", input, repeats * image->byte_size(), now() - t0);
+
+    t0 = now();
+    for (int r = 0; r < repeats; r++) {
+        image->half_size();
+    }
+    report("half_size", input, repeats * image->byte_size(), now() - t0);
+    /*}}}*/
+
+    if (uploader == NULL) {
+        return;
+    }
+
+    /* upload {{{*/
+    t0 = now();
+    for (int r = 0; r < repeats; r++) {
+        glBindTexture(GL_TEXTURE_2D, coarse_tex_id);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, TextureUploader::internal_format(*coarse),
+                     coarse->width, coarse->height,
+                     0, coarse->format, coarse->type, coarse->data);
+        glFinish();
+    }
+    report("upload coarse", input, repeats * coarse->byte_size(), now() - t0);
+
+    // the whole image in one go, as show_frame() does; includes the mipmaps
+    t0 = now();
+    for (int r = 0; r < repeats; r++) {
+        uploader->start(image, tex_id);
+        uploader->finish();
+        glFinish();
+    }
+    report("upload", input, repeats * image->byte_size(), now() - t0);
+
+    GLenum error = glGetError();
+    if (error != GL_NO_ERROR) {
+        char message[32];
+        snprintf(message, sizeof(message), "GL error 0x%04x", error);
+        report_error("upload", input, message);
+    }
+    /*}}}*/
+}/*}}}*/
+/*}}}*/
+
+static void usage (const char* argv0)/*{{{*/
+{
+    fprintf(stderr,
+            "usage: %s [--quick] [--no-gl] [--keep]\n"
+            "  --quick   smaller inputs and fewer repeats\n"
+            "  --no-gl   skip the texture upload\n"
+            "  --keep    leave the synthesized inputs in place\n",
+            argv0);
+}/*}}}*/
+
+int main (int argc, char** argv)/*{{{*/
+{
+    QCoreApplication app (argc, argv);  // image format plugins
+
+    bool quick = false;
+    bool gl = true;
+    bool keep = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            quick = true;
+        } else if (strcmp(argv[i], "--no-gl") == 0) {
+            gl = false;
+        } else if (strcmp(argv[i], "--keep") == 0) {
+            keep = true;
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (quick) {
+        repeats = 3;
+    }
+
+    bench_kernels();
+
+    // one thread, so the numbers don't depend on the machine's core count
+    Decoder::set_exr_threads(0);
+
+    QString dir = QString("%1/gazer_bench-%2")
+        .arg(QDir::tempPath()).arg(QCoreApplication::applicationPid());
+    if ( ! QDir().mkpath(dir)) {
+        fprintf(stderr, "could not create %s\n", qPrintable(dir));
+        return 1;
+    }
+    QStringList inputs;
+    try {
+        inputs = synthesize(dir, quick);
+    } catch (const char* error) {
+        fprintf(stderr, "%s\n", error);
+        return 1;
+    }
+
+    TextureUploader* uploader = NULL;
+    GLuint textures[2] = { 0, 0 };
+#ifdef HAVE_EGL
+    OffscreenContext context;
+    if (gl) {
+        const char* error = context.create();
+        if (error != NULL) {
+            report_error("upload", "gl", error);
+        } else {
+            fprintf(stderr, "GL: %s, %s\n", glGetString(GL_RENDERER),
+                    glGetString(GL_VERSION));
+            glGenTextures(2, textures);
+            uploader = new TextureUploader;
+            uploader->initialize();
+        }
+    }
+#else
+    if (gl) {
+        report_error("upload", "gl", "built without EGL");
+    }
+#endif
+
+    foreach (QString path, inputs) {
+        bench_input(path, uploader, textures[0], textures[1]);
+    }
+
+    if (uploader != NULL) {
+        uploader->release();
+        delete uploader;
+        glDeleteTextures(2, textures);
+    }
+
+    if (keep) {
+        fprintf(stderr, "inputs left in %s\n", qPrintable(dir));
+    } else {
+        foreach (QString path, inputs) {
+            QFile::remove(path);
+        }
+        QDir().rmdir(dir);
+    }
+    return 0;
+}/*}}}*/
+
+// vim: sw=4 fdm=marker
@@ -21,18 +21,134 @@
 
 /* includes {{{*/
 #include "MainWindow.h"
+#include "BatchConverter.h"
+#include "Decoder.h"
+#include "Profiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <QApplication>
+#include <QCoreApplication>
+#include <QThread>
 #include <apr_getopt.h>
 /*}}}*/
 
-int main (int argc, char **argv)/*{{{*/
+static const apr_getopt_option_t batch_options[] = {/*{{{*/
+    { "batch",    'b', 0, "convert the files and exit; no window" },
+    { "output",   'o', 1, "directory to write to (default .)" },
+    { "format",   'f', 1, "jpg, png, tiff, ... or exr (default jpg)" },
+    { "exposure", 'e', 1, "exposure of the tone curve (default 1.1)" },
+    { "size",     's', 1, "longest side of the output (default full size)" },
+    { "jobs",     'j', 1, "files converted at once (default one per core)" },
+    { "help",     'h', 0, "show this help" },
+    { NULL, 0, 0, NULL }
+};/*}}}*/
+
+static void usage (const char* argv0)/*{{{*/
 {
-    QApplication app (argc, argv);
+    fprintf(stderr, "usage: %s [files...]\n"
+                    "       %s --batch [options] files...\n\n",
+            argv0, argv0);
+    for (const apr_getopt_option_t* o = batch_options; o->name; o++) {
+        fprintf(stderr, "  -%c, --%-10s %s %s\n", o->optch, o->name,
+                o->has_arg ? "ARG" : "   ", o->description);
+    }
+}/*}}}*/
+static bool batch_requested (int argc, char** argv)/*{{{*/
+{
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--batch") == 0 || strcmp(argv[i], "-b") == 0) {
+            return true;
+        }
+    }
+    return false;
+}/*}}}*/
+
+/**
+ * gazer --batch: converts the files on the command line to tone mapped
+ * proxies and exits, without ever touching the display.
+ */
+static int run_batch (int& argc, char** argv)/*{{{*/
+{
+    QCoreApplication app (argc, argv);
+
+    apr_pool_t* pool;
+    apr_pool_create(&pool, NULL);
+    apr_getopt_t* opt;
+    apr_getopt_init(&opt, pool, argc, argv);
+
+    BatchConverter converter;
+    int jobs = QThread::idealThreadCount();
+    int optch;
+    const char* arg;
+    apr_status_t status;
+    while ((status = apr_getopt_long(opt, batch_options, &optch, &arg))
+           == APR_SUCCESS) {
+        switch (optch) {
+        case 'o':
+            converter.set_output_dir(QString::fromLocal8Bit(arg));
+            break;
+        case 'f':
+            converter.set_format(arg);
+            break;
+        case 'e':
+            converter.set_exposure(atof(arg));
+            break;
+        case 's':
+            converter.set_max_size(atoi(arg));
+            break;
+        case 'j':
+            jobs = qMax(1, atoi(arg));
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        }
+    }
+    if (status != APR_EOF || opt->ind >= argc) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    QStringList files;
+    for (int i = opt->ind; i < argc; i++) {
+        files << QString::fromLocal8Bit(argv[i]);
+    }
 
+    // the cores go to whole files first, then to bands within them
+    converter.set_jobs(jobs);
+    Decoder::set_exr_threads(qMax(1, QThread::idealThreadCount() / jobs));
+    int failed = converter.run(files);
+    if (failed > 0) {
+        fprintf(stderr, "%d of %d files failed\n", failed, files.size());
+        return 1;
+    }
+    return 0;
+}/*}}}*/
+
+int main (int argc, char **argv)/*{{{*/
+{
     apr_initialize();
     atexit(apr_terminate);
 
+    // GAZER_TRACE=file.json records from the start and writes it at exit
+    const char* trace = getenv("GAZER_TRACE");
+    if (trace != NULL) {
+        Profiler::set_enabled(true);
+    }
+
+    if (batch_requested(argc, argv)) {
+        int status = run_batch(argc, argv);
+        if (trace != NULL) {
+            Profiler::export_trace(trace);
+        }
+        return status;
+    }
+
+    QApplication app (argc, argv);
+
     MainWindow win;
     win.show();
 
@@ -42,7 +158,11 @@ int main (int argc, char **argv)/*{{{*/
     }
     win.set_file_list(file_list);
 
-    return app.exec();
+    int status = app.exec();
+    if (trace != NULL) {
+        Profiler::export_trace(trace);
+    }
+    return status;
 }/*}}}*/
 
 // vim: sw=4 fdm=marker